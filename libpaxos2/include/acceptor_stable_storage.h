@@ -1,18 +1,23 @@
 #ifndef ACCEPTOR_STABLE_STORAGE_H_C2XN5QX9
 #define ACCEPTOR_STABLE_STORAGE_H_C2XN5QX9
 
-int stablestorage_init(int acceptor_id);
-void stablestorage_do_recovery();
-int stablestorage_shutdown();
+typedef struct acceptor_storage_t acceptor_storage;
 
-void stablestorage_tx_begin();
-void stablestorage_tx_end();
+//If recover is set, opens the existing DB instead of creating a new one.
+// Groups other than 0 have "_g<group>" appended to the environment path.
+// Returns NULL for error
+acceptor_storage * stablestorage_init(int group, int acceptor_id, int recover);
+//Closes the DB and frees the storage
+int stablestorage_shutdown(acceptor_storage * s);
 
-acceptor_record * stablestorage_get_record(iid_t iid);
+void stablestorage_tx_begin(acceptor_storage * s);
+void stablestorage_tx_end(acceptor_storage * s);
 
-acceptor_record * stablestorage_save_accept(accept_req * ar);
-acceptor_record * stablestorage_save_prepare(prepare_req * pr, acceptor_record * rec);
+acceptor_record * stablestorage_get_record(acceptor_storage * s, iid_t iid);
 
-acceptor_record * stablestorage_save_final_value(char * value, size_t size, iid_t iid, ballot_t ballot);
+acceptor_record * stablestorage_save_accept(acceptor_storage * s, accept_req * ar);
+acceptor_record * stablestorage_save_prepare(acceptor_storage * s, prepare_req * pr, acceptor_record * rec);
 
-#endif /* end of include guard: ACCEPTOR_STABLE_STORAGE_H_C2XN5QX9 */
+acceptor_record * stablestorage_save_final_value(acceptor_storage * s, char * value, size_t size, iid_t iid, ballot_t ballot);
+
+#endif /* end of include guard: ACCEPTOR_STABLE_STORAGE_H_C2XN5QX9 */
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef CLIENTS_HANDLER_H_K3W9QZ1R
+#define CLIENTS_HANDLER_H_K3W9QZ1R
+
+#include <netinet/in.h>
+
+//One for each values handler, see proposer_clients_handler.c
+typedef struct ch_state_t ch_state;
+
+ch_state * ch_new(vh_state * vh, int group);
+void ch_free(ch_state * ch);
+int ch_init(ch_state * ch);
+void ch_shutdown(ch_state * ch);
+void ch_register(ch_state * ch, unsigned int client_id, struct sockaddr_in * addr);
+void ch_notify(ch_state * ch, unsigned int client_id, unsigned int seqno, iid_t iid, int result);
+void ch_submit(ch_state * ch, vh_value_wrapper * vw);
+void ch_check_held(ch_state * ch);
+void ch_delivered(ch_state * ch, unsigned int client_id, unsigned int seqno);
+int ch_is_delivered(ch_state * ch, vh_value_wrapper * vw);
+#endif /* end of include guard: CLIENTS_HANDLER_H_K3W9QZ1R */
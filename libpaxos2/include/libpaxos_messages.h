@@ -13,7 +13,8 @@ typedef enum pax_msg_code_e {
     repeat_reqs=16,     //For progress, L -> A
     submit=32,          //Clients to leader
     leader_announce=64, //Oracle to proposers
-    alive_ping=65       //Proposers to oracle
+    alive_ping=65,      //Proposers to oracle
+    submit_reply=66     //Leader to client
 } paxos_msg_code;
 
 typedef struct paxos_msg_t {
@@ -38,6 +39,9 @@ typedef struct prepare_ack_t {
     iid_t iid;
     ballot_t ballot;
     ballot_t value_ballot;
+    //Highest instance accepted by the acceptor, bounds the holes
+    // a new leader must fill (and the reads under a leader lease)
+    iid_t highest_accepted_iid;
     size_t value_size;
     char value[0];
 } prepare_ack;
@@ -63,6 +67,50 @@ typedef struct accept_ack_t {
 } accept_ack;
 #define ACCEPT_ACK_SIZE(M) (M->value_size + sizeof(accept_ack))
 
+/* 
+    Client values: sent by clients in submit messages, tagged with the
+    client id and a sequence number (client_id 0 means anonymous).
+    A submit message is a value_batch, so that a client can send 
+    multiple values in a single packet.
+    Instance values: the leader packs the values submitted by clients
+    into a single instance value, learners unpack them before delivery
+*/
+typedef struct client_value_t {
+    unsigned int    client_id;
+    unsigned int    seqno;
+    size_t          value_size;
+    char            value[0];
+} client_value;
+#define CLIENT_VALUE_SIZE(M) (M->value_size + sizeof(client_value))
+
+typedef struct value_batch_t {
+    short int   count;
+    char        data[0];
+} value_batch;
+
+/* 
+    Acceptors membership change, a client value with the reserved
+    client_id MEMBERSHIP_CLIENT_ID. Bit i of members is set if acceptor
+    i is a member, a quorum set to 0 is computed from the members.
+*/
+typedef struct membership_cmd_t {
+    unsigned int    members;
+    short int       phase1_quorum;
+    short int       phase2_quorum;
+    short int       fast_quorum;
+} membership_cmd;
+#define MEMBERSHIP_CLIENT_ID 0xFFFFFFFFU
+
+/* 
+    Sent by a merged learner to the leader of a group behind the 
+    others, a client value with the reserved client_id 
+    NOOP_REQUEST_CLIENT_ID. The leader fills the instances up to 
+    target_iid with no-ops, if it has no value for them. Never decided.
+*/
+typedef struct noop_request_t {
+    iid_t           target_iid;
+} noop_request;
+#define NOOP_REQUEST_CLIENT_ID 0xFFFFFFFEU
 
 /* 
     Batches to send multiple paxos messages in a single packet
@@ -85,11 +133,14 @@ size_t prepare_ack_batch_size_calc(prepare_ack_batch * pab);
 #define PREPARE_ACK_BATCH_SIZE(M) (prepare_ack_batch_size_calc(M))
 
 
+//Acceptor i handles the batch only if bit i of 'acceptors' is set
 typedef struct accept_req_batch_t {
     short int count;
     short int proposer_id;
+    unsigned int acceptors;
     char data[0];
 } accept_req_batch;
+#define ALL_ACCEPTORS ((1U << N_OF_ACCEPTORS) - 1)
 size_t accept_req_batch_size_calc(accept_req_batch * aab);
 #define ACCEPT_REQ_BATCH_SIZE(M) (accept_req_batch_size_calc(M))
 
@@ -119,6 +170,16 @@ typedef struct alive_ping_msg_t {
     long unsigned int sequence_number;
 } alive_ping_msg;
 
+/* 
+    Outcome of a submitted value, unicast by the leader to the client
+*/
+typedef struct submit_reply_msg_t {
+    unsigned int    client_id;
+    unsigned int    seqno;
+    iid_t           iid;
+    int             result;
+} submit_reply_msg;
+
 
 
 #endif /* end of include guard: LIBPAXOS_MESSAGES_H_HP8GZLGD */
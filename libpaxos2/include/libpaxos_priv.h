@@ -16,9 +16,83 @@
 */
 //Suspends the learner, cancelling its events, 
 // but leaves the underlying libevent loop running.
-void learner_suspend();
+void learner_suspend(paxos_learner * l);
 
-int learner_is_closed(iid_t iid);
+int learner_is_closed(paxos_learner * l, iid_t iid);
+//Time the instance was closed, -1 if not closed (or already delivered)
+int learner_closed_time(paxos_learner * l, iid_t iid, struct timeval * tv);
+
+//Used by the leader in fast mode: 1 if some accept was 
+// received for the instance (or for a later one)
+int learner_seen_accepts(paxos_learner * l, iid_t iid);
+
+/*
+    The runtime configuration (see paxos_config in libpaxos.h)
+*/
+extern paxos_config paxos_conf;
+
+//Checks the configuration, loading PAXOS_CONFIG if needed.
+// Invoked by every role before starting, 
+// returns -1 if the configuration is not valid
+int paxos_config_ready();
+
+//Computes the quorums left to 0 for n acceptors and checks that
+// they intersect, returns -1 if they don't
+int paxos_quorums_check(int n, int * p1, int * p2, int * fast);
+
+/*
+    Acceptors membership, starting from instance from_iid
+    (see pax_submit_membership in libpaxos.h).
+    Bit i of members is set if acceptor i is a member,
+    acceptors is the number of members.
+*/
+typedef struct paxos_membership_t {
+    iid_t           from_iid;
+    unsigned int    members;
+    int             acceptors;
+    int             phase1_quorum;
+    int             phase2_quorum;
+    int             fast_quorum;
+} paxos_membership;
+#define IS_MEMBER(M, A) (((M)->members & (1U << (A))) != 0)
+
+//The membership of the given instance, as known by this learner.
+// Valid for instances below current + membership_alpha, that is 
+// all the ones in the proposer and learner arrays
+const paxos_membership * learner_membership(paxos_learner * l, iid_t iid);
+
+//Expands to the address, port arguments of udp_sendbuf_new and 
+// udp_receiver_new, i.e. CONF_NET(acceptors_net)
+#define CONF_NET(N) CONF_NET_GROUP(N, 0)
+//The same, for group G
+#define CONF_NET_GROUP(N, G) paxos_conf.N.addr, \
+    (paxos_conf.N.port + ((G) * paxos_conf.group_port_stride))
+
+#if defined(PAXOS_FAST_MODE) && defined(PAXOS_MULTI_LEADER)
+#error "PAXOS_FAST_MODE and PAXOS_MULTI_LEADER cannot be used together"
+#endif
+#if defined(PAXOS_FAST_MODE) && defined(PROPOSER_THRIFTY_P2)
+#error "PAXOS_FAST_MODE and PROPOSER_THRIFTY_P2 cannot be used together"
+#endif
+
+//In fast mode, the first round of each instance (the one started
+// with FIRST_BALLOT by any proposer) is a fast round
+#ifdef PAXOS_FAST_MODE
+#define IS_FAST_BALLOT(B) ((B) / MAX_N_OF_PROPOSERS == 1)
+#else
+#define IS_FAST_BALLOT(B) (0)
+#endif
+
+//Like learner_new, but the deliver function receives each instance 
+// value as it was decided (a batch of client values), without unpacking.
+// Used by proposers and acceptors
+paxos_learner * learner_new_instances(struct event_base * eb, int group, deliver_callback f, void * arg);
+
+//Starts a thread with a new event base, invokes init on it and
+// then runs the libevent loop. Used by learner_init, acceptor_init, ...
+// Returns when init completed, -1 if it failed
+typedef int (* paxos_thread_init)(struct event_base * eb, void * arg);
+int paxos_thread_start(paxos_thread_init init, void * arg);
 
 typedef accept_ack acceptor_record;
 
@@ -95,7 +169,6 @@ typedef accept_ack acceptor_record;
    works only if LEARNER_ARRAY_SIZE is a power of 2.
 */
 // #define GET_LEA_INDEX(n) (n & (LEARNER_ARRAY_SIZE-1))
-#define GET_LEA_INSTANCE(I) &learner_state[((I) & (LEARNER_ARRAY_SIZE-1))]
 
 // 
 // 
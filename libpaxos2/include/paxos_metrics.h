@@ -0,0 +1,49 @@
+#ifndef PAXOS_METRICS_H_R7T2LM4X
+#define PAXOS_METRICS_H_R7T2LM4X
+
+typedef enum paxos_metric_type_e {
+    metric_counter,
+    metric_gauge,
+    metric_histogram
+} paxos_metric_type;
+
+/*
+    A metric is registered once and never removed. It can be updated
+    by any thread without locks, readers may see a histogram
+    that is being updated (i.e. count and sum slightly out of sync).
+    For histograms, value is the sum of the samples.
+    Metrics of a role context have a label that tells the context apart
+    (i.e. group="1",acceptor="2"), dumped as Prometheus labels.
+*/
+#define PAXOS_METRIC_LABEL_SIZE 48
+typedef struct paxos_metric_t {
+    const char *        name;
+    char                label[PAXOS_METRIC_LABEL_SIZE];
+    paxos_metric_type   type;
+    volatile long       value;
+    volatile long       count;
+    volatile long       buckets[PAXOS_METRICS_BUCKETS];
+} paxos_metric;
+
+//Returns the metric with the given name, creating it if needed.
+// Never returns NULL: if the table is full, a shared placeholder
+// that is never dumped is returned
+paxos_metric * metrics_register(const char * name, paxos_metric_type type);
+
+//Like metrics_register, for the context with the given label
+// (empty for process-wide metrics)
+paxos_metric * metrics_register_label(const char * name, const char * label, 
+    paxos_metric_type type);
+
+#define METRIC_INC(M) __sync_fetch_and_add(&(M)->value, 1)
+#define METRIC_ADD(M, V) __sync_fetch_and_add(&(M)->value, (long)(V))
+#define METRIC_SET(M, V) ((M)->value = (long)(V))
+void metrics_observe(paxos_metric * m, long unsigned int usecs);
+
+//Serves the metrics dump on PAXOS_METRICS_SOCKET, trough the given
+// event base (must be called by the thread running it). 
+// Does nothing after the first invocation
+struct event_base;
+int metrics_listen(struct event_base * eb);
+
+#endif /* end of include guard: PAXOS_METRICS_H_R7T2LM4X */
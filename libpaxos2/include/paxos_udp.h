@@ -17,6 +17,9 @@ typedef struct udp_send_buffer_t {
     char buffer[MAX_UDP_MSG_SIZE];
 } udp_send_buffer;
 
+//See acceptor_stable_storage.h
+struct acceptor_storage_t;
+
 typedef struct udp_receiver_t {
     int sock;
     struct sockaddr_in addr;
@@ -27,25 +30,36 @@ typedef struct udp_receiver_t {
 udp_send_buffer * udp_sendbuf_new(char* address_string, int port);
 void sendbuf_clear(udp_send_buffer * sb, paxos_msg_code type, short int sender_id);
 void sendbuf_flush(udp_send_buffer * sb);
+int udp_sendbuf_destroy(udp_send_buffer * sb);
 
 
 void sendbuf_add_repeat_req(udp_send_buffer * sb, iid_t iid);
-void sendbuf_add_accept_ack(udp_send_buffer * sb, acceptor_record * rec);
+//The transaction in s is committed before flushing a full message
+void sendbuf_add_accept_ack(udp_send_buffer * sb, acceptor_record * rec, struct acceptor_storage_t * s);
 void sendbuf_add_prepare_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot);
-void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec);
+void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec, struct acceptor_storage_t * s, iid_t highest_accepted);
 void sendbuf_add_accept_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot, char * value, size_t val_size);
-void sendbuf_add_submit_val(udp_send_buffer * sb, char * value, size_t val_size);
+void sendbuf_set_acceptors(udp_send_buffer * sb, unsigned int acceptors);
+void sendbuf_add_submit_val(udp_send_buffer * sb, unsigned int client_id, unsigned int seqno, char * value, size_t val_size);
 
 
 udp_receiver * udp_receiver_blocking_new(char* address_string, int port);
 udp_receiver * udp_receiver_new(char* address_string, int port);
 int udp_read_next_message(udp_receiver * recv_info);
+int udp_try_read_next_message(udp_receiver * recv_info);
 int udp_receiver_destroy(udp_receiver * rec);
 
 void sendbuf_send_ping(udp_send_buffer * sb, short int proposer_id, long unsigned int sequence_number);
 void sendbuf_send_leader_announce(udp_send_buffer * sb, short int leader_id);
+void sendbuf_send_submit_reply(udp_send_buffer * sb, struct sockaddr_in * dest, unsigned int client_id, unsigned int seqno, iid_t iid, int result);
 
 
 void print_paxos_msg(paxos_msg * msg);
 
+//Simulated network (see pax_sim_start in libpaxos.h)
+int sim_is_active();
+int sim_receiver_open(udp_receiver * rec, char* address_string, int port);
+void sim_receiver_close(udp_receiver * rec);
+int sim_send(struct sockaddr_in * dest, char * data, size_t size);
+
 #endif /* end of include guard: PAXOS_UDP_H_X98E254H */
@@ -4,18 +4,33 @@
 typedef struct vh_value_wrapper_t {
     size_t value_size;
     struct vh_value_wrapper_t * next;
-    // int client_socket;
+    unsigned int client_id;
+    unsigned int seqno;
     char value[0];
 } vh_value_wrapper;
 
-int vh_init();
-void vh_shutdown();
+//One for each proposer, see proposer_values_handler.c
+typedef struct vh_state_t vh_state;
+struct event_base;
+
+vh_state * vh_new(struct event_base * eb, int group, short int proposer_id);
+void vh_free(vh_state * vh);
+int vh_init(vh_state * vh);
+void vh_shutdown(vh_state * vh);
 vh_value_wrapper * vh_wrap_value(char * value, size_t size);
+vh_value_wrapper * vh_empty_batch();
 int vh_value_compare(vh_value_wrapper * vw1, vh_value_wrapper * vw2);
-void vh_enqueue_value(char * value, size_t value_size);
-void vh_push_back_value(vh_value_wrapper * vw);
-vh_value_wrapper * vh_get_next_pending();
-int vh_pending_list_size();
-void vh_notify_client(unsigned int result, vh_value_wrapper * vw);
-long unsigned int vh_get_dropped_count();
+int vh_enqueue_value(vh_state * vh, unsigned int client_id, unsigned int seqno, char * value, size_t value_size);
+int vh_enqueue_wrapper(vh_state * vh, vh_value_wrapper * vw);
+void vh_push_back_value(vh_state * vh, vh_value_wrapper * vw);
+vh_value_wrapper * vh_get_next_pending(vh_state * vh);
+vh_value_wrapper * vh_get_next_batch(vh_state * vh);
+int vh_batch_ready(vh_state * vh);
+void vh_check_held(vh_state * vh);
+void vh_delivered(vh_state * vh, char * value, size_t size);
+int vh_pending_list_size(vh_state * vh);
+void vh_notify_client(vh_state * vh, int result, iid_t iid, vh_value_wrapper * vw);
+void vh_notify_batch(vh_state * vh, int result, iid_t iid, vh_value_wrapper * vw);
+long unsigned int vh_get_dropped_count(vh_state * vh);
+iid_t vh_noop_target(vh_state * vh);
 #endif /* end of include guard: VALUES_HANDLER_H_23R78MJT */
@@ -1,5 +1,7 @@
+#include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <memory.h>
 
 #include "event.h"
 #include "evutil.h"
@@ -8,29 +10,80 @@
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
 #include "acceptor_stable_storage.h"
+#include "paxos_metrics.h"
 
 #define ACCEPTOR_ERROR (-1)
 
-//Unique identifier of this acceptor
-int this_acceptor_id = -1;
-
-//UDP socket managers for sending
-static udp_send_buffer * to_proposers;
-static udp_send_buffer * to_learners;
-
-//UDP socket manager for receiving
-static udp_receiver * for_acceptor;
-
-//Event: Message received
-static struct event acceptor_msg_event;
+//Exported metrics of an acceptor (see paxos_metrics.h)
+struct acceptor_metrics {
+    paxos_metric * prepares;
+    paxos_metric * prepares_dropped;
+    paxos_metric * accepts;
+    paxos_metric * accepts_dropped;
+    paxos_metric * repeats;
+    paxos_metric * repeats_missing;
+    paxos_metric * highest_accepted;
+    paxos_metric * lease_denied;
+};
+
+//An acceptor, all its events are registered with eb
+struct paxos_acceptor_t {
+    //Libevent handle
+    struct event_base * eb;
+
+    //Unique identifier of this acceptor, in its group
+    int                 acceptor_id;
+
+    //Consensus group of this acceptor (see PAXOS_GROUPS)
+    int                 group;
+
+    //UDP socket managers for sending
+    udp_send_buffer *   to_proposers;
+    udp_send_buffer *   to_learners;
+
+    //UDP socket manager for receiving
+    udp_receiver *      for_acceptor;
+
+    //Event: Message received
+    struct event        msg_event;
+
+    //Event: Time to repeat last accept
+    struct event        repeat_accept_event;
+    //Interval at which the previous event fires
+    struct timeval      periodic_repeat_interval;
+
+    //The highest instance id for which a value was accepted
+    iid_t               highest_accepted_iid;
+
+    //Leader lease (see PAXOS_LEADER_LEASE in config): the proposer 
+    // that holds it (-1 for none) and until when
+    short int           lease_owner;
+    struct timeval      lease_expiry;
+
+    //Underlying persistent storage
+    acceptor_storage *  storage;
+
+    //The learner delivering values to the acceptor, NULL unless
+    // ACCEPTOR_UPDATE_ON_DELIVER is defined or the acceptor joined
+    paxos_learner *     learner;
+
+    struct acceptor_metrics metrics;
+
+#ifdef PAXOS_FAST_MODE
+    //Instances in "any" state (fast round), in the order the 
+    // leader opened them. Client values are accepted for the first one
+    iid_t               any_queue[ACCEPTOR_ANY_QUEUE_SIZE];
+    unsigned int        any_queue_head;
+    unsigned int        any_queue_tail;
+#endif
+};
+#ifdef PAXOS_FAST_MODE
+#define GET_ANY_SLOT(A, P) (&(A)->any_queue[((P) & (ACCEPTOR_ANY_QUEUE_SIZE-1))])
+#endif
 
-//Event: Time to repeat last accept
-static struct event repeat_accept_event;
-//Interval at which the previous event fires
-static struct timeval periodic_repeat_interval;
+//The acceptor started by acceptor_init
+static paxos_acceptor * default_acceptor = NULL;
 
-//The highest instance id for which a value was accepted
-static iid_t highest_accepted_iid = 0;
 
 // TODO periodic retransmission and update-on-deliver are currently in a transaction. Could be prepended to the next instead
 
@@ -38,31 +91,70 @@ static iid_t highest_accepted_iid = 0;
 // Helpers
 /*-------------------------------------------------------------------------*/
 
+//Returns 1 if a request with the given ballot must be ignored,
+// since another proposer holds the lease
+static int
+acc_lease_denies(paxos_acceptor * a, ballot_t ballot, struct timeval * now) {
+    if(paxos_conf.leader_lease == 0 || 
+        (short int)(ballot % MAX_N_OF_PROPOSERS) == a->lease_owner) {
+        return 0;
+    }
+    if(timercmp(now, &a->lease_expiry, <)) {
+        METRIC_INC(a->metrics.lease_denied);
+        return 1;
+    }
+    return 0;
+}
+
+//Lease starts (or is renewed) when a request is applied
+static void
+acc_lease_grant(paxos_acceptor * a, ballot_t ballot, struct timeval * now) {
+    if(paxos_conf.leader_lease == 0) {
+        return;
+    }
+    a->lease_owner = ballot % MAX_N_OF_PROPOSERS;
+    a->lease_expiry.tv_sec = now->tv_sec + 
+        (now->tv_usec + paxos_conf.leader_lease) / 1000000;
+    a->lease_expiry.tv_usec = (now->tv_usec + paxos_conf.leader_lease) % 1000000;
+}
+
 //Given an accept request (phase 2a) message and the current record
 // will update the record if the request is legal
 // Return NULL for no changes, the new record if the accept was applied
 static acceptor_record *
-acc_apply_accept(accept_req * ar, acceptor_record * rec) {
+acc_apply_accept(paxos_acceptor * a, accept_req * ar, acceptor_record * rec) {
     //We already have a more recent ballot
-    if (rec != NULL && rec->ballot < ar->ballot) {
-        LOG(DBG, ("Accept for iid:%u dropped (ballots curr:%u recv:%u)\n", 
+    if (rec != NULL && rec->ballot > ar->ballot) {
+        LOG(DBG, ("Accept for iid:%"IID_FMT" dropped (ballots curr:%"BALLOT_FMT" recv:%"BALLOT_FMT")\n", 
             ar->iid, rec->ballot, ar->ballot));
+        METRIC_INC(a->metrics.accepts_dropped);
+        return NULL;
+    }
+    
+    //In a fast round, only the first value is accepted
+    if (rec != NULL && rec->ballot == ar->ballot && 
+        IS_FAST_BALLOT(ar->ballot) && rec->value_size > 0) {
+        LOG(DBG, ("Accept for iid:%"IID_FMT" dropped (fast round, value already accepted)\n", 
+            ar->iid));
+        METRIC_INC(a->metrics.accepts_dropped);
         return NULL;
     }
     
     //Record not found or smaller ballot
     // in both cases overwrite and store
-    LOG(DBG, ("Accepting for iid:%u (ballot:%u)\n", 
+    LOG(DBG, ("Accepting for iid:%"IID_FMT" (ballot:%"BALLOT_FMT")\n", 
         ar->iid, ar->ballot));
     
     //Store the updated record
-    rec = stablestorage_save_accept(ar);
+    rec = stablestorage_save_accept(a->storage, ar);
+    METRIC_INC(a->metrics.accepts);
     
     //Keep track of highest accepted for retransmission
-    if(ar->iid > highest_accepted_iid) {
-        highest_accepted_iid = ar->iid;
-        LOG(DBG, ("Highest accepted is now iid:%u\n", 
-            highest_accepted_iid));
+    if(ar->iid > a->highest_accepted_iid) {
+        a->highest_accepted_iid = ar->iid;
+        METRIC_SET(a->metrics.highest_accepted, a->highest_accepted_iid);
+        LOG(DBG, ("Highest accepted is now iid:%"IID_FMT"\n", 
+            a->highest_accepted_iid));
     }
     return rec;
 }
@@ -71,49 +163,116 @@ acc_apply_accept(accept_req * ar, acceptor_record * rec) {
 // corresponding record, will update if the request is valid
 // Return NULL for no changes, the new record if the promise was made
 static acceptor_record *
-acc_apply_prepare(prepare_req * pr, acceptor_record * rec) {
+acc_apply_prepare(paxos_acceptor * a, prepare_req * pr, acceptor_record * rec) {
     //We already have a more recent ballot
     if (rec != NULL && rec->ballot >= pr->ballot) {
-        LOG(DBG, ("Prepare request for iid:%u dropped (ballots curr:%u recv:%u)\n", 
+        LOG(DBG, ("Prepare request for iid:%"IID_FMT" dropped (ballots curr:%"BALLOT_FMT" recv:%"BALLOT_FMT")\n", 
             pr->iid, rec->ballot, pr->ballot));
+        METRIC_INC(a->metrics.prepares_dropped);
         return NULL;
     }
     
     //Stored value is final, the instance is closed already
     if (rec != NULL && rec->is_final) {
-        LOG(DBG, ("Prepare request for iid:%u dropped \
+        LOG(DBG, ("Prepare request for iid:%"IID_FMT" dropped \
             (stored value is final)\n", pr->iid));
+        METRIC_INC(a->metrics.prepares_dropped);
         return NULL;
     }
     
     //Record not found or smaller ballot
     // in both cases overwrite and store
-    LOG(DBG, ("Prepare request is valid for iid:%u (ballot:%u)\n", 
+    LOG(DBG, ("Prepare request is valid for iid:%"IID_FMT" (ballot:%"BALLOT_FMT")\n", 
         pr->iid, pr->ballot));
     
     //Store the updated record
-    rec = stablestorage_save_prepare(pr, rec);
+    rec = stablestorage_save_prepare(a->storage, pr, rec);
+    METRIC_INC(a->metrics.prepares);
 
     return rec;
 }
 
+#ifdef PAXOS_FAST_MODE
+//Given an "any" accept request (fast round, no value) and the current 
+// record, stores the ballot and remembers the instance as available
+// for client values
+static void
+acc_apply_any(paxos_acceptor * a, accept_req * ar, acceptor_record * rec) {
+    //We already have a more recent ballot, or a value for this one
+    if (rec != NULL && (rec->ballot > ar->ballot || 
+        (rec->ballot == ar->ballot && rec->value_size > 0) || rec->is_final)) {
+        LOG(DBG, ("Any for iid:%"IID_FMT" dropped\n", ar->iid));
+        return;
+    }
+    
+    //Retransmission, already in queue
+    if (rec != NULL && rec->ballot == ar->ballot) {
+        return;
+    }
+
+    if(a->any_queue_tail - a->any_queue_head == ACCEPTOR_ANY_QUEUE_SIZE) {
+        printf("Any queue is full, dropping any for iid:%"IID_FMT"\n", ar->iid);
+        return;
+    }
+
+    //Record with no value, ballot and value_ballot are set
+    stablestorage_save_accept(a->storage, ar);
+    *GET_ANY_SLOT(a, a->any_queue_tail) = ar->iid;
+    a->any_queue_tail += 1;
+    LOG(DBG, ("Instance %"IID_FMT" is now in any state\n", ar->iid));
+}
+
+//Accepts the value submitted by a client for the first instance 
+// in "any" state. Returns the new record, NULL if no instance is available
+static acceptor_record *
+acc_apply_fast_value(paxos_acceptor * a, char * value, size_t value_size) {
+    acceptor_record * rec;
+    iid_t iid;
+    
+    while(a->any_queue_head != a->any_queue_tail) {
+        iid = *GET_ANY_SLOT(a, a->any_queue_head);
+        a->any_queue_head += 1;
+        
+        rec = stablestorage_get_record(a->storage, iid);
+        //Not in any state anymore (i.e. recovered with a classic round)
+        if(rec == NULL || rec->value_size > 0 || 
+            !IS_FAST_BALLOT(rec->ballot) || rec->is_final) {
+            continue;
+        }
+        
+        //Accept with the ballot of the any request
+        accept_req * ar = PAX_MALLOC(sizeof(accept_req) + value_size);
+        ar->iid = iid;
+        ar->ballot = rec->ballot;
+        ar->value_size = value_size;
+        memcpy(ar->value, value, value_size);
+        rec = acc_apply_accept(a, ar, rec);
+        PAX_FREE(ar);
+        return rec;
+    }
+    
+    LOG(VRB, ("No instance in any state, client value dropped\n"));
+    return NULL;
+}
+#endif
+
 //Reads the last (by iid) instance for which a value was accepted
 // and re-transmit it to the learners
 static void
-acc_retransmit_latest_accept() {
+acc_retransmit_latest_accept(paxos_acceptor * a) {
     
     acceptor_record * rec;
     
     //Fetch the highest instance accepted
-    sendbuf_clear(to_learners, accept_acks, this_acceptor_id);
-    stablestorage_tx_begin();
-    rec = stablestorage_get_record(highest_accepted_iid);
+    sendbuf_clear(a->to_learners, accept_acks, a->acceptor_id);
+    stablestorage_tx_begin(a->storage);
+    rec = stablestorage_get_record(a->storage, a->highest_accepted_iid);
     
     //And retransmit it to learners
-    sendbuf_add_accept_ack(to_learners, rec);    
-    stablestorage_tx_end();
+    sendbuf_add_accept_ack(a->to_learners, rec, a->storage);    
+    stablestorage_tx_end(a->storage);
     
-    sendbuf_flush(to_learners);
+    sendbuf_flush(a->to_learners);
     
 }
  
@@ -125,17 +284,17 @@ acc_periodic_repeater(int fd, short event, void *arg)
 {
     UNUSED_ARG(fd);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_acceptor * a = arg;
     
     //If some value has been accepted,
-    if (highest_accepted_iid > 0) {
+    if (a->highest_accepted_iid > 0) {
         //Rebroadcast most recent (so that learners stay up-to-date)
-        LOG(DBG, ("re-sending most recent accept, iid:%u\n", highest_accepted_iid));
-        acc_retransmit_latest_accept();
+        LOG(DBG, ("re-sending most recent accept, iid:%"IID_FMT"\n", a->highest_accepted_iid));
+        acc_retransmit_latest_accept(a);
     }
     
     //Set the next timeout for calling this function
-    if(event_add(&repeat_accept_event, &periodic_repeat_interval) != 0) {
+    if(event_add(&a->repeat_accept_event, &a->periodic_repeat_interval) != 0) {
 	   printf("Error while adding next repeater periodic event\n");
 	}
 }
@@ -149,39 +308,48 @@ acc_periodic_repeater(int fd, short event, void *arg)
 // needs to be wrapped into transactions and made persistent
 // before sending the corresponding acknowledgement
 static void 
-handle_prepare_req_batch(prepare_req_batch* prb) {
+handle_prepare_req_batch(paxos_acceptor * a, prepare_req_batch* prb) {
     
     LOG(DBG, ("Handling prepare for %d instances\n", prb->count));
 
     //Create empty prepare_ack_batch in buffer
-    sendbuf_clear(to_proposers, prepare_acks, this_acceptor_id);
+    sendbuf_clear(a->to_proposers, prepare_acks, a->acceptor_id);
 
     //Wrap changes in a  transaction
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(a->storage);
     
     short int i;
     acceptor_record * rec;
     prepare_req * pr;
+    struct timeval now;
+    gettimeofday(&now, NULL);
 
     //Iterate over the prepare_req in the batch
     for(i = 0; i < prb->count; i++) {
         pr = &prb->prepares[i];
         
+        //Another proposer holds the lease
+        if(acc_lease_denies(a, pr->ballot, &now)) {
+            continue;
+        }
+        
         //Retrieve corresponding record
-        rec = stablestorage_get_record(pr->iid);
+        rec = stablestorage_get_record(a->storage, pr->iid);
         //Try to apply prepare
-        rec = acc_apply_prepare(pr, rec);
+        rec = acc_apply_prepare(a, pr, rec);
         //If accepted, send accept_ack
         if(rec != NULL) {
-            sendbuf_add_prepare_ack(to_proposers, rec);
+            acc_lease_grant(a, pr->ballot, &now);
+            sendbuf_add_prepare_ack(a->to_proposers, rec, a->storage, 
+                a->highest_accepted_iid);
         }
 
     }
     
-    stablestorage_tx_end();
+    stablestorage_tx_end(a->storage);
     
     //Flush the send buffer if there's something
-    sendbuf_flush(to_proposers);
+    sendbuf_flush(a->to_proposers);
 
 }
 
@@ -190,40 +358,62 @@ handle_prepare_req_batch(prepare_req_batch* prb) {
 // needs to be wrapped into transactions and made persistent
 // before sending the corresponding acknowledgement
 static void 
-handle_accept_req_batch(accept_req_batch* arb) {
+handle_accept_req_batch(paxos_acceptor * a, accept_req_batch* arb) {
+    //Addressed to other acceptors (thrifty phase 2)
+    if((arb->acceptors & (1U << a->acceptor_id)) == 0) {
+        LOG(DBG, ("Ignoring accept for %d instances\n", arb->count));
+        return;
+    }
     LOG(DBG, ("Handling accept for %d instances\n", arb->count));
 
     //Create empty accept_ack_batch in buffer
-    sendbuf_clear(to_learners, accept_acks, this_acceptor_id);
+    sendbuf_clear(a->to_learners, accept_acks, a->acceptor_id);
 
     //Wrap in a transaction
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(a->storage);
     
     short int i;
     size_t data_offset = 0;
     accept_req * ar;
     acceptor_record * rec;
+    struct timeval now;
+    gettimeofday(&now, NULL);
     
     //Iterate over accept_req in batch
     for(i = 0; i < arb->count; i++) {
         ar = (accept_req*) &arb->data[data_offset];
         
+        //Another proposer holds the lease
+        if(acc_lease_denies(a, ar->ballot, &now)) {
+            data_offset += ACCEPT_REQ_SIZE(ar);
+            continue;
+        }
+        
         //Retrieve correspondin record
-        rec = stablestorage_get_record(ar->iid);
+        rec = stablestorage_get_record(a->storage, ar->iid);
+#ifdef PAXOS_FAST_MODE
+        //No value, fast round: wait for a client value
+        if(ar->value_size == 0 && IS_FAST_BALLOT(ar->ballot)) {
+            acc_apply_any(a, ar, rec);
+            data_offset += ACCEPT_REQ_SIZE(ar);
+            continue;
+        }
+#endif
         //Try to apply accept
-        rec = acc_apply_accept(ar, rec);
+        rec = acc_apply_accept(a, ar, rec);
         //If accepted, send accept_ack
         if(rec != NULL) {
-            sendbuf_add_accept_ack(to_learners, rec);
+            acc_lease_grant(a, ar->ballot, &now);
+            sendbuf_add_accept_ack(a->to_learners, rec, a->storage);
         }
 
         data_offset += ACCEPT_REQ_SIZE(ar);
     }
     
-    stablestorage_tx_end();
+    stablestorage_tx_end(a->storage);
     
     //Flush the send buffer if there's something
-    sendbuf_flush(to_learners);
+    sendbuf_flush(a->to_learners);
 
 }
 
@@ -232,14 +422,14 @@ handle_accept_req_batch(accept_req_batch* arb) {
 // May answer with multiple messages, all reads are wrapped
 // into transactions
 static void 
-handle_repeat_req_batch(repeat_req_batch* rrb) {
+handle_repeat_req_batch(paxos_acceptor * a, repeat_req_batch* rrb) {
     LOG(DBG, ("Repeating accept for %d instances\n", rrb->count));
 
     //Create empty accept_ack_batch in buffer
-    sendbuf_clear(to_learners, accept_acks, this_acceptor_id);
+    sendbuf_clear(a->to_learners, accept_acks, a->acceptor_id);
 
     //Wrap in a (read-only) transaction
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(a->storage);
     
     short int i;
     acceptor_record * rec;
@@ -247,22 +437,42 @@ handle_repeat_req_batch(repeat_req_batch* rrb) {
     //Iterate over the repeat_req in the batch
     for(i = 0; i < rrb->count; i++) {
         //Read the corresponding record
-        rec = stablestorage_get_record(rrb->requests[i]);
+        rec = stablestorage_get_record(a->storage, rrb->requests[i]);
         
         //If a value was accepted, send accept_ack
         if(rec != NULL && rec->value_size > 0) {
-            sendbuf_add_accept_ack(to_learners, rec);
+            sendbuf_add_accept_ack(a->to_learners, rec, a->storage);
+            METRIC_INC(a->metrics.repeats);
         } else {
-            LOG(DBG, ("Cannot retransmit iid:%u no value accepted \n", rrb->requests[i]));
+            METRIC_INC(a->metrics.repeats_missing);
+            LOG(DBG, ("Cannot retransmit iid:%"IID_FMT" no value accepted \n", rrb->requests[i]));
         }
     }
     
-    stablestorage_tx_end();
+    stablestorage_tx_end(a->storage);
     
     //Flush the send buffer if there's something
-    sendbuf_flush(to_learners);
+    sendbuf_flush(a->to_learners);
 }
 
+#ifdef PAXOS_FAST_MODE
+//Received a submit message directly from a client (fast round),
+// the whole message is the value of the next instance in any state
+static void 
+handle_fast_submit(paxos_acceptor * a, paxos_msg * msg) {
+    sendbuf_clear(a->to_learners, accept_acks, a->acceptor_id);
+
+    stablestorage_tx_begin(a->storage);
+    acceptor_record * rec = acc_apply_fast_value(a, msg->data, msg->data_size);
+    if(rec != NULL) {
+        sendbuf_add_accept_ack(a->to_learners, rec, a->storage);
+    }
+    stablestorage_tx_end(a->storage);
+    
+    sendbuf_flush(a->to_learners);
+}
+#endif
+
 //This function is invoked when a new message is ready to be read
 // from the acceptor UDP socket
 static void 
@@ -270,12 +480,12 @@ acc_handle_newmsg(int sock, short event, void *arg) {
     //Make the compiler happy!
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_acceptor * a = arg;
     
-    assert(sock == for_acceptor->sock);
+    assert(sock == a->for_acceptor->sock);
     
     //Read the next message
-    int valid = udp_read_next_message(for_acceptor);
+    int valid = udp_read_next_message(a->for_acceptor);
     if (valid < 0) {
         printf("Dropping invalid acceptor message\n");
         return;
@@ -283,55 +493,51 @@ acc_handle_newmsg(int sock, short event, void *arg) {
     
     //The message is valid, take the appropriate action
     // based on the type
-    paxos_msg * msg = (paxos_msg*) &for_acceptor->recv_buffer;
+    paxos_msg * msg = (paxos_msg*) &a->for_acceptor->recv_buffer;
     switch(msg->type) {
         case prepare_reqs: {
-            handle_prepare_req_batch((prepare_req_batch*) msg->data);
+            handle_prepare_req_batch(a, (prepare_req_batch*) msg->data);
         }
         break;
 
         case accept_reqs: {
-            handle_accept_req_batch((accept_req_batch*) msg->data);
+            handle_accept_req_batch(a, (accept_req_batch*) msg->data);
         }
         break;
 
         case repeat_reqs: {
-            handle_repeat_req_batch((repeat_req_batch*) msg->data);
+            handle_repeat_req_batch(a, (repeat_req_batch*) msg->data);
         }
         break;
 
+#ifdef PAXOS_FAST_MODE
+        case submit: {
+            handle_fast_submit(a, msg);
+        }
+        break;
+#endif
+
         default: {
             printf("Unknow msg type %d received by acceptor\n", msg->type);
         }
     }
 }
-//The acceptor runs on top of a learner, if the learner is active
-// (ACCEPTOR_UPDATE_ON_DELIVER is defined), this is the function 
-// invoked when a value is delivered.
-// The acceptor overwrites his personal record with the delivered value
-// since it will never change again
-void 
-acc_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, int proposer) {
+//If ACCEPTOR_UPDATE_ON_DELIVER is defined (or the acceptor joined),
+// the acceptor runs a learner and this is the function invoked when 
+// a value is delivered. The acceptor overwrites his personal record 
+// with the delivered value since it will never change again
+static void 
+acc_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, 
+    int proposer, void * arg) {
     UNUSED_ARG(proposer);
+    paxos_acceptor * a = arg;
 
-#ifndef ACCEPTOR_UPDATE_ON_DELIVER
-    UNUSED_ARG(value);
-    UNUSED_ARG(size);
-    UNUSED_ARG(iid);
-    UNUSED_ARG(ballot);
-
-    //ACCEPTOR_UPDATE_ON_DELIVER not defined, 
-    //this callback should not even be called!
-    printf("Warning:%s invoked when ACCEPTOR_UPDATE_ON_DELIVER is undefined!\n", __func__);
-
-#else
     //Save permanently the value delivered, replacing the
     // accept for this particular acceptor
     //FIXME: Could append to next TX instead of doing a separate one
-    stablestorage_tx_begin();
-    stablestorage_save_final_value(value, size, iid, ballot);
-    stablestorage_tx_end();
-#endif
+    stablestorage_tx_begin(a->storage);
+    stablestorage_save_final_value(a->storage, value, size, iid, ballot);
+    stablestorage_tx_end(a->storage);
 }
 
 /*-------------------------------------------------------------------------*/
@@ -340,44 +546,46 @@ acc_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, int
 
 //Initialize sockets and related events
 static int 
-init_acc_network() {
+init_acc_network(paxos_acceptor * a) {
     
     // Send buffer for talking to proposers
-    to_proposers = udp_sendbuf_new(PAXOS_PROPOSERS_NET);
-    if(to_proposers == NULL) {
+    a->to_proposers = udp_sendbuf_new(CONF_NET_GROUP(proposers_net, a->group));
+    if(a->to_proposers == NULL) {
         printf("Error creating acceptor->proposers network sender\n");
         return ACCEPTOR_ERROR;
     }
 
     // Send buffer for talking to learners
-    to_learners = udp_sendbuf_new(PAXOS_LEARNERS_NET);
-    if(to_learners == NULL) {
+    a->to_learners = udp_sendbuf_new(CONF_NET_GROUP(learners_net, a->group));
+    if(a->to_learners == NULL) {
         printf("Error creating acceptor->learners network sender\n");
         return ACCEPTOR_ERROR;
     }
     
     // Message receive event
-    for_acceptor = udp_receiver_new(PAXOS_ACCEPTORS_NET);
-    if (for_acceptor == NULL) {
+    a->for_acceptor = udp_receiver_new(CONF_NET_GROUP(acceptors_net, a->group));
+    if (a->for_acceptor == NULL) {
         printf("Error creating acceptor network receiver\n");
         return ACCEPTOR_ERROR;
     }
-    event_set(&acceptor_msg_event, for_acceptor->sock, EV_READ|EV_PERSIST, acc_handle_newmsg, NULL);
-    event_add(&acceptor_msg_event, NULL);
+    event_set(&a->msg_event, a->for_acceptor->sock, EV_READ|EV_PERSIST, acc_handle_newmsg, a);
+    event_base_set(a->eb, &a->msg_event);
+    event_add(&a->msg_event, NULL);
     
     return 0;
 }
 
 //Initialize timers
 static int 
-init_acc_timers() {
+init_acc_timers(paxos_acceptor * a) {
     
     //Sets the first acc_periodic_repeater invocation timeout
-    evtimer_set(&repeat_accept_event, acc_periodic_repeater, NULL);
-	evutil_timerclear(&periodic_repeat_interval);
-	periodic_repeat_interval.tv_sec = ACCEPTOR_REPEAT_INTERVAL;
-    periodic_repeat_interval.tv_usec = 0;
-	if(event_add(&repeat_accept_event, &periodic_repeat_interval) != 0) {
+    evtimer_set(&a->repeat_accept_event, acc_periodic_repeater, a);
+    event_base_set(a->eb, &a->repeat_accept_event);
+	evutil_timerclear(&a->periodic_repeat_interval);
+	a->periodic_repeat_interval.tv_sec = paxos_conf.acceptor_repeat_interval;
+    a->periodic_repeat_interval.tv_usec = 0;
+	if(event_add(&a->repeat_accept_event, &a->periodic_repeat_interval) != 0) {
 	   printf("Error while adding first periodic repeater event\n");
        return -1;
 	}
@@ -385,90 +593,197 @@ init_acc_timers() {
     return 0;
 }
 
-//Initialize the underlying persistent storage
-// Berlekey DB in this case
-static int
-init_acc_stable_storage() {
-    return stablestorage_init(this_acceptor_id);
+//Register the exported metrics, labeled with group and id
+static void
+init_acc_metrics(paxos_acceptor * a) {
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    struct acceptor_metrics * m = &a->metrics;
+    
+    snprintf(label, sizeof(label), "group=\"%d\",acceptor=\"%d\"", 
+        a->group, a->acceptor_id);
+    m->prepares = metrics_register_label("acceptor_prepares", label, metric_counter);
+    m->prepares_dropped = metrics_register_label("acceptor_prepares_dropped", label, metric_counter);
+    m->accepts = metrics_register_label("acceptor_accepts", label, metric_counter);
+    m->accepts_dropped = metrics_register_label("acceptor_accepts_dropped", label, metric_counter);
+    m->repeats = metrics_register_label("acceptor_repeats", label, metric_counter);
+    m->repeats_missing = metrics_register_label("acceptor_repeats_missing", label, metric_counter);
+    m->highest_accepted = metrics_register_label("acceptor_highest_accepted_iid", label, metric_gauge);
+    m->lease_denied = metrics_register_label("acceptor_lease_denied", label, metric_counter);
 }
 
-//Acceptor initialization, this function is invoked by
-// the underlying learner after it's normal initialization
-static int init_acceptor() {
+//Acceptor initialization, on the event base of the acceptor
+static int init_acceptor(paxos_acceptor * a, int recover, int join) {
 
-#ifdef ACCEPTOR_UPDATE_ON_DELIVER
-    //Keep the learnern running as normal
-    //Will deliver values when decided
-    LOG(VRB, ("Acceptor will update stored values as they are delivered\n"));
-#else
-    //Shut down the underlying learner,
-    //(but keep using it's event loop)
-    LOG(VRB, ("Acceptor shutting down learner events\n"));
-    learner_suspend();
+#ifdef PAXOS_FAST_MODE
+    if ((ACCEPTOR_ANY_QUEUE_SIZE & (ACCEPTOR_ANY_QUEUE_SIZE -1)) != 0) {
+        printf("Error: ACCEPTOR_ANY_QUEUE_SIZE is not a power of 2\n");
+        return -1;
+    }
 #endif
     
+    init_acc_metrics(a);
+    
     //Add network events and prepare send buffer
-    if(init_acc_network() != 0) {
+    if(init_acc_network(a) != 0) {
         printf("Acceptor network init failed\n");
         return -1;
     }
 
     //Add additional timers to libevent loop
-    if(init_acc_timers() != 0){
+    if(init_acc_timers(a) != 0){
         printf("Acceptor timers init failed\n");
         return -1;
     }
     
     //Initialize BDB 
-    if(init_acc_stable_storage() != 0) {
+    a->storage = stablestorage_init(a->group, a->acceptor_id, recover);
+    if(a->storage == NULL) {
         printf("Acceptor stable storage init failed\n");
         return -1;
     }
+
+#ifdef ACCEPTOR_UPDATE_ON_DELIVER
+    join = 1;
+#endif
+    //Will deliver values when decided, a new member also 
+    // gets the ones decided before it joined (state transfer)
+    if(join) {
+        LOG(VRB, ("Acceptor will update stored values as they are delivered\n"));
+        a->learner = learner_new_instances(a->eb, a->group, acc_deliver_callback, a);
+        if(a->learner == NULL) {
+            printf("Could not start the learner!\n");
+            return -1;
+        }
+    }
+    
+    //Metrics dump, shared by all the roles in this process
+    if(metrics_listen(a->eb) != 0) {
+        printf("Metrics socket init failed\n");
+        return -1;
+    }
     return 0;
 }
 
-/*-------------------------------------------------------------------------*/
-// Public functions (see libpaxos.h for more details)
-/*-------------------------------------------------------------------------*/
-
-int acceptor_init(int acceptor_id) {
+//Creates an acceptor on the given event base,
+// returns NULL if the initialization fails
+static paxos_acceptor *
+acc_new(struct event_base * eb, int group, int acceptor_id, int recover, int join) {
+    
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return NULL;
+    }
     
     // Check that n_of_acceptor is not too big
     if(N_OF_ACCEPTORS >= (sizeof(unsigned int)*8)) {
         printf("Error, this library currently supports at most:%d acceptors\n",
             (int)(sizeof(unsigned int)*8));
         printf("(the number of bits in a 'unsigned int', used as acceptor id)\n");
-        return -1;
+        return NULL;
     }
     
-    //Check id validity of acceptor_id
+    //Check id validity of acceptor_id (members may change later)
     if(acceptor_id < 0 || acceptor_id >= N_OF_ACCEPTORS) {
         printf("Invalid acceptor id:%d\n", acceptor_id);
-        return -1;
+        return NULL;
     }
     
-    this_acceptor_id = acceptor_id;
-    LOG(VRB, ("Acceptor %d starting...\n", this_acceptor_id));
+    if(group < 0 || group >= paxos_conf.groups) {
+        printf("Invalid group:%d\n", group);
+        return NULL;
+    }
     
-    //Starts a learner with a custom init function
-    if (learner_init(acc_deliver_callback, init_acceptor) != 0) {
-        printf("Could not start the learner!\n");
-        return -1;
+    paxos_acceptor * a = PAX_MALLOC(sizeof(paxos_acceptor));
+    memset(a, 0, sizeof(paxos_acceptor));
+    a->eb = eb;
+    a->group = group;
+    a->acceptor_id = acceptor_id;
+    a->highest_accepted_iid = 0;
+    
+    //A lease granted before a restart is not known, 
+    // nobody gets one until it would be expired
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    acc_lease_grant(a, MAX_N_OF_PROPOSERS, &now);
+    a->lease_owner = -1;
+    LOG(VRB, ("Acceptor %d starting...\n", a->acceptor_id));
+    
+    if(init_acceptor(a, recover, join) != 0) {
+        acceptor_free(a);
+        return NULL;
     }
     
-    printf("Acceptor %d is ready\n", this_acceptor_id);
-    return 0;
+    printf("Acceptor %d is ready\n", a->acceptor_id);
+    return a;
+}
+
+//Arguments of acceptor_init, passed to the acceptor thread
+typedef struct acc_legacy_args_t {
+    int acceptor_id;
+    int recover;
+    int join;
+} acc_legacy_args;
+
+//Invoked in the acceptor thread by paxos_thread_start
+static int
+init_acc_legacy(struct event_base * eb, void * arg) {
+    acc_legacy_args * aa = arg;
+    default_acceptor = acc_new(eb, 0, aa->acceptor_id, aa->recover, aa->join);
+    return (default_acceptor == NULL ? -1 : 0);
+}
+
+/*-------------------------------------------------------------------------*/
+// Public functions (see libpaxos.h for more details)
+/*-------------------------------------------------------------------------*/
+
+paxos_acceptor * acceptor_new(struct event_base * eb, int group, int acceptor_id, int recover) {
+    return acc_new(eb, group, acceptor_id, recover, 0);
+}
+
+paxos_acceptor * acceptor_join(struct event_base * eb, int group, int acceptor_id) {
+    return acc_new(eb, group, acceptor_id, 0, 1);
+}
+
+void acceptor_free(paxos_acceptor * a) {
+    if(a->learner != NULL) {
+        learner_free(a->learner);
+    }
+    event_del(&a->msg_event);
+    event_del(&a->repeat_accept_event);
+    if(a->for_acceptor != NULL) {
+        udp_receiver_destroy(a->for_acceptor);
+    }
+    if(a->to_proposers != NULL) {
+        udp_sendbuf_destroy(a->to_proposers);
+    }
+    if(a->to_learners != NULL) {
+        udp_sendbuf_destroy(a->to_learners);
+    }
+    if(a->storage != NULL && stablestorage_shutdown(a->storage) != 0) {
+        printf("stablestorage shutdown failed!\n");
+    }
+    PAX_FREE(a);
+}
+
+int acceptor_init(int acceptor_id) {
+    acc_legacy_args aa = {acceptor_id, 0, 0};
+    return paxos_thread_start(init_acc_legacy, &aa);
 }
 
 int acceptor_init_recover(int acceptor_id) {
-    //Set recovery mode then start normally
-    stablestorage_do_recovery();
-    return acceptor_init(acceptor_id);
+    acc_legacy_args aa = {acceptor_id, 1, 0};
+    return paxos_thread_start(init_acc_legacy, &aa);
+}
+
+int acceptor_init_join(int acceptor_id) {
+    acc_legacy_args aa = {acceptor_id, 0, 1};
+    return paxos_thread_start(init_acc_legacy, &aa);
 }
 
 int acceptor_exit() {
-    if (stablestorage_shutdown() != 0) {
+    if (stablestorage_shutdown(default_acceptor->storage) != 0) {
         printf("stablestorage shutdown failed!\n");
     }
+    default_acceptor->storage = NULL;
     return 0;
-}
\ No newline at end of file
+}
@@ -18,38 +18,56 @@ BDB Forums @ Oracle
 
 #include "libpaxos_priv.h"
 #include "acceptor_stable_storage.h"
+#include "paxos_metrics.h"
 
 //Size of cache <GB, B, ncaches
 #define MEM_CACHE_SIZE (0), (4*1024*1024)
-//DB env handle, DB handle, Transaction handle 
-//FIXME: should be static, but abmagic can't link then
-DB_ENV *dbenv;
-DB *dbp;
-DB_TXN *txn;
-
-//Buffer to read/write current record
-static char record_buf[MAX_UDP_MSG_SIZE];
-static acceptor_record * record_buffer = (acceptor_record*)record_buf;
-
-//Set to 1 if init should do a recovery
-static int do_recovery = 0;
-
-//Invoked before stablestorage_init, sets recovery mode on
-// the acceptor will try to recover a DB rather than creating a new one
-void stablestorage_do_recovery() {
-    printf("Acceptor in recovery mode\n");
-    do_recovery = 1;
-}
 
-static char db_env_path[512];
-static char db_filename[512];
-static char db_file_path[512];
+//The storage of an acceptor
+struct acceptor_storage_t {
+    //DB env handle, DB handle, Transaction handle 
+    DB_ENV *            dbenv;
+    DB *                dbp;
+    DB_TXN *            txn;
+
+    //Buffer to read/write current record (MAX_UDP_MSG_SIZE bytes)
+    acceptor_record *   record_buffer;
+
+    //Set to 1 if init should do a recovery
+    // the acceptor will try to recover a DB rather than creating a new one
+    int                 do_recovery;
+
+    char                db_env_path[512];
+    char                db_filename[512];
+    char                db_file_path[512];
+
+    struct timeval      tx_start;
+    //Time from begin to commit of each transaction
+    paxos_metric *      tx_latency;
+};
+
+//Keys are the iids in big-endian order, so that the btree 
+// order (byte by byte) is the numeric one
+static void
+bdb_set_key(DBT * dbkey, unsigned char * key_buffer, iid_t iid) {
+    int i;
+    for(i = sizeof(iid_t) - 1; i >= 0; i--) {
+        key_buffer[i] = (unsigned char)(iid & 0xFF);
+        iid >>= 8;
+    }
+    memset(dbkey, 0, sizeof(DBT));
+    dbkey->data = key_buffer;
+    dbkey->size = sizeof(iid_t);
+}
 
-int bdb_init_tx_handle(int tx_mode) {
+static int 
+bdb_init_tx_handle(acceptor_storage * s, int tx_mode) {
     int result;
+    DB_ENV * dbenv;
 
     //Create environment handle
-    result = db_env_create(&dbenv, 0);
+    result = db_env_create(&s->dbenv, 0);
+    dbenv = s->dbenv;
     if (result != 0) {
         printf("DB_ENV creation failed: %s\n", db_strerror(result));
         return -1;
@@ -94,7 +112,7 @@ int bdb_init_tx_handle(int tx_mode) {
     
     //Open the DB environment
     result = dbenv->open(dbenv, 
-        db_env_path,            /* Environment directory */
+        s->db_env_path,         /* Environment directory */
         flags,                  /* Open flags */
         0);                     /* Default file permissions */
 
@@ -106,16 +124,26 @@ int bdb_init_tx_handle(int tx_mode) {
     return 0;
 }
 
-int bdb_init_db(char * db_path) {
+static int 
+bdb_init_db(acceptor_storage * s, char * db_path) {
     int result;
+    DB * dbp;
+    
+    //Record numbers of DB_RECNO are 32 bits, iids are 64
+    if(ACCEPTOR_ACCESS_METHOD != DB_BTREE) {
+        printf("Error: ACCEPTOR_ACCESS_METHOD must be DB_BTREE\n");
+        return -1;
+    }
+    
     //Create the DB file
-    result = db_create(&dbp, dbenv, 0);
+    result = db_create(&s->dbp, s->dbenv, 0);
+    dbp = s->dbp;
     if (result != 0) {
         printf("db_create failed: %s\n", db_strerror(result));
         return -1;
     }
     
-    if(DURABILITY_MODE == 0 || DURABILITY_MODE == 20) {
+    if(paxos_conf.durability_mode == 0 || paxos_conf.durability_mode == 20) {
         //Set the size of the memory cache
         result = dbp->set_cachesize(dbp, MEM_CACHE_SIZE, 1);
         if (result != 0) {
@@ -128,18 +156,18 @@ int bdb_init_db(char * db_path) {
     int flags = 
         DB_CREATE;          /*Create if not existing*/
 
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(s);
 
     //Open the DB file
     result = dbp->open(dbp,
-        txn,                    /* Transaction pointer */
+        s->txn,                 /* Transaction pointer */
         db_path,                /* On-disk file that holds the database. */
         NULL,                   /* Optional logical database name */
         ACCEPTOR_ACCESS_METHOD, /* Database access method */
         flags,                  /* Open flags */
         0);                     /* Default file permissions */
 
-    stablestorage_tx_end();
+    stablestorage_tx_end(s);
 
     if(result != 0) {
         printf("DB open failed: %s\n", db_strerror(result));
@@ -149,91 +177,122 @@ int bdb_init_db(char * db_path) {
     return 0;
 }
 
+static void
+stablestorage_free(acceptor_storage * s) {
+    PAX_FREE(s->record_buffer);
+    PAX_FREE(s);
+}
+
 //Initializes the underlying stable storage
-int stablestorage_init(int acceptor_id) {
+// Returns NULL for error
+acceptor_storage * 
+stablestorage_init(int group, int acceptor_id, int recover) {
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    
+    acceptor_storage * s = PAX_MALLOC(sizeof(acceptor_storage));
+    memset(s, 0, sizeof(acceptor_storage));
+    snprintf(label, sizeof(label), "group=\"%d\",acceptor=\"%d\"", 
+        group, acceptor_id);
+    s->tx_latency = metrics_register_label("acceptor_storage_latency_us", 
+        label, metric_histogram);
+    s->record_buffer = PAX_MALLOC(MAX_UDP_MSG_SIZE);
+    s->do_recovery = recover;
+    if(recover) {
+        printf("Acceptor in recovery mode\n");
+    }
     
     //Create path to db file in db dir
-    sprintf(db_env_path, ACCEPTOR_DB_PATH);    
-    sprintf(db_filename, ACCEPTOR_DB_FNAME);
-    sprintf(db_file_path, "%s/%s", db_env_path, db_filename);
-    LOG(VRB, ("Opening db file %s/%s\n", db_env_path, db_filename));    
+    snprintf(s->db_env_path, sizeof(s->db_env_path), 
+        paxos_conf.acceptor_db_path, acceptor_id);
+    snprintf(s->db_filename, sizeof(s->db_filename), 
+        paxos_conf.acceptor_db_fname, acceptor_id);
+    //Each group has its own environment
+    if(group > 0) {
+        size_t len = strlen(s->db_env_path);
+        snprintf(s->db_env_path + len, sizeof(s->db_env_path) - len, "_g%d", group);
+    }
+    sprintf(s->db_file_path, "%s/%s", s->db_env_path, s->db_filename);
+    LOG(VRB, ("Opening db file %s/%s\n", s->db_env_path, s->db_filename));    
 
     struct stat sb;
     //Check if the environment dir and db file exists
-    int dir_exists = (stat(db_env_path, &sb) == 0);
-    int db_exists = (stat(db_file_path, &sb) == 0);
+    int dir_exists = (stat(s->db_env_path, &sb) == 0);
+    int db_exists = (stat(s->db_file_path, &sb) == 0);
 
     //Check for old db file if running recovery
-    if(do_recovery && (!dir_exists || !db_exists)) {
+    if(s->do_recovery && (!dir_exists || !db_exists)) {
         printf("Error: Acceptor recovery failed!\n");
-        printf("The file:%s does not exist\n", db_file_path);
-        return -1;
+        printf("The file:%s does not exist\n", s->db_file_path);
+        stablestorage_free(s);
+        return NULL;
     }
     
     //Create the directory if it does not exist
-    if(!dir_exists && (mkdir(db_env_path, S_IRWXU) != 0)) {
-        printf("Failed to create env dir %s: %s\n", db_env_path, strerror(errno));
-        return -1;
+    if(!dir_exists && (mkdir(s->db_env_path, S_IRWXU) != 0)) {
+        printf("Failed to create env dir %s: %s\n", s->db_env_path, strerror(errno));
+        stablestorage_free(s);
+        return NULL;
     } 
     
     //Delete and recreate an empty dir if not recovering
-    if(!do_recovery && dir_exists) {
+    if(!s->do_recovery && dir_exists) {
         char rm_command[600];
-        sprintf(rm_command, "rm -r %s", db_env_path);
+        sprintf(rm_command, "rm -r %s", s->db_env_path);
         
         if((system(rm_command) != 0) || 
-            (mkdir(db_env_path, S_IRWXU) != 0)) {
-            printf("Failed to recreate empty env dir %s: %s\n", db_env_path, strerror(errno));
+            (mkdir(s->db_env_path, S_IRWXU) != 0)) {
+            printf("Failed to recreate empty env dir %s: %s\n", s->db_env_path, strerror(errno));
         }
     }
     
     int ret = 0;
-    char * db_file = db_filename;
+    char * db_file = s->db_filename;
     printf("Durability mode is: ");
-    switch(DURABILITY_MODE) {
+    switch(paxos_conf.durability_mode) {
         //In memory cache
         case 0: {
             //Give full path if opening without handle
             printf("no durability!\n");
-            db_file = db_file_path;
+            db_file = s->db_file_path;
         }
         break;
         
         //Transactional storage
         case 10: {
             printf("transactional, no durability!\n");
-            ret = bdb_init_tx_handle(DB_LOG_IN_MEMORY);
+            ret = bdb_init_tx_handle(s, DB_LOG_IN_MEMORY);
         }
         break;
 
         case 11: {
             printf("transactional, DB_TXN_NOSYNC\n");
-            ret = bdb_init_tx_handle(DB_TXN_NOSYNC);
+            ret = bdb_init_tx_handle(s, DB_TXN_NOSYNC);
         }
         break;
 
         case 12: {
             printf("transactional, DB_TXN_WRITE_NOSYNC\n");
-            ret = bdb_init_tx_handle(DB_TXN_WRITE_NOSYNC);
+            ret = bdb_init_tx_handle(s, DB_TXN_WRITE_NOSYNC);
         }
         break;
 
         case 13: {
             printf("transactional, durable\n");
-            ret = bdb_init_tx_handle(0);
+            ret = bdb_init_tx_handle(s, 0);
         }
         break;
         
         case 20: {
             //Give full path if opening without handle
             printf("manual db flush\n");
-            db_file = db_file_path;
+            db_file = s->db_file_path;
         }
         break;
 
         default: {
-            printf("Unknow durability mode %d!\n", DURABILITY_MODE);
-            return -1;
+            printf("Unknow durability mode %d!\n", paxos_conf.durability_mode);
+            stablestorage_free(s);
+        return NULL;
         }
     }
     
@@ -241,25 +300,26 @@ int stablestorage_init(int acceptor_id) {
         printf("Failed to open DB handle\n");
     }
     
-    if(bdb_init_db(db_file) != 0) {
+    if(bdb_init_db(s, db_file) != 0) {
         printf("Failed to open DB file\n");
-        return -1;
+        stablestorage_free(s);
+        return NULL;
     }
     
-    return 0;
+    return s;
 }
 
 //Safely closes the underlying stable storage
-int stablestorage_shutdown() {
+int stablestorage_shutdown(acceptor_storage * s) {
     int result = 0;
     
     //Close db file
-    if(dbp->close(dbp, 0) != 0) {
+    if(s->dbp->close(s->dbp, 0) != 0) {
         printf("DB_ENV close failed\n");
         result = -1;
     }
 
-    switch(DURABILITY_MODE) {
+    switch(paxos_conf.durability_mode) {
         case 0:
         case 20:
         break;
@@ -270,7 +330,7 @@ int stablestorage_shutdown() {
         case 12:
         case 13: {
             //Close handle
-            if(dbenv->close(dbenv, 0) != 0) {
+            if(s->dbenv->close(s->dbenv, 0) != 0) {
                 printf("DB close failed\n");
                 result = -1;
             }
@@ -278,61 +338,75 @@ int stablestorage_shutdown() {
         break;
         
         default: {
-            printf("Unknow durability mode %d!\n", DURABILITY_MODE);
-            return -1;
+            printf("Unknow durability mode %d!\n", paxos_conf.durability_mode);
+            result = -1;
         }
     }    
  
     LOG(VRB, ("DB close completed\n"));  
+    stablestorage_free(s);
     return result;
 }
 
 //Begins a new transaction in the stable storage
 void 
-stablestorage_tx_begin() {
+stablestorage_tx_begin(acceptor_storage * s) {
+    gettimeofday(&s->tx_start, NULL);
 
-    if(DURABILITY_MODE == 0 || DURABILITY_MODE == 20) {
+    if(paxos_conf.durability_mode == 0 || paxos_conf.durability_mode == 20) {
         return;
     }
 
     int result;
-    result = dbenv->txn_begin(dbenv, NULL, &txn, 0);
+    result = s->dbenv->txn_begin(s->dbenv, NULL, &s->txn, 0);
     assert(result == 0);
 }
 
 //Commits the transaction to stable storage
-void 
-stablestorage_tx_end() {
+static void 
+stablestorage_tx_commit(acceptor_storage * s) {
     int result;
 
-    if(DURABILITY_MODE == 0) {
+    if(paxos_conf.durability_mode == 0) {
         return;
     }
-    if (DURABILITY_MODE == 20) {
-        result = dbp->sync(dbp, 0);
+    if (paxos_conf.durability_mode == 20) {
+        result = s->dbp->sync(s->dbp, 0);
         assert(result == 0);
         return;
     }
 
     //Since it's either read only or write only
     // and there is no concurrency, should always commit!
-    result = txn->commit(txn, 0);
+    result = s->txn->commit(s->txn, 0);
     assert(result == 0);
 }
 
+void 
+stablestorage_tx_end(acceptor_storage * s) {
+    struct timeval now;
+    stablestorage_tx_commit(s);
+    
+    if(s->tx_latency != NULL) {
+        gettimeofday(&now, NULL);
+        metrics_observe(s->tx_latency, ((now.tv_sec - s->tx_start.tv_sec) * 1000000) + 
+            (now.tv_usec - s->tx_start.tv_usec));
+    }
+}
+
 //Retrieves an instance record from stable storage
 // returns null if the instance does not exist yet
 acceptor_record * 
-stablestorage_get_record(iid_t iid) {
+stablestorage_get_record(acceptor_storage * s, iid_t iid) {
+    acceptor_record * record_buffer = s->record_buffer;
     int flags, result;
     DBT dbkey, dbdata;
+    unsigned char key_buffer[sizeof(iid_t)];
     
-    memset(&dbkey, 0, sizeof(DBT));
     memset(&dbdata, 0, sizeof(DBT));
 
     //Key is iid
-    dbkey.data = &iid;
-    dbkey.size = sizeof(iid_t);
+    bdb_set_key(&dbkey, key_buffer, iid);
     
     //Data is our buffer
     dbdata.data = record_buffer;
@@ -342,19 +416,19 @@ stablestorage_get_record(iid_t iid) {
 
     //Read the record
     flags = 0;
-    result = dbp->get(dbp, 
-        txn, 
+    result = s->dbp->get(s->dbp, 
+        s->txn, 
         &dbkey, 
         &dbdata, 
         flags);
     
     if(result == DB_NOTFOUND || result == DB_KEYEMPTY) {
         //Record does not exist
-        LOG(DBG, ("The record for iid:%u does not exist\n", iid));
+        LOG(DBG, ("The record for iid:%"IID_FMT" does not exist\n", iid));
         return NULL;
     } else if (result != 0) {
         //Read error!
-        printf("Error while reading record for iid:%u : %s\n",
+        printf("Error while reading record for iid:%"IID_FMT" : %s\n",
             iid, db_strerror(result));
         return NULL;
     }
@@ -367,9 +441,11 @@ stablestorage_get_record(iid_t iid) {
 //Save a valid accept request, the instance may be new (no record)
 // or old with a smaller ballot, in both cases it creates a new record
 acceptor_record * 
-stablestorage_save_accept(accept_req * ar) {
+stablestorage_save_accept(acceptor_storage * s, accept_req * ar) {
+    acceptor_record * record_buffer = s->record_buffer;
     int flags, result;
     DBT dbkey, dbdata;
+    unsigned char key_buffer[sizeof(iid_t)];
     
     //Store as acceptor_record (== accept_ack)
     record_buffer->iid = ar->iid;
@@ -379,12 +455,10 @@ stablestorage_save_accept(accept_req * ar) {
     record_buffer->value_size = ar->value_size;
     memcpy(record_buffer->value, ar->value, ar->value_size);
     
-    memset(&dbkey, 0, sizeof(DBT));
     memset(&dbdata, 0, sizeof(DBT));
 
     //Key is iid
-    dbkey.data = &ar->iid;
-    dbkey.size = sizeof(iid_t);
+    bdb_set_key(&dbkey, key_buffer, ar->iid);
         
     //Data is our buffer
     dbdata.data = record_buffer;
@@ -392,8 +466,8 @@ stablestorage_save_accept(accept_req * ar) {
     
     //Store permanently
     flags = 0;
-    result = dbp->put(dbp, 
-        txn, 
+    result = s->dbp->put(s->dbp, 
+        s->txn, 
         &dbkey, 
         &dbdata, 
         0);
@@ -405,9 +479,11 @@ stablestorage_save_accept(accept_req * ar) {
 //Save a valid prepare request, the instance may be new (no record)
 // or old with a smaller ballot
 acceptor_record * 
-stablestorage_save_prepare(prepare_req * pr, acceptor_record * rec) {
+stablestorage_save_prepare(acceptor_storage * s, prepare_req * pr, acceptor_record * rec) {
+    acceptor_record * record_buffer = s->record_buffer;
     int flags, result;
     DBT dbkey, dbdata;
+    unsigned char key_buffer[sizeof(iid_t)];
     
     //No previous record, create a new one
     if (rec == NULL) {
@@ -423,12 +499,10 @@ stablestorage_save_prepare(prepare_req * pr, acceptor_record * rec) {
         rec->ballot = pr->ballot;
     }
     
-    memset(&dbkey, 0, sizeof(DBT));
     memset(&dbdata, 0, sizeof(DBT));
 
     //Key is iid
-    dbkey.data = &pr->iid;
-    dbkey.size = sizeof(iid_t);
+    bdb_set_key(&dbkey, key_buffer, pr->iid);
         
     //Data is our buffer
     dbdata.data = record_buffer;
@@ -436,8 +510,8 @@ stablestorage_save_prepare(prepare_req * pr, acceptor_record * rec) {
     
     //Store permanently
     flags = 0;
-    result = dbp->put(dbp, 
-        txn, 
+    result = s->dbp->put(s->dbp, 
+        s->txn, 
         &dbkey, 
         &dbdata, 
         0);
@@ -451,10 +525,11 @@ stablestorage_save_prepare(prepare_req * pr, acceptor_record * rec) {
 // The instance may be new or previously seen, in both cases 
 // this creates a new record
 acceptor_record * 
-stablestorage_save_final_value(char * value, size_t size, iid_t iid, ballot_t ballot) {
-
+stablestorage_save_final_value(acceptor_storage * s, char * value, size_t size, iid_t iid, ballot_t ballot) {
+    acceptor_record * record_buffer = s->record_buffer;
     int flags, result;
     DBT dbkey, dbdata;
+    unsigned char key_buffer[sizeof(iid_t)];
     
     //Store as acceptor_record (== accept_ack)
     record_buffer->iid = iid;
@@ -464,12 +539,10 @@ stablestorage_save_final_value(char * value, size_t size, iid_t iid, ballot_t ba
     record_buffer->value_size = size;
     memcpy(record_buffer->value, value, size);
     
-    memset(&dbkey, 0, sizeof(DBT));
     memset(&dbdata, 0, sizeof(DBT));
 
     //Key is iid
-    dbkey.data = &iid;
-    dbkey.size = sizeof(iid_t);
+    bdb_set_key(&dbkey, key_buffer, iid);
         
     //Data is our buffer
     dbdata.data = record_buffer;
@@ -477,8 +550,8 @@ stablestorage_save_final_value(char * value, size_t size, iid_t iid, ballot_t ba
     
     //Store permanently
     flags = 0;
-    result = dbp->put(dbp, 
-        txn, 
+    result = s->dbp->put(s->dbp, 
+        s->txn, 
         &dbkey, 
         &dbdata, 
         0);
@@ -1,6 +1,5 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <pthread.h> 
 #include <assert.h>
 #include <memory.h>
 
@@ -10,10 +9,9 @@
 #include "libpaxos.h"
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
+#include "paxos_metrics.h"
 
 #define LEARNER_ERROR (-1)
-#define LEARNER_READY (0)
-#define LEARNER_STARTING (1)
 #define INST_INFO_EMPTY (0)
 #define IS_CLOSED(INST) (INST->final_value != NULL)
 
@@ -23,65 +21,237 @@ typedef struct learner_instance_info {
     ballot_t        last_update_ballot;
     accept_ack*     acks[N_OF_ACCEPTORS];
     accept_ack*     final_value;
+    //When final_value was set
+    struct timeval  closed_at;
 } l_inst_info;
 
-//Highest instance for which a message was seen
-static iid_t highest_iid_seen = 1;
-
-//Current instance, incremented when current is closed and 
-// the corresponding value is delivered
-static iid_t current_iid = 1;
-
-//Highest instance that is already closed 
-// (can be higher than current!)
-//TODO: not used
-static iid_t highest_iid_closed = 0;
-
-//Array (used as a circular buffer) to store instance infos
-static l_inst_info learner_state[LEARNER_ARRAY_SIZE];
-
-//A custom initialization function to invoke after the normal initialization
-// Can be NULL
-static custom_init_function custom_init = NULL;
-
-//Function to invoke when the current_iid is closed, 
-// the final value and some other informations is passed as argument
-static deliver_function delfun = NULL;
-
-//Current status of the learner and related signal
-// The thread calling learner init waits until the new thread completed initialization
-static int learner_ready = LEARNER_STARTING;
-static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  ready_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t learner_thread = NULL;
-struct event init_complete_event;
-
-//Timeval interval to schedule events as soon as possible
-struct timeval asap_interval = {0, 0};
-
-//Libevent handle
-static struct event_base * eb;
-// Event: a message was received
-struct event learner_msg_event;
-// Event: time to check for holes
-static struct event hole_check_event;
-//Time interval for the previous event
-static struct timeval hole_check_interval;
-
-//Network managers
-static udp_send_buffer * to_acceptors;
-static udp_receiver * for_learner;
+//Last sequence numbers delivered for a given client
+typedef struct learner_client_record {
+    unsigned int    client_id;
+    //Highest sequence number delivered
+    unsigned int    max_seqno;
+    //Bit i is set if (max_seqno - i) was delivered
+    uint64_t        window;
+    //Instance of the last value delivered, for eviction
+    iid_t           last_iid;
+} l_client_record;
+#define DEDUP_WINDOW_SIZE 64
+#define DEDUP_PROBES 8
+
+//Memberships kept by a learner, the current one and the changes
+// still to be applied
+#define MEMBERSHIP_HISTORY_SIZE 8
+
+//Exported metrics of a learner (see paxos_metrics.h)
+struct learner_metrics {
+    paxos_metric * delivered;
+    paxos_metric * delivered_values;
+    paxos_metric * duplicates;
+    paxos_metric * acks_dropped;
+    paxos_metric * repeat_reqs;
+    paxos_metric * lagging;
+    paxos_metric * current_iid;
+    paxos_metric * highest_seen;
+    paxos_metric * membership_changes;
+    paxos_metric * noops;
+    paxos_metric * noop_requests;
+};
+
+//A learner, all its events are registered with eb
+struct paxos_learner_t {
+    //Libevent handle
+    struct event_base * eb;
+
+    //Consensus group of this learner (see PAXOS_GROUPS)
+    int                 group;
+
+    //Set if delivery is merged with the other groups
+    paxos_merged_learner * merge;
+
+    //Highest instance for which a message was seen
+    iid_t               highest_iid_seen;
+
+    //Current instance, incremented when current is closed and 
+    // the corresponding value is delivered
+    iid_t               current_iid;
+
+    //Highest instance that is already closed 
+    // (can be higher than current!)
+    iid_t               highest_iid_closed;
+
+    //Array (used as a circular buffer) to store instance infos,
+    // learner_array_size entries
+    l_inst_info *       state;
+
+    //Function to invoke when the current_iid is closed, 
+    // the final value and some other informations is passed as argument
+    deliver_callback    delfun;
+    void *              delarg;
+
+    //If set, the client values packed in an instance value are delivered
+    // one by one. Otherwise the instance value is delivered as it is.
+    int                 unpack_batches;
+
+    //Table of clients used to filter out duplicates, 
+    // unused records have client_id 0
+    l_client_record     dedup_table[LEARNER_DEDUP_TABLE_SIZE];
+
+    //Acceptors membership (see pax_submit_membership), circular
+    // buffer of the last changes, the initial membership is the first
+    paxos_membership    membership[MEMBERSHIP_HISTORY_SIZE];
+    unsigned int        membership_count;
+
+    // Event: a message was received
+    struct event        msg_event;
+    // Event: time to check for holes
+    struct event        hole_check_event;
+    //Time interval for the previous event
+    struct timeval      hole_check_interval;
+
+    //Network managers
+    udp_send_buffer *   to_acceptors;
+    udp_receiver *      for_learner;
+
+    struct learner_metrics metrics;
+};
+#define GET_LEA_INSTANCE(L, I) (&(L)->state[((I) & (paxos_conf.learner_array_size-1))])
+#define GET_DEDUP_RECORD(L, I) (&(L)->dedup_table[((I) & (LEARNER_DEDUP_TABLE_SIZE-1))])
+#define GET_MEMBERSHIP(L, N) (&(L)->membership[((N) & (MEMBERSHIP_HISTORY_SIZE-1))])
+
+/*
+    A merged learner runs one learner for each group on the same event
+    base. Instances are delivered round-robin: instance 1 of group 0,
+    instance 1 of group 1, ..., instance 2 of group 0 and so on.
+    A closed instance waits in the array of its learner until it's the
+    turn of its group, so the merged order advances as fast as the 
+    slowest group. The leader of a group behind the others is 
+    periodically asked to fill the gap with no-ops.
+*/
+struct paxos_merged_learner_t {
+    int                 groups;
+    //Group of the next instance to deliver
+    int                 turn;
+    //One for each group
+    paxos_learner **    learners;
+    //To the leader of each group, for the noop requests
+    udp_send_buffer **  to_leaders;
+
+    // Event: time to check if a group is behind
+    struct event        noop_check_event;
+    //Time interval for the previous event
+    struct timeval      noop_check_interval;
+};
+//Position of instance I of group G in the merged order, starting from 1
+#define MERGED_IID(M, G, I) ((((I) - 1) * (M)->groups) + (G) + 1)
+
+//The learner started by learner_init, used by the dedup state functions
+static paxos_learner * default_learner = NULL;
+
+//Duplicates table restored before learner_init
+static char * restored_dedup_table = NULL;
+
 
 /*-------------------------------------------------------------------------*/
 // Helpers
 /*-------------------------------------------------------------------------*/
 
 //Used by the proposer to check for completion of phase 2
-int learner_is_closed(iid_t iid) {
-    l_inst_info * ii = GET_LEA_INSTANCE(iid);
+int learner_is_closed(paxos_learner * l, iid_t iid) {
+    l_inst_info * ii = GET_LEA_INSTANCE(l, iid);
     return ((iid == ii->iid) && IS_CLOSED(ii));
 }
 
+//Used by the proposer to measure phase 2 latency, 
+// returns -1 if the instance is not closed
+int learner_closed_time(paxos_learner * l, iid_t iid, struct timeval * tv) {
+    l_inst_info * ii = GET_LEA_INSTANCE(l, iid);
+    if((iid != ii->iid) || !IS_CLOSED(ii)) {
+        return -1;
+    }
+    *tv = ii->closed_at;
+    return 0;
+}
+
+int learner_seen_accepts(paxos_learner * l, iid_t iid) {
+    l_inst_info * ii = GET_LEA_INSTANCE(l, iid);
+    return ((iid == ii->iid) || (l->highest_iid_seen > iid));
+}
+
+const paxos_membership * learner_membership(paxos_learner * l, iid_t iid) {
+    unsigned int n = l->membership_count - 1;
+    unsigned int oldest = 0;
+    if(l->membership_count > MEMBERSHIP_HISTORY_SIZE) {
+        oldest = l->membership_count - MEMBERSHIP_HISTORY_SIZE;
+    }
+    
+    //The most recent change that applies to iid
+    while(n > oldest && GET_MEMBERSHIP(l, n)->from_iid > iid) {
+        n--;
+    }
+    return GET_MEMBERSHIP(l, n);
+}
+
+//A membership change was decided in instance iid, 
+// it applies from iid + membership_alpha
+static void lea_membership_change(paxos_learner * l, membership_cmd * mc, iid_t iid) {
+    paxos_membership next;
+    
+    next.from_iid = iid + paxos_conf.membership_alpha;
+    next.members = mc->members;
+    next.acceptors = __builtin_popcount(mc->members);
+    next.phase1_quorum = mc->phase1_quorum;
+    next.phase2_quorum = mc->phase2_quorum;
+    next.fast_quorum = mc->fast_quorum;
+    
+    //Every learner decides the same, the instance is the same
+    if(next.acceptors == 0 || (next.members & ~ALL_ACCEPTORS) != 0 ||
+        paxos_quorums_check(next.acceptors, &next.phase1_quorum, 
+            &next.phase2_quorum, &next.fast_quorum) != 0) {
+        printf("Invalid membership change in iid:%"IID_FMT", ignored\n", iid);
+        return;
+    }
+    
+    //The oldest would be overwritten while still in use
+    if(l->membership_count >= MEMBERSHIP_HISTORY_SIZE &&
+        GET_MEMBERSHIP(l, l->membership_count + 1)->from_iid > iid) {
+        printf("Too many membership changes pending, iid:%"IID_FMT" ignored\n", iid);
+        return;
+    }
+    
+    *GET_MEMBERSHIP(l, l->membership_count) = next;
+    l->membership_count += 1;
+    METRIC_INC(l->metrics.membership_changes);
+    LOG(VRB, ("Acceptors %x are the members from iid:%"IID_FMT" (quorums p1:%d p2:%d)\n",
+        next.members, next.from_iid, next.phase1_quorum, next.phase2_quorum));
+}
+
+//Applies the membership changes in an instance value,
+// both for learners that unpack the values and for those who don't
+static void lea_membership_scan(paxos_learner * l, accept_ack * aa) {
+    value_batch * vb = (value_batch *)aa->value;
+    client_value * bv;
+    size_t offset = sizeof(value_batch);
+    short int i;
+    
+    //Checked and reported when delivered
+    if(aa->value_size < sizeof(value_batch)) {
+        return;
+    }
+    
+    for(i = 0; i < vb->count; i++) {
+        bv = (client_value *)&aa->value[offset];
+        if(offset + sizeof(client_value) > aa->value_size ||
+            offset + CLIENT_VALUE_SIZE(bv) > aa->value_size) {
+            return;
+        }
+        if(bv->client_id == MEMBERSHIP_CLIENT_ID && 
+            bv->value_size == sizeof(membership_cmd)) {
+            lea_membership_change(l, (membership_cmd *)bv->value, aa->iid);
+        }
+        offset += CLIENT_VALUE_SIZE(bv);
+    }
+}
+
 //Resets a given instance info
 static void lea_clear_instance_info(l_inst_info * ii) {
     //Reset all fields and free stored messages
@@ -116,7 +286,7 @@ static void lea_store_accept_ack(l_inst_info * ii, short int acceptor_id, accept
 static int lea_update_state(l_inst_info * ii, short int acceptor_id, accept_ack * aa) {
     //First message for this iid
     if(ii->iid == INST_INFO_EMPTY) {
-        LOG(DBG, ("Received first message for instance:%u\n", aa->iid));
+        LOG(DBG, ("Received first message for instance:%"IID_FMT"\n", aa->iid));
         ii->iid = aa->iid;
         ii->last_update_ballot = aa->ballot;
     }
@@ -124,13 +294,13 @@ static int lea_update_state(l_inst_info * ii, short int acceptor_id, accept_ack
     
     //Instance closed already, drop
     if(IS_CLOSED(ii)) {
-        LOG(DBG, ("Dropping accept_ack for iid:%u, already closed\n", aa->iid));
+        LOG(DBG, ("Dropping accept_ack for iid:%"IID_FMT", already closed\n", aa->iid));
         return 0;
     }
     
     //No previous message to overwrite for this acceptor
     if(ii->acks[acceptor_id] == NULL) {
-        LOG(DBG, ("Got first ack for iid:%u, acceptor:%d\n", \
+        LOG(DBG, ("Got first ack for iid:%"IID_FMT", acceptor:%d\n", \
             ii->iid, acceptor_id));
         //Save this accept_ack
         lea_store_accept_ack(ii, acceptor_id, aa);
@@ -143,23 +313,65 @@ static int lea_update_state(l_inst_info * ii, short int acceptor_id, accept_ack
     
     //Already more recent info in the record, accept_ack is old
     if(prev_ack->ballot >= aa->ballot) {
-        LOG(DBG, ("Dropping accept_ack for iid:%u, stored ballot is newer or equal\n", aa->iid));
+        LOG(DBG, ("Dropping accept_ack for iid:%"IID_FMT", stored ballot is newer or equal\n", aa->iid));
         return 0;
     }
     
     //Replace the previous ack since the received ballot is newer
-    LOG(DBG, ("Overwriting previous accept_ack for iid:%u\n", aa->iid));
+    LOG(DBG, ("Overwriting previous accept_ack for iid:%"IID_FMT"\n", aa->iid));
     PAX_FREE(prev_ack);
     lea_store_accept_ack(ii, acceptor_id, aa);
     ii->last_update_ballot = aa->ballot;
     return 1;
 }
 
+//In a fast round, acceptors may accept different values with 
+// the same ballot: a fast quorum must agree on the value too.
+//Returns 1 if the instance is closed, 0 otherwise
+static int lea_check_fast_quorum(paxos_learner * l, l_inst_info * ii) {
+    const paxos_membership * m = learner_membership(l, ii->iid);
+    size_t i, j, count;
+    accept_ack * curr_ack;
+    accept_ack * other_ack;
+
+    for(i = 0; i < N_OF_ACCEPTORS; i++) {
+        curr_ack = ii->acks[i];
+        if(curr_ack == NULL || curr_ack->ballot != ii->last_update_ballot) {
+            continue;
+        }
+        
+        //Count the acks with the same value as this one
+        count = 0;
+        for(j = 0; j < N_OF_ACCEPTORS; j++) {
+            other_ack = ii->acks[j];
+            if(other_ack != NULL && 
+                other_ack->ballot == curr_ack->ballot &&
+                other_ack->value_size == curr_ack->value_size &&
+                memcmp(other_ack->value, curr_ack->value, curr_ack->value_size) == 0) {
+                count++;
+            }
+        }
+        
+        if(count >= (size_t)m->fast_quorum) {
+            LOG(DBG, ("Reached fast quorum, iid:%"IID_FMT" is closed!\n", ii->iid));
+            ii->final_value = curr_ack;
+            gettimeofday(&ii->closed_at, NULL);
+            if(ii->iid > l->highest_iid_closed) {
+                l->highest_iid_closed = ii->iid;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
 //Checks if a given instance is closed, that is if a quorum of acceptor
 // accepted the same value+ballot
 //Returns 1 if the instance is closed, 0 otherwise
-static int lea_check_quorum(l_inst_info * ii) {
+static int lea_check_quorum(paxos_learner * l, l_inst_info * ii) {
+    const paxos_membership * m = learner_membership(l, ii->iid);
     size_t i, a_valid_index = -1, count = 0;
+    int final_found = 0;
     accept_ack * curr_ack;
     
     //Iterates over stored acks
@@ -181,20 +393,26 @@ static int lea_check_quorum(l_inst_info * ii) {
             // immediately.
             if(curr_ack->is_final) {
                 //For sure >= than quorum...
-                count += N_OF_ACCEPTORS;
+                count += m->acceptors;
+                final_found = 1;
                 break;
             }
         }
     }
     
-    //Reached a quorum/majority!
-    if(count >= QUORUM) {
-        LOG(DBG, ("Reached quorum, iid:%u is closed!\n", ii->iid));
+    if(!final_found && IS_FAST_BALLOT(ii->last_update_ballot)) {
+        return lea_check_fast_quorum(l, ii);
+    }
+    
+    //Reached a phase 2 quorum!
+    if(count >= (size_t)m->phase2_quorum) {
+        LOG(DBG, ("Reached quorum, iid:%"IID_FMT" is closed!\n", ii->iid));
         ii->final_value = ii->acks[a_valid_index];
+        gettimeofday(&ii->closed_at, NULL);
         
         //Keep track of highest closed
-        if(ii->iid > highest_iid_closed) {
-            highest_iid_closed = ii->iid;
+        if(ii->iid > l->highest_iid_closed) {
+            l->highest_iid_closed = ii->iid;
         }
 
         return 1;
@@ -205,30 +423,188 @@ static int lea_check_quorum(l_inst_info * ii) {
 
 }
 
+//Returns the record for the given client, if not in the table 
+// the least recently delivered record is replaced.
+// Learners deliver the same sequence of values, therefore 
+// all learners evict the same clients.
+static l_client_record * lea_dedup_lookup(paxos_learner * l, unsigned int client_id) {
+    unsigned int i;
+    l_client_record * rec;
+    l_client_record * oldest = NULL;
+    
+    for(i = 0; i < DEDUP_PROBES; i++) {
+        rec = GET_DEDUP_RECORD(l, client_id + i);
+        if(rec->client_id == client_id) {
+            return rec;
+        }
+        if(rec->client_id == 0) {
+            oldest = rec;
+            break;
+        }
+        if(oldest == NULL || rec->last_iid < oldest->last_iid) {
+            oldest = rec;
+        }
+    }
+    
+    //Create a new record
+    memset(oldest, 0, sizeof(l_client_record));
+    oldest->client_id = client_id;
+    return oldest;
+}
+
+//Returns 1 if the given value was already delivered, 
+// otherwise marks it as delivered and returns 0
+static int lea_dedup_check(paxos_learner * l, client_value * cv, iid_t iid) {
+    //Anonymous client, cannot tell
+    if(cv->client_id == 0) {
+        return 0;
+    }
+    
+    l_client_record * rec = lea_dedup_lookup(l, cv->client_id);
+    
+    //First value from this client
+    if(rec->window == 0) {
+        rec->max_seqno = cv->seqno;
+        rec->window = 1;
+        rec->last_iid = iid;
+        return 0;
+    }
+    
+    int distance = (int)(cv->seqno - rec->max_seqno);
+
+    if(distance > 0) {
+        //Newer than any other, slide the window
+        if(distance >= DEDUP_WINDOW_SIZE) {
+            rec->window = 0;
+        } else {
+            rec->window <<= distance;
+        }
+        rec->window |= 1;
+        rec->max_seqno = cv->seqno;
+    } else if (distance <= -DEDUP_WINDOW_SIZE) {
+        //Too old to tell, assume it's a duplicate
+        return 1;
+    } else {
+        uint64_t bit = ((uint64_t)1 << (-distance));
+        if(rec->window & bit) {
+            return 1;
+        }
+        rec->window |= bit;
+    }
+    
+    rec->last_iid = iid;
+    return 0;
+}
+
+//Delivers one by one the client values packed in an instance value,
+// with out_iid as instance id
+static void lea_deliver_batch(paxos_learner * l, accept_ack * aa, short int proposer_id, 
+    iid_t out_iid) {
+    value_batch * vb = (value_batch *)aa->value;
+    client_value * bv;
+    size_t offset = sizeof(value_batch);
+    short int i;
+    
+    if(aa->value_size < sizeof(value_batch)) {
+        printf("Invalid value batch in iid:%"IID_FMT", not delivered\n", aa->iid);
+        return;
+    }
+    
+    //No-op (hole filled by a leader), nothing to deliver
+    if(vb->count == 0) {
+        METRIC_INC(l->metrics.noops);
+        return;
+    }
+    
+    for(i = 0; i < vb->count; i++) {
+        bv = (client_value *)&aa->value[offset];
+        //Make sure the value is within the instance value
+        if(offset + sizeof(client_value) > aa->value_size ||
+            offset + CLIENT_VALUE_SIZE(bv) > aa->value_size) {
+            printf("Invalid value batch in iid:%"IID_FMT", value %d not delivered\n", 
+                aa->iid, i);
+            return;
+        }
+        //Membership change, applied already
+        if(bv->client_id == MEMBERSHIP_CLIENT_ID) {
+            offset += CLIENT_VALUE_SIZE(bv);
+            continue;
+        }
+        //Resubmitted value, delivered already
+        if(lea_dedup_check(l, bv, aa->iid)) {
+            LOG(DBG, ("Duplicate value from client %u (seqno:%u) in iid:%"IID_FMT"\n",
+                bv->client_id, bv->seqno, aa->iid));
+            METRIC_INC(l->metrics.duplicates);
+            offset += CLIENT_VALUE_SIZE(bv);
+            continue;
+        }
+        l->delfun(bv->value, bv->value_size, out_iid, aa->ballot, proposer_id, l->delarg);
+        METRIC_INC(l->metrics.delivered_values);
+        offset += CLIENT_VALUE_SIZE(bv);
+    }
+}
+
+//Delivers the current_iid (closed) with out_iid as instance id, 
+// then moves to the next instance
+static void lea_deliver_current(paxos_learner * l, l_inst_info * ii, iid_t out_iid) {
+    assert(ii->iid == l->current_iid);
+    accept_ack * aa = ii->final_value;
+    
+    //Before the application sees the value
+    lea_membership_scan(l, aa);
+    
+    //Deliver the value trough callback
+    short int proposer_id = aa->ballot % MAX_N_OF_PROPOSERS;
+    if(l->unpack_batches) {
+        lea_deliver_batch(l, aa, proposer_id, out_iid);
+    } else {
+        l->delfun(aa->value, aa->value_size, out_iid, aa->ballot, 
+            proposer_id, l->delarg);
+        METRIC_INC(l->metrics.delivered_values);
+    }
+    
+    //Move to next instance
+    l->current_iid++;
+    METRIC_INC(l->metrics.delivered);
+    METRIC_SET(l->metrics.current_iid, l->current_iid);
+    
+    //Clear the state
+    lea_clear_instance_info(ii);
+}
+
+//Delivers the closed instances of all groups, as long as the 
+// one of the group in turn is closed
+static void lea_merge_deliver(paxos_merged_learner * m) {
+    paxos_learner * l = m->learners[m->turn];
+    l_inst_info * ii = GET_LEA_INSTANCE(l, l->current_iid);
+    
+    while(IS_CLOSED(ii)) {
+        lea_deliver_current(l, ii, MERGED_IID(m, m->turn, l->current_iid));
+        
+        m->turn = (m->turn + 1) % m->groups;
+        l = m->learners[m->turn];
+        ii = GET_LEA_INSTANCE(l, l->current_iid);
+    }
+}
+
 //Invoked when the current_iid is closed.
 // Since other instances may be closed too (curr+1, curr+2), also tries to deliver them
-static void lea_deliver_next_closed() {
+static void lea_deliver_next_closed(paxos_learner * l) {
+    //Waits for the turn of this group
+    if(l->merge != NULL) {
+        lea_merge_deliver(l->merge);
+        return;
+    }
+    
     //Get next instance (last delivered + 1)
-    l_inst_info * ii = GET_LEA_INSTANCE(current_iid);
-    accept_ack * aa;
+    l_inst_info * ii = GET_LEA_INSTANCE(l, l->current_iid);
     
     //If closed deliver it and all next closed
     while(IS_CLOSED(ii)) {
-        assert(ii->iid == current_iid);
-        aa = ii->final_value;
-        
-        //Deliver the value trough callback
-        short int proposer_id = aa->ballot % MAX_N_OF_PROPOSERS;
-        delfun(aa->value, aa->value_size, current_iid, aa->ballot, proposer_id);
-        
-        //Move to next instance
-        current_iid++;
-        
-        //Clear the state
-        lea_clear_instance_info(ii);
+        lea_deliver_current(l, ii, l->current_iid);
         
         //Go on and try to deliver next
-        ii = GET_LEA_INSTANCE(current_iid);
+        ii = GET_LEA_INSTANCE(l, l->current_iid);
     }
 
 }
@@ -236,22 +612,23 @@ static void lea_deliver_next_closed() {
 //Creates a batch of repeat_req to send to the acceptor, 
 // asking to retransmit their accepted value for a given instance
 static void 
-lea_send_repeat_request(iid_t from, iid_t to) {
+lea_send_repeat_request(paxos_learner * l, iid_t from, iid_t to) {
     iid_t i;
     
     l_inst_info * ii;
     //Create empty repeat_request in buffer
-    sendbuf_clear(to_acceptors, repeat_reqs, -1);
+    sendbuf_clear(l->to_acceptors, repeat_reqs, -1);
     
     for(i = from; i < to; i++) {
         //Request all non-closed in from...to range
-        ii = GET_LEA_INSTANCE(i);
+        ii = GET_LEA_INSTANCE(l, i);
         if(!IS_CLOSED(ii)) {
-            sendbuf_add_repeat_req(to_acceptors, i);
+            sendbuf_add_repeat_req(l->to_acceptors, i);
+            METRIC_INC(l->metrics.repeat_reqs);
         }
     }
     //Flush if dirty flag is set
-    sendbuf_flush(to_acceptors);
+    sendbuf_flush(l->to_acceptors);
 }
 
 //This function is invoked periodically and tries to detect if the learner 
@@ -262,79 +639,128 @@ static void
 lea_hole_check(int fd, short event, void *arg) {
     UNUSED_ARG(fd);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_learner * l = arg;
 
     //Periodic check for missing instances
     //(i.e. i+1 closed, but i not closed yet)
-    if (highest_iid_seen > current_iid + LEARNER_ARRAY_SIZE) {
-        LOG(0, ("This learner is lagging behind!!!, highest seen:%u, highest delivered:%u\n", 
-            highest_iid_seen, current_iid-1));
-        lea_send_repeat_request(current_iid, highest_iid_seen);
-    } else if(highest_iid_closed > current_iid) {
-        LOG(VRB, ("Out of sync, highest closed:%u, highest delivered:%u\n", 
-            highest_iid_closed, current_iid-1));
+    if (l->highest_iid_seen > l->current_iid + paxos_conf.learner_array_size) {
+        LOG(0, ("This learner is lagging behind!!!, highest seen:%"IID_FMT", highest delivered:%"IID_FMT"\n", 
+            l->highest_iid_seen, l->current_iid-1));
+        METRIC_INC(l->metrics.lagging);
+        lea_send_repeat_request(l, l->current_iid, l->highest_iid_seen);
+    } else if(l->highest_iid_closed > l->current_iid) {
+        LOG(VRB, ("Out of sync, highest closed:%"IID_FMT", highest delivered:%"IID_FMT"\n", 
+            l->highest_iid_closed, l->current_iid-1));
         //Ask retransmission to acceptors
-        lea_send_repeat_request(current_iid, highest_iid_closed);
+        lea_send_repeat_request(l, l->current_iid, l->highest_iid_closed);
     }
 
     //Set the next timeout for calling this function
-    if(event_add(&hole_check_event, &hole_check_interval) != 0) {
+    if(event_add(&l->hole_check_event, &l->hole_check_interval) != 0) {
 	   printf("Error while adding next hole_check event\n");
 	}
 }
 
+//Invoked periodically by a merged learner. If the group in turn has 
+// no closed instance to deliver, but the others closed later ones, 
+// its leader is asked to fill the gap with no-ops
+static void
+lea_merge_noop_check(int fd, short event, void *arg) {
+    UNUSED_ARG(fd);
+    UNUSED_ARG(event);
+    paxos_merged_learner * m = arg;
+    paxos_learner * l = m->learners[m->turn];
+    noop_request nr;
+    int i;
+    
+    nr.target_iid = 0;
+    for(i = 0; i < m->groups; i++) {
+        if(i != m->turn && m->learners[i]->highest_iid_closed > nr.target_iid) {
+            nr.target_iid = m->learners[i]->highest_iid_closed;
+        }
+    }
+    
+    if(nr.target_iid >= l->current_iid && 
+        !IS_CLOSED(GET_LEA_INSTANCE(l, l->current_iid))) {
+        LOG(VRB, ("Group %d is behind, asking no-ops up to %"IID_FMT"\n",
+            m->turn, nr.target_iid));
+        sendbuf_clear(m->to_leaders[m->turn], submit, 0);
+        sendbuf_add_submit_val(m->to_leaders[m->turn], NOOP_REQUEST_CLIENT_ID, 
+            0, (char*)&nr, sizeof(noop_request));
+        sendbuf_flush(m->to_leaders[m->turn]);
+        METRIC_INC(l->metrics.noop_requests);
+    }
+    
+    if(event_add(&m->noop_check_event, &m->noop_check_interval) != 0) {
+	   printf("Error while adding next noop_check event\n");
+	}
+}
+
 /*-------------------------------------------------------------------------*/
 // Event handlers
 /*-------------------------------------------------------------------------*/
 
 // Called when an accept_ack is received, the learner will update it's status
 // for that instance and afterward check if the instance is closed
-static void handle_accept_ack(short int acceptor_id, accept_ack * aa) {
+static void handle_accept_ack(paxos_learner * l, short int acceptor_id, accept_ack * aa) {
     //Keep track of highest seen instance id
-    if(aa->iid > highest_iid_seen) {
-        highest_iid_seen = aa->iid;
+    if(aa->iid > l->highest_iid_seen) {
+        l->highest_iid_seen = aa->iid;
+        METRIC_SET(l->metrics.highest_seen, l->highest_iid_seen);
     }
     
     //Already closed and delivered, ignore message
-    if(aa->iid < current_iid) {
-        LOG(DBG, ("Dropping accept_ack for already delivered iid:%u\n", aa->iid));
+    if(aa->iid < l->current_iid) {
+        LOG(DBG, ("Dropping accept_ack for already delivered iid:%"IID_FMT"\n", aa->iid));
+        METRIC_INC(l->metrics.acks_dropped);
         return;
     }
     
     //We are late w.r.t the current iid, ignore message
     // (The instence received is too ahead and will overwrite something)
-    if(aa->iid >= current_iid + LEARNER_ARRAY_SIZE) {
-        LOG(DBG, ("Dropping accept_ack for iid:%u, too far in future\n", aa->iid));
+    if(aa->iid >= l->current_iid + paxos_conf.learner_array_size) {
+        LOG(DBG, ("Dropping accept_ack for iid:%"IID_FMT", too far in future\n", aa->iid));
+        METRIC_INC(l->metrics.acks_dropped);
+        return;
+    }
+
+    //Not a member in this instance, only a final value is relevant
+    // (i.e. from an acceptor that joined later)
+    if(!IS_MEMBER(learner_membership(l, aa->iid), acceptor_id) && !aa->is_final) {
+        LOG(DBG, ("Dropping accept_ack for iid:%"IID_FMT", acceptor %d is not a member\n", 
+            aa->iid, acceptor_id));
+        METRIC_INC(l->metrics.acks_dropped);
         return;
     }
 
     //Message is within interesting bounds
     //Update the corresponding record
-    l_inst_info * ii = GET_LEA_INSTANCE(aa->iid);
+    l_inst_info * ii = GET_LEA_INSTANCE(l, aa->iid);
     int relevant = lea_update_state(ii, acceptor_id, aa);
     if(!relevant) {
         //Not really interesting (i.e. a duplicate message)
-        LOG(DBG, ("Learner discarding learn for iid:%u\n", aa->iid));
+        LOG(DBG, ("Learner discarding learn for iid:%"IID_FMT"\n", aa->iid));
+        METRIC_INC(l->metrics.acks_dropped);
         return;
     }
     
     // Message contained some relevant info, 
     // check if instance can be declared closed
-    int closed = lea_check_quorum(ii);
+    int closed = lea_check_quorum(l, ii);
     if(!closed) {
-        LOG(DBG, ("Not yet a quorum for iid:%u\n", aa->iid));
+        LOG(DBG, ("Not yet a quorum for iid:%"IID_FMT"\n", aa->iid));
         return;
     }
 
     //If the closed instance is the current one,
     //Deliver it (and the followings if already closed)
-    if (aa->iid == current_iid) {
-        lea_deliver_next_closed(aa->iid);
+    if (aa->iid == l->current_iid) {
+        lea_deliver_next_closed(l);
     }
 }
 
 // Called when an accept_ack_batch is received
-static void handle_accept_ack_batch(accept_ack_batch* aab) {
+static void handle_accept_ack_batch(paxos_learner * l, accept_ack_batch* aab) {
     size_t data_offset;
     accept_ack * aa;
     
@@ -344,7 +770,7 @@ static void handle_accept_ack_batch(accept_ack_batch* aab) {
     //Iterate over accept_ack messages in batch
     for(i = 0; i < aab->count; i++) {
         aa = (accept_ack*) &aab->data[data_offset];
-        handle_accept_ack(aab->acceptor_id, aa);
+        handle_accept_ack(l, aab->acceptor_id, aa);
         data_offset += ACCEPT_ACK_SIZE(aa);
     }    
 }
@@ -354,21 +780,21 @@ static void lea_handle_newmsg(int sock, short event, void *arg) {
     //Make the compiler happy!
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_learner * l = arg;
     
-    assert(sock == for_learner->sock);
+    assert(sock == l->for_learner->sock);
 
     //Read and validate next message from socket
-    int valid = udp_read_next_message(for_learner);    
+    int valid = udp_read_next_message(l->for_learner);    
     if (valid < 0) {
         printf("Dropping invalid learner message\n");
         return;
     }
     
-    paxos_msg * msg = (paxos_msg*) &for_learner->recv_buffer;
+    paxos_msg * msg = (paxos_msg*) &l->for_learner->recv_buffer;
     switch(msg->type) {
         case accept_acks: {
-            handle_accept_ack_batch((accept_ack_batch*) msg->data);
+            handle_accept_ack_batch(l, (accept_ack_batch*) msg->data);
         }
         break;
 
@@ -383,52 +809,77 @@ static void lea_handle_newmsg(int sock, short event, void *arg) {
 /*-------------------------------------------------------------------------*/
 
 //Initialize records array (circular buffer)
-static int init_lea_structs() {
-    // Check array size
-    if ((LEARNER_ARRAY_SIZE & (LEARNER_ARRAY_SIZE -1)) != 0) {
-        printf("Error: LEARNER_ARRAY_SIZE is not a power of 2\n");
+static int init_lea_structs(paxos_learner * l) {
+    // Check array size (learner_array_size is checked with the config)
+    if ((LEARNER_DEDUP_TABLE_SIZE & (LEARNER_DEDUP_TABLE_SIZE -1)) != 0) {
+        printf("Error: LEARNER_DEDUP_TABLE_SIZE is not a power of 2\n");
         return LEARNER_ERROR;
     }
     
-    // Clear the state array
-    memset(learner_state, 0, (sizeof(l_inst_info) * LEARNER_ARRAY_SIZE));
-    size_t i;
-    for(i = 0; i < LEARNER_ARRAY_SIZE; i++) {
-        lea_clear_instance_info(&learner_state[i]);
+    // Allocate and clear the state array
+    size_t i, size = (sizeof(l_inst_info) * paxos_conf.learner_array_size);
+    l->state = PAX_MALLOC(size);
+    memset(l->state, 0, size);
+    for(i = 0; i < (size_t)paxos_conf.learner_array_size; i++) {
+        lea_clear_instance_info(&l->state[i]);
     }
     return 0;
 }
 
+//Register the exported metrics, labeled with the group 
+// and the number of learners created before this one
+static void init_lea_metrics(paxos_learner * l) {
+    static int learners_count = 0;
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    struct learner_metrics * m = &l->metrics;
+    
+    snprintf(label, sizeof(label), "group=\"%d\",learner=\"%d\"", 
+        l->group, __sync_fetch_and_add(&learners_count, 1));
+    m->delivered = metrics_register_label("learner_delivered", label, metric_counter);
+    m->delivered_values = metrics_register_label("learner_delivered_values", label, metric_counter);
+    m->duplicates = metrics_register_label("learner_duplicates", label, metric_counter);
+    m->acks_dropped = metrics_register_label("learner_acks_dropped", label, metric_counter);
+    m->repeat_reqs = metrics_register_label("learner_repeat_reqs", label, metric_counter);
+    m->lagging = metrics_register_label("learner_lagging", label, metric_counter);
+    m->current_iid = metrics_register_label("learner_current_iid", label, metric_gauge);
+    m->highest_seen = metrics_register_label("learner_highest_seen_iid", label, metric_gauge);
+    m->membership_changes = metrics_register_label("learner_membership_changes", label, metric_counter);
+    m->noops = metrics_register_label("learner_noops", label, metric_counter);
+    m->noop_requests = metrics_register_label("learner_noop_requests", label, metric_counter);
+}
+
 //Initializes socket managers and relative events
-static int init_lea_network() {
+static int init_lea_network(paxos_learner * l) {
     
     // Send buffer for talking to acceptors
-    to_acceptors = udp_sendbuf_new(PAXOS_ACCEPTORS_NET);
-    if(to_acceptors == NULL) {
+    l->to_acceptors = udp_sendbuf_new(CONF_NET_GROUP(acceptors_net, l->group));
+    if(l->to_acceptors == NULL) {
         printf("Error creating learner network sender\n");
         return LEARNER_ERROR;
     }
     
     // Message receive event
-    for_learner = udp_receiver_new(PAXOS_LEARNERS_NET);
-    if (for_learner == NULL) {
+    l->for_learner = udp_receiver_new(CONF_NET_GROUP(learners_net, l->group));
+    if (l->for_learner == NULL) {
         printf("Error creating learner network receiver\n");
         return LEARNER_ERROR;
     }
-    event_set(&learner_msg_event, for_learner->sock, EV_READ|EV_PERSIST, lea_handle_newmsg, NULL);
-    event_add(&learner_msg_event, NULL);
+    event_set(&l->msg_event, l->for_learner->sock, EV_READ|EV_PERSIST, lea_handle_newmsg, l);
+    event_base_set(l->eb, &l->msg_event);
+    event_add(&l->msg_event, NULL);
     
     return 0;
 }
 
 //Set up the first timer for hole checking
 static int 
-init_lea_timers() {
-    evtimer_set(&hole_check_event, lea_hole_check, NULL);
-	evutil_timerclear(&hole_check_interval);
-	hole_check_interval.tv_sec = LEARNER_HOLECHECK_INTERVAL / 1000000;
-    hole_check_interval.tv_usec = LEARNER_HOLECHECK_INTERVAL % 1000000;
-	if(event_add(&hole_check_event, &hole_check_interval) != 0) {
+init_lea_timers(paxos_learner * l) {
+    evtimer_set(&l->hole_check_event, lea_hole_check, l);
+    event_base_set(l->eb, &l->hole_check_event);
+	evutil_timerclear(&l->hole_check_interval);
+	l->hole_check_interval.tv_sec = paxos_conf.learner_holecheck_interval / 1000000;
+    l->hole_check_interval.tv_usec = paxos_conf.learner_holecheck_interval % 1000000;
+	if(event_add(&l->hole_check_event, &l->hole_check_interval) != 0) {
 	   printf("Error while adding first periodic hole_check event\n");
        return -1;
 	}
@@ -436,172 +887,289 @@ init_lea_timers() {
     return 0;
 }
 
-//Invoked when learner init fails. Sets the state to error and 
-// wakes up the thread that called learner_init
-static void 
-init_lea_failure(char * msg) {
-    //Init failed for some reason
-    printf("Learner init error: %s\n", msg);
-    
-    //Set status to error and wake up 
-    //the thread that called learner_init
-    pthread_mutex_lock(&ready_lock);
-    learner_ready = LEARNER_ERROR;
-    pthread_cond_signal(&ready_cond);
-    pthread_mutex_unlock(&ready_lock);
-}
-
-//Invoked as first event of libevent loop, if learner init 
-// completes successfully. Sets the state to ready
-//  and wakes up the thread that called learner_init
-static void
-init_lea_success(int fd, short event, void *arg) {
-    UNUSED_ARG(fd);
-    UNUSED_ARG(event);
-    UNUSED_ARG(arg);
-
-    LOG(DBG, ("Learner thread setting status to ready\n"));
-    //Init completed successfully, wake up
-    //the thread that called learner_init
-    pthread_mutex_lock(&ready_lock);
-    learner_ready = LEARNER_READY;
-    pthread_cond_signal(&ready_cond);
-    pthread_mutex_unlock(&ready_lock);
-}
-
-//Set up the first event to be executed ASAP, 
-// signaling that the initialization is complete
-static int
-init_lea_signal_ready() {
-    evtimer_set(&init_complete_event, init_lea_success, NULL);
-	if(event_add(&init_complete_event, &asap_interval) != 0) {
-	   printf("Error while adding lea successful init event\n");
-       return -1;
-   }
-   return 0;
-}
-
-
-//This function is invoked by libevent in a new thread. It initializes the learner, 
-// and starts the libevent loop (which never returns)
-static void* 
-init_learner_thread(void* arg) {
+//Creates a learner on the given event base, 
+// returns NULL if the initialization fails
+static paxos_learner *
+lea_new(struct event_base * eb, int group, deliver_callback f, void * arg, int unpack) {
     //The deliver callback cannot be null
     //(why starting a learner otherwise?)
-    delfun = (deliver_function) arg;
-    if(delfun == NULL) {
-        init_lea_failure("Error in libevent init\n");
+    if(f == NULL) {
         printf("Error NULL callback!\n");
         return NULL;
     }
     
-    //Initialization of libevent handle
-    if((eb = event_init()) == NULL) {
-        init_lea_failure("Error in libevent init\n");
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return NULL;
+    }
+    
+    if(group < 0 || group >= paxos_conf.groups) {
+        printf("Invalid group:%d\n", group);
         return NULL;
     }
     
+    paxos_learner * l = PAX_MALLOC(sizeof(paxos_learner));
+    memset(l, 0, sizeof(paxos_learner));
+    l->eb = eb;
+    l->group = group;
+    l->highest_iid_seen = 1;
+    l->current_iid = 1;
+    l->highest_iid_closed = 0;
+    l->delfun = f;
+    l->delarg = arg;
+    l->unpack_batches = unpack;
+    
+    //Initial membership, acceptors 0...acceptors-1
+    paxos_membership * m = GET_MEMBERSHIP(l, 0);
+    m->from_iid = 1;
+    m->members = (1U << paxos_conf.acceptors) - 1;
+    m->acceptors = paxos_conf.acceptors;
+    m->phase1_quorum = paxos_conf.phase1_quorum;
+    m->phase2_quorum = paxos_conf.phase2_quorum;
+    m->fast_quorum = paxos_conf.fast_quorum;
+    l->membership_count = 1;
+    
     //Normal learner initialization, private structures
-    if(init_lea_structs() != 0) {
-        init_lea_failure("Error in learner structures initialization\n");
+    if(init_lea_structs(l) != 0) {
+        printf("Learner init error: structures initialization\n");
+        learner_free(l);
         return NULL;
     }
+    init_lea_metrics(l);
     
     //Init sockets and send buffer
-    if(init_lea_network() != 0) {
-        init_lea_failure("Error in learner network init\n");
+    if(init_lea_network(l) != 0) {
+        printf("Learner init error: network init\n");
+        learner_free(l);
         return NULL;
     }
 
     //Timers initialization
-    if(init_lea_timers() != 0) {
-        init_lea_failure("Error in learner timers initialization\n");
+    if(init_lea_timers(l) != 0) {
+        printf("Learner init error: timers initialization\n");
+        learner_free(l);
         return NULL;
     }
     
-    //Call custom init (i.e. to register additional events)
-    if(custom_init != NULL && custom_init() != 0) {
-        init_lea_failure("Error in custom_init_function\n");
+    //Metrics dump, shared by all the roles in this process
+    if(metrics_listen(eb) != 0) {
+        printf("Learner init error: metrics socket initialization\n");
+        learner_free(l);
         return NULL;
-    } else {
-        LOG(DBG, ("Custom init completed\n"));
     }
     
-    // Signal client, learner is ready
-    if(init_lea_signal_ready() != 0) {
-        init_lea_failure("Error in learner timers initialization\n");
-        return NULL;
-    }
+    LOG(VRB, ("Learner is ready\n"));
+    return l;
+}
 
-    // Start the libevent loop, should never return
-    LOG(DBG, ("Learner thread ready, starting libevent loop\n"));
-    event_dispatch();
-    printf("libeven loop terminated\n");
-    return NULL;
+//Adapts the deliver_function of learner_init to a deliver_callback
+static void
+lea_legacy_deliver(char * value, size_t size, iid_t iid, ballot_t ballot, 
+    int proposer, void * arg) {
+    deliver_function * f = arg;
+    (*f)(value, size, iid, ballot, proposer);
 }
 
-// This function waits until the learner status is set 
-// (to 'ready' or to 'error') and returns the corresponding value
-static int 
-init_lea_wait_ready() {
-    int status;
-    
-    pthread_mutex_lock(&ready_lock);
-    
-    while(1) {
-        //Wait for a signal
-        pthread_cond_wait(&ready_cond, &ready_lock);
-        status = learner_ready;
+//Arguments of learner_init, passed to the learner thread
+typedef struct lea_legacy_args_t {
+    deliver_function    delfun;
+    custom_init_function cif;
+} lea_legacy_args;
 
-        if(status == LEARNER_STARTING) {
-        //Not ready yet, keep waiting
-            continue;            
-        } else {
-        //Status changed
-            break;
-        }
+//Invoked in the learner thread by paxos_thread_start
+static int
+init_lea_legacy(struct event_base * eb, void * arg) {
+    lea_legacy_args * la = arg;
+    
+    if(la->delfun == NULL) {
+        printf("Error NULL callback!\n");
+        return -1;
     }
     
-    //Check that status is a valid value
-    if (status != LEARNER_READY && status != LEARNER_ERROR) {
-        printf("Unknow learner status: %d\n", status);
-        status = LEARNER_ERROR;
+    default_learner = lea_new(eb, 0, lea_legacy_deliver, &la->delfun, 1);
+    if(default_learner == NULL) {
+        return -1;
     }
     
-    pthread_mutex_unlock(&ready_lock);
-    return status;
+    //Restored before the learner existed
+    if(restored_dedup_table != NULL) {
+        memcpy(default_learner->dedup_table, restored_dedup_table, 
+            sizeof(default_learner->dedup_table));
+        PAX_FREE(restored_dedup_table);
+        restored_dedup_table = NULL;
+    }
+
+    //Call custom init (i.e. to register additional events)
+    if(la->cif != NULL && la->cif() != 0) {
+        printf("Learner init error: custom_init_function\n");
+        return -1;
+    }
+    LOG(DBG, ("Custom init completed\n"));
+    return 0;
 }
 
 /*-------------------------------------------------------------------------*/
 // Public functions (see libpaxos.h for more details)
 /*-------------------------------------------------------------------------*/
 
+paxos_learner * learner_new(struct event_base * eb, int group, deliver_callback f, void * arg) {
+    return lea_new(eb, group, f, arg, 1);
+}
+
+paxos_learner * learner_new_instances(struct event_base * eb, int group, deliver_callback f, void * arg) {
+    return lea_new(eb, group, f, arg, 0);
+}
+
+paxos_merged_learner * learner_merged_new(struct event_base * eb, deliver_callback f, void * arg) {
+    int i;
+    
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return NULL;
+    }
+    
+    paxos_merged_learner * m = PAX_MALLOC(sizeof(paxos_merged_learner));
+    m->groups = paxos_conf.groups;
+    m->turn = 0;
+    m->learners = PAX_MALLOC(sizeof(paxos_learner*) * m->groups);
+    memset(m->learners, 0, sizeof(paxos_learner*) * m->groups);
+    m->to_leaders = PAX_MALLOC(sizeof(udp_send_buffer*) * m->groups);
+    memset(m->to_leaders, 0, sizeof(udp_send_buffer*) * m->groups);
+    evtimer_set(&m->noop_check_event, lea_merge_noop_check, m);
+    event_base_set(eb, &m->noop_check_event);
+    
+    for(i = 0; i < m->groups; i++) {
+        m->learners[i] = lea_new(eb, i, f, arg, 1);
+        if(m->learners[i] == NULL) {
+            printf("Learner of group %d init failed\n", i);
+            learner_merged_free(m);
+            return NULL;
+        }
+        m->learners[i]->merge = m;
+        
+        m->to_leaders[i] = udp_sendbuf_new(CONF_NET_GROUP(submit_net, i));
+        if(m->to_leaders[i] == NULL) {
+            printf("Error creating merged learner->leader network sender\n");
+            learner_merged_free(m);
+            return NULL;
+        }
+    }
+    
+    if(m->groups > 1 && paxos_conf.learner_merged_noop_interval > 0) {
+        evutil_timerclear(&m->noop_check_interval);
+        m->noop_check_interval.tv_sec = paxos_conf.learner_merged_noop_interval / 1000000;
+        m->noop_check_interval.tv_usec = paxos_conf.learner_merged_noop_interval % 1000000;
+        if(event_add(&m->noop_check_event, &m->noop_check_interval) != 0) {
+            printf("Error while adding first noop_check event\n");
+            learner_merged_free(m);
+            return NULL;
+        }
+    }
+    
+    LOG(VRB, ("Merged learner is ready, %d groups\n", m->groups));
+    return m;
+}
+
+void learner_merged_free(paxos_merged_learner * m) {
+    int i;
+    
+    event_del(&m->noop_check_event);
+    for(i = 0; i < m->groups; i++) {
+        if(m->learners[i] != NULL) {
+            learner_free(m->learners[i]);
+        }
+        if(m->to_leaders[i] != NULL) {
+            udp_sendbuf_destroy(m->to_leaders[i]);
+        }
+    }
+    PAX_FREE(m->to_leaders);
+    PAX_FREE(m->learners);
+    PAX_FREE(m);
+}
+
+void learner_free(paxos_learner * l) {
+    size_t i;
+    
+    event_del(&l->msg_event);
+    event_del(&l->hole_check_event);
+    if(l->for_learner != NULL) {
+        udp_receiver_destroy(l->for_learner);
+    }
+    if(l->to_acceptors != NULL) {
+        udp_sendbuf_destroy(l->to_acceptors);
+    }
+    if(l->state != NULL) {
+        for(i = 0; i < (size_t)paxos_conf.learner_array_size; i++) {
+            lea_clear_instance_info(&l->state[i]);
+        }
+        PAX_FREE(l->state);
+    }
+    PAX_FREE(l);
+}
+
 int learner_init(deliver_function f, custom_init_function cif) {
-    // Start learner (which starts event_dispatch())
-    custom_init = cif;
-    if (pthread_create(&learner_thread, NULL, init_learner_thread, (void*) f) != 0) {
-        perror("pthread create learner thread");
+    //Used by the learner thread forever
+    lea_legacy_args * la = PAX_MALLOC(sizeof(lea_legacy_args));
+    la->delfun = f;
+    la->cif = cif;
+    
+    // Start learner (which starts the libevent loop)
+    if(paxos_thread_start(init_lea_legacy, la) != 0) {
+        printf("Learner initialization failed!\n");
         return -1;
     }
     
-    //Wait until initialization completed
-    LOG(DBG, ("Learner thread started, waiting for ready signal\n"));    
-    if (init_lea_wait_ready() == LEARNER_ERROR) {
-        printf("Learner initialization failed!\n");
+    LOG(VRB, ("Learner is ready\n"));
+    return 0;
+}
+
+size_t learner_dedup_state_size() {
+    return sizeof(l_client_record) * LEARNER_DEDUP_TABLE_SIZE;
+}
+
+void learner_dedup_save(paxos_learner * l, char * buf) {
+    memcpy(buf, l->dedup_table, sizeof(l->dedup_table));
+}
+
+int learner_dedup_restore(paxos_learner * l, char * buf, size_t size) {
+    if(size != sizeof(l->dedup_table)) {
+        printf("Invalid duplicates table size: %lu, expected %lu\n", 
+            size, sizeof(l->dedup_table));
         return -1;
     }
+    memcpy(l->dedup_table, buf, size);
+    return 0;
+}
+
+void learner_dedup_state_save(char * buf) {
+    learner_dedup_save(default_learner, buf);
+}
+
+int learner_dedup_state_restore(char * buf, size_t size) {
+    if(default_learner != NULL) {
+        return learner_dedup_restore(default_learner, buf, size);
+    }
     
-    LOG(VRB, ("Learner is ready\n"));    
+    //Applied by learner_init
+    if(size != learner_dedup_state_size()) {
+        printf("Invalid duplicates table size: %lu, expected %lu\n", 
+            size, learner_dedup_state_size());
+        return -1;
+    }
+    if(restored_dedup_table == NULL) {
+        restored_dedup_table = PAX_MALLOC(size);
+    }
+    memcpy(restored_dedup_table, buf, size);
     return 0;
 }
 
 //TODO: comment or categorize...
-void learner_suspend() {
+void learner_suspend(paxos_learner * l) {
     //Remove active events
-    event_del(&learner_msg_event);
+    event_del(&l->msg_event);
     //Close socket
-    udp_receiver_destroy(for_learner);
-    for_learner = NULL;
+    udp_receiver_destroy(l->for_learner);
+    l->for_learner = NULL;
         
     LOG(VRB, ("Learner events suspended!\n"));
 }
@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+
+/*
+    The configuration of this process, defaults from paxos_config.h
+*/
+paxos_config paxos_conf = {
+    .acceptors = N_OF_ACCEPTORS,
+    .phase1_quorum = PHASE1_QUORUM,
+    .phase2_quorum = PHASE2_QUORUM,
+    .fast_quorum = FAST_QUORUM,
+
+    .proposer_array_size = PROPOSER_ARRAY_SIZE,
+    .learner_array_size = LEARNER_ARRAY_SIZE,
+
+    .preexec_win_size = PROPOSER_PREEXEC_WIN_SIZE,
+    .p2_window_initial = PROPOSER_P2_WINDOW_INITIAL,
+    .p2_window_min = PROPOSER_P2_WINDOW_MIN,
+    .p2_window_max = PROPOSER_P2_WINDOW_MAX,
+    .p2_latency_factor = PROPOSER_P2_LATENCY_FACTOR,
+
+    .p1_timeout_initial = P1_TIMEOUT_INITIAL,
+    .p1_timeout_min = P1_TIMEOUT_MIN,
+    .p1_timeout_max = P1_TIMEOUT_MAX,
+    .p2_timeout_initial = P2_TIMEOUT_INITIAL,
+    .p2_timeout_min = P2_TIMEOUT_MIN,
+    .p2_timeout_max = P2_TIMEOUT_MAX,
+    .p2_check_interval = P2_CHECK_INTERVAL,
+    .multi_leader_revoke_timeout = MULTI_LEADER_REVOKE_TIMEOUT,
+    .leader_lease = PAXOS_LEADER_LEASE,
+    .leader_lease_margin = LEADER_LEASE_MARGIN,
+    .leader_client_reorder_timeout = LEADER_CLIENT_REORDER_TIMEOUT,
+    .leader_batch_delay = LEADER_BATCH_DELAY,
+    .client_coalesce_delay = CLIENT_SUBMIT_COALESCE_DELAY,
+    .learner_holecheck_interval = LEARNER_HOLECHECK_INTERVAL,
+    .ping_interval = FAILURE_DETECTOR_PING_INTERVAL,
+    .oracle_min_stddev = ORACLE_MIN_STDDEV,
+    .acceptor_repeat_interval = ACCEPTOR_REPEAT_INTERVAL,
+
+    .leader_batch_max_size = LEADER_BATCH_MAX_SIZE,
+    .thrifty_rotate = PROPOSER_THRIFTY_ROTATE,
+    .oracle_phi_threshold = ORACLE_PHI_THRESHOLD,
+
+    .durability_mode = DURABILITY_MODE,
+    .acceptor_db_path = ACCEPTOR_DB_PATH,
+    .acceptor_db_fname = ACCEPTOR_DB_FNAME,
+
+    .learners_net = {PAXOS_LEARNERS_NET},
+    .acceptors_net = {PAXOS_ACCEPTORS_NET},
+    .proposers_net = {PAXOS_PROPOSERS_NET},
+    .submit_net = {PAXOS_SUBMIT_NET},
+    .oracle_net = {PAXOS_ORACLE_NET},
+    .pings_net = {PAXOS_PINGS_NET},
+
+    .groups = PAXOS_GROUPS,
+    .group_port_stride = PAXOS_GROUP_PORT_STRIDE,
+    .learner_merged_noop_interval = LEARNER_MERGED_NOOP_INTERVAL,
+
+    .membership_alpha = PAXOS_MEMBERSHIP_ALPHA
+};
+
+//Set once pax_config_load is invoked, so that PAXOS_CONFIG is ignored
+static int conf_loaded = 0;
+//Checked by the first role started, then read-only
+static int conf_ready = 0;
+static pthread_mutex_t conf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*-------------------------------------------------------------------------*/
+// Config file parsing
+/*-------------------------------------------------------------------------*/
+
+typedef enum conf_field_type_e {
+    conf_int,
+    conf_long,
+    conf_string,
+    conf_net
+} conf_field_type;
+
+typedef struct conf_field_t {
+    const char *        name;
+    conf_field_type     type;
+    size_t              offset;
+} conf_field;
+
+#define CONF_FIELD(T, F) {#F, T, offsetof(paxos_config, F)}
+
+static conf_field conf_fields[] = {
+    CONF_FIELD(conf_int, acceptors),
+    CONF_FIELD(conf_int, phase1_quorum),
+    CONF_FIELD(conf_int, phase2_quorum),
+    CONF_FIELD(conf_int, fast_quorum),
+    CONF_FIELD(conf_int, proposer_array_size),
+    CONF_FIELD(conf_int, learner_array_size),
+    CONF_FIELD(conf_int, preexec_win_size),
+    CONF_FIELD(conf_int, p2_window_initial),
+    CONF_FIELD(conf_int, p2_window_min),
+    CONF_FIELD(conf_int, p2_window_max),
+    CONF_FIELD(conf_int, p2_latency_factor),
+    CONF_FIELD(conf_long, p1_timeout_initial),
+    CONF_FIELD(conf_long, p1_timeout_min),
+    CONF_FIELD(conf_long, p1_timeout_max),
+    CONF_FIELD(conf_long, p2_timeout_initial),
+    CONF_FIELD(conf_long, p2_timeout_min),
+    CONF_FIELD(conf_long, p2_timeout_max),
+    CONF_FIELD(conf_long, p2_check_interval),
+    CONF_FIELD(conf_long, multi_leader_revoke_timeout),
+    CONF_FIELD(conf_long, leader_lease),
+    CONF_FIELD(conf_long, leader_lease_margin),
+    CONF_FIELD(conf_long, leader_client_reorder_timeout),
+    CONF_FIELD(conf_long, leader_batch_delay),
+    CONF_FIELD(conf_long, client_coalesce_delay),
+    CONF_FIELD(conf_long, learner_holecheck_interval),
+    CONF_FIELD(conf_long, ping_interval),
+    CONF_FIELD(conf_long, oracle_min_stddev),
+    CONF_FIELD(conf_long, acceptor_repeat_interval),
+    CONF_FIELD(conf_int, leader_batch_max_size),
+    CONF_FIELD(conf_int, thrifty_rotate),
+    CONF_FIELD(conf_int, oracle_phi_threshold),
+    CONF_FIELD(conf_int, durability_mode),
+    CONF_FIELD(conf_string, acceptor_db_path),
+    CONF_FIELD(conf_string, acceptor_db_fname),
+    CONF_FIELD(conf_net, learners_net),
+    CONF_FIELD(conf_net, acceptors_net),
+    CONF_FIELD(conf_net, proposers_net),
+    CONF_FIELD(conf_net, submit_net),
+    CONF_FIELD(conf_net, oracle_net),
+    CONF_FIELD(conf_net, pings_net),
+    CONF_FIELD(conf_int, groups),
+    CONF_FIELD(conf_int, group_port_stride),
+    CONF_FIELD(conf_long, learner_merged_noop_interval),
+    CONF_FIELD(conf_int, membership_alpha)
+};
+#define N_OF_CONF_FIELDS (sizeof(conf_fields) / sizeof(conf_field))
+
+static conf_field *
+conf_lookup(const char * name) {
+    size_t i;
+    for(i = 0; i < N_OF_CONF_FIELDS; i++) {
+        if(strcmp(conf_fields[i].name, name) == 0) {
+            return &conf_fields[i];
+        }
+    }
+    return NULL;
+}
+
+//Parses value into the field, returns -1 if it's not valid
+static int
+conf_set_field(conf_field * f, char * value) {
+    char * field = ((char*)&paxos_conf) + f->offset;
+    char * end;
+    long n;
+
+    switch(f->type) {
+        case conf_int:
+        case conf_long: {
+            n = strtol(value, &end, 10);
+            if(end == value || *end != '\0') {
+                return -1;
+            }
+            if(f->type == conf_int) {
+                *((int*)field) = (int)n;
+            } else {
+                *((long*)field) = n;
+            }
+        }
+        break;
+
+        case conf_string: {
+            //Both string fields have the same size
+            if(strlen(value) >= sizeof(paxos_conf.acceptor_db_path)) {
+                return -1;
+            }
+            strcpy(field, value);
+        }
+        break;
+
+        case conf_net: {
+            paxos_net * net = (paxos_net*)field;
+            char * sep = strchr(value, ':');
+            if(sep == NULL || (size_t)(sep - value) >= sizeof(net->addr)) {
+                return -1;
+            }
+            n = strtol(sep + 1, &end, 10);
+            if(end == (sep + 1) || *end != '\0' || n <= 0 || n > 65535) {
+                return -1;
+            }
+            memcpy(net->addr, value, (sep - value));
+            net->addr[sep - value] = '\0';
+            net->port = (int)n;
+        }
+        break;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+// Validation
+/*-------------------------------------------------------------------------*/
+
+static int
+conf_is_power_of_2(int n) {
+    return (n > 0 && (n & (n - 1)) == 0);
+}
+
+//Computes the quorums left to 0 for n acceptors, then checks 
+// that they intersect. Returns -1 if they don't
+int
+paxos_quorums_check(int n, int * p1, int * p2, int * fast) {
+    if(*p1 == 0) {
+        *p1 = (n/2)+1;
+    }
+    if(*p2 == 0) {
+        *p2 = (n/2)+1;
+    }
+    if(*fast == 0) {
+        *fast = (n*3 + 3)/4;
+    }
+
+    if(*p1 < 1 || *p2 < 1 || *fast < 1) {
+        printf("Error: quorums must be positive\n");
+        return -1;
+    }
+    if(*p1 > n || *p2 > n || *fast > n) {
+        printf("Error: quorums cannot exceed the number of acceptors (%d)\n", n);
+        return -1;
+    }
+    if((*p1 + *p2) <= n) {
+        printf("Error: phase1_quorum %d and phase2_quorum %d do not intersect\n",
+            *p1, *p2);
+        return -1;
+    }
+#ifdef PAXOS_FAST_MODE
+    if((*p1 + 2*(*fast)) <= (2*n)) {
+        printf("Error: two fast_quorum %d and a phase1_quorum %d do not intersect\n",
+            *fast, *p1);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+//Computes the quorums left to 0, then checks everything
+// the roles rely on. Returns -1 if something is wrong
+static int
+conf_check(paxos_config * c) {
+    int n = c->acceptors;
+
+    if(n < 1 || n > N_OF_ACCEPTORS) {
+        printf("Error: acceptors = %d, must be between 1 and %d\n",
+            n, N_OF_ACCEPTORS);
+        printf("(N_OF_ACCEPTORS in paxos_config.h is the maximum)\n");
+        return -1;
+    }
+
+    //Computed for the runtime number of acceptors
+    if(paxos_quorums_check(n, &c->phase1_quorum, &c->phase2_quorum, 
+        &c->fast_quorum) != 0) {
+        return -1;
+    }
+
+    if(!conf_is_power_of_2(c->learner_array_size)) {
+        printf("Error: learner_array_size is not a power of 2\n");
+        return -1;
+    }
+    if(!conf_is_power_of_2(c->proposer_array_size)) {
+        printf("Error: proposer_array_size is not a power of 2\n");
+        return -1;
+    }
+
+    if(c->p2_window_min < 1 ||
+        c->p2_window_initial < c->p2_window_min ||
+        c->p2_window_initial > c->p2_window_max) {
+        printf("Error: invalid p2 window (initial:%d min:%d max:%d)\n",
+            c->p2_window_initial, c->p2_window_min, c->p2_window_max);
+        return -1;
+    }
+    if(c->preexec_win_size < 2) {
+        printf("Error: preexec_win_size must be at least 2\n");
+        return -1;
+    }
+
+    if(c->p2_check_interval <= 0 || c->learner_holecheck_interval <= 0 ||
+        c->ping_interval <= 0 || c->acceptor_repeat_interval <= 0) {
+        printf("Error: check and ping intervals must be positive\n");
+        return -1;
+    }
+    if(c->oracle_phi_threshold <= 0 || c->oracle_min_stddev <= 0) {
+        printf("Error: oracle threshold and min stddev must be positive\n");
+        return -1;
+    }
+    if(c->leader_lease < 0 || c->leader_lease_margin < 0 ||
+        (c->leader_lease > 0 && c->leader_lease_margin >= c->leader_lease)) {
+        printf("Error: invalid leader lease (lease:%ld margin:%ld)\n",
+            c->leader_lease, c->leader_lease_margin);
+        return -1;
+    }
+#if defined(PAXOS_FAST_MODE) || defined(PAXOS_MULTI_LEADER)
+    if(c->leader_lease > 0) {
+        printf("Error: leader lease cannot be used with fast mode or multiple leaders\n");
+        return -1;
+    }
+#endif
+    if(c->p1_timeout_min > c->p1_timeout_max ||
+        c->p2_timeout_min > c->p2_timeout_max) {
+        printf("Error: timeouts min is bigger than max\n");
+        return -1;
+    }
+
+    if(c->leader_batch_max_size <= 0 ||
+        c->leader_batch_max_size > PAXOS_MAX_VALUE_SIZE) {
+        printf("Error: leader_batch_max_size must be less than %d\n",
+            PAXOS_MAX_VALUE_SIZE);
+        return -1;
+    }
+    if(c->thrifty_rotate < 1) {
+        printf("Error: thrifty_rotate must be positive\n");
+        return -1;
+    }
+
+    if(c->groups < 1 || c->group_port_stride < 0) {
+        printf("Error: invalid groups %d (port stride %d)\n",
+            c->groups, c->group_port_stride);
+        return -1;
+    }
+    if(c->learner_merged_noop_interval < 0) {
+        printf("Error: invalid learner_merged_noop_interval %ld\n", 
+            c->learner_merged_noop_interval);
+        return -1;
+    }
+    //The highest port is used by the last group
+    paxos_net * nets[] = {&c->learners_net, &c->acceptors_net, &c->proposers_net,
+        &c->submit_net, &c->oracle_net, &c->pings_net};
+    size_t i;
+    for(i = 0; i < (sizeof(nets) / sizeof(paxos_net*)); i++) {
+        if(nets[i]->port + ((c->groups - 1) * c->group_port_stride) > 65535) {
+            printf("Error: port %d is out of range for %d groups\n",
+                nets[i]->port, c->groups);
+            return -1;
+        }
+    }
+
+    //Every instance a proposer or learner can handle must have
+    // its membership decided already
+    if(c->membership_alpha == 0) {
+        c->membership_alpha = (c->proposer_array_size > c->learner_array_size ?
+            c->proposer_array_size : c->learner_array_size);
+    }
+    if(c->membership_alpha < c->proposer_array_size || 
+        c->membership_alpha < c->learner_array_size) {
+        printf("Error: membership_alpha %d is smaller than the instances arrays\n",
+            c->membership_alpha);
+        return -1;
+    }
+    return 0;
+}
+
+int
+paxos_config_ready() {
+    int status = 0;
+    char * path;
+
+    pthread_mutex_lock(&conf_lock);
+    if(!conf_ready) {
+        path = getenv("PAXOS_CONFIG");
+        if(!conf_loaded && path != NULL) {
+            status = pax_config_load(path);
+        }
+        if(status == 0) {
+            status = conf_check(&paxos_conf);
+        }
+        if(status == 0) {
+            conf_ready = 1;
+            LOG(VRB, ("Configuration: %d acceptors, quorums p1:%d p2:%d\n",
+                paxos_conf.acceptors, paxos_conf.phase1_quorum,
+                paxos_conf.phase2_quorum));
+        }
+    }
+    pthread_mutex_unlock(&conf_lock);
+    return status;
+}
+
+/*-------------------------------------------------------------------------*/
+// Public functions (see libpaxos.h for more details)
+/*-------------------------------------------------------------------------*/
+
+paxos_config *
+pax_config() {
+    return &paxos_conf;
+}
+
+int
+pax_config_load(const char * path) {
+    FILE * f;
+    char line[512];
+    char name[128];
+    char value[384];
+    int line_num = 0;
+    int status = 0;
+    conf_field * field;
+
+    if(conf_ready) {
+        printf("Error: configuration loaded after init\n");
+        return -1;
+    }
+
+    f = fopen(path, "r");
+    if(f == NULL) {
+        perror("config file");
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        line_num++;
+
+        //Strip comments
+        char * comment = strchr(line, '#');
+        if(comment != NULL) {
+            *comment = '\0';
+        }
+
+        int n = sscanf(line, "%127s %383s", name, value);
+        if(n <= 0) {
+            //Blank line
+            continue;
+        }
+
+        field = conf_lookup(name);
+        if(field == NULL) {
+            printf("%s:%d: unknown option %s\n", path, line_num, name);
+            status = -1;
+            break;
+        }
+        if(n != 2 || conf_set_field(field, value) != 0) {
+            printf("%s:%d: invalid value for %s\n", path, line_num, name);
+            status = -1;
+            break;
+        }
+    }
+
+    fclose(f);
+    conf_loaded = 1;
+    return status;
+}
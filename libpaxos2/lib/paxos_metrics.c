@@ -0,0 +1,372 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "event.h"
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+#include "paxos_metrics.h"
+
+/*
+    All the metrics of this process are kept in a fixed table.
+    Registration is rare (at init) and takes a lock, updates
+    and reads do not. The same name can be registered with different
+    labels (one per context), the dump lists them together.
+*/
+static paxos_metric metrics_table[PAXOS_METRICS_MAX];
+static volatile int metrics_count = 0;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//Returned when the table is full, it's not dumped
+static paxos_metric metrics_placeholder;
+
+static paxos_metric *
+metrics_lookup(const char * name, const char * label) {
+    int i;
+    for(i = 0; i < metrics_count; i++) {
+        if(strcmp(metrics_table[i].name, name) == 0 &&
+            strcmp(metrics_table[i].label, label) == 0) {
+            return &metrics_table[i];
+        }
+    }
+    return NULL;
+}
+
+paxos_metric *
+metrics_register(const char * name, paxos_metric_type type) {
+    return metrics_register_label(name, "", type);
+}
+
+paxos_metric *
+metrics_register_label(const char * name, const char * label, 
+    paxos_metric_type type) {
+    paxos_metric * m;
+
+    if(strlen(label) >= PAXOS_METRIC_LABEL_SIZE) {
+        printf("Warning: metric label %s too long\n", label);
+        return &metrics_placeholder;
+    }
+
+    pthread_mutex_lock(&metrics_lock);
+    m = metrics_lookup(name, label);
+    if(m == NULL) {
+        if(metrics_count == PAXOS_METRICS_MAX) {
+            printf("Warning: metrics table full, %s not exported\n", name);
+            m = &metrics_placeholder;
+        } else {
+            m = &metrics_table[metrics_count];
+            memset(m, 0, sizeof(paxos_metric));
+            m->name = name;
+            strcpy(m->label, label);
+            m->type = type;
+            //Visible to readers only once initialized
+            __sync_synchronize();
+            metrics_count += 1;
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return m;
+}
+
+void
+metrics_observe(paxos_metric * m, long unsigned int usecs) {
+    int i = 0;
+    //Bucket i counts samples up to 2^i usec, the last one all the others
+    while(i < (PAXOS_METRICS_BUCKETS - 1) && (1UL << i) < usecs) {
+        i++;
+    }
+    __sync_fetch_and_add(&m->buckets[i], 1);
+    __sync_fetch_and_add(&m->count, 1);
+    __sync_fetch_and_add(&m->value, (long)usecs);
+}
+
+/*-------------------------------------------------------------------------*/
+// Text dump
+/*-------------------------------------------------------------------------*/
+
+//Appends to buf like snprintf, but keeps counting when buf is full
+static void
+metrics_append(char * buf, size_t size, size_t * len, const char * fmt, ...) {
+    va_list ap;
+    int n;
+    char * dst = (*len < size ? buf + *len : NULL);
+    size_t avail = (*len < size ? size - *len : 0);
+
+    va_start(ap, fmt);
+    n = vsnprintf(dst, avail, fmt, ap);
+    va_end(ap);
+    if(n > 0) {
+        *len += n;
+    }
+}
+
+//Type line, once for all the metrics with the same name
+static void
+metrics_dump_type(paxos_metric * m, char * buf, size_t size, size_t * len) {
+    const char * type_names[] = {"counter", "gauge", "histogram"};
+    metrics_append(buf, size, len, "# TYPE paxos_%s %s\n", 
+        m->name, type_names[m->type]);
+}
+
+static void
+metrics_dump_one(paxos_metric * m, char * buf, size_t size, size_t * len) {
+    int i;
+    long cumulative = 0;
+    //Label as {label}, and prepended to le (histogram buckets)
+    char braces[PAXOS_METRIC_LABEL_SIZE + 2] = "";
+    const char * sep = (m->label[0] != '\0' ? "," : "");
+
+    if(m->label[0] != '\0') {
+        snprintf(braces, sizeof(braces), "{%s}", m->label);
+    }
+
+    switch(m->type) {
+        case metric_counter:
+        case metric_gauge: {
+            metrics_append(buf, size, len, "paxos_%s%s %ld\n",
+                m->name, braces, m->value);
+        }
+        break;
+
+        case metric_histogram: {
+            for(i = 0; i < PAXOS_METRICS_BUCKETS - 1; i++) {
+                cumulative += m->buckets[i];
+                metrics_append(buf, size, len, "paxos_%s_bucket{%s%sle=\"%lu\"} %ld\n",
+                    m->name, m->label, sep, (1UL << i), cumulative);
+            }
+            cumulative += m->buckets[i];
+            metrics_append(buf, size, len, "paxos_%s_bucket{%s%sle=\"+Inf\"} %ld\n",
+                m->name, m->label, sep, cumulative);
+            metrics_append(buf, size, len, "paxos_%s_sum%s %ld\npaxos_%s_count%s %ld\n",
+                m->name, braces, m->value, m->name, braces, m->count);
+        }
+        break;
+    }
+}
+
+/*-------------------------------------------------------------------------*/
+// Unix socket
+/*-------------------------------------------------------------------------*/
+#ifdef PAXOS_METRICS_SOCKET
+static int metrics_sock = -1;
+static struct event metrics_event;
+static struct event_base * metrics_eb;
+
+//A connected client, the dump is written as the socket is writable
+typedef struct metrics_client_t {
+    int             fd;
+    char *          buf;
+    size_t          len;
+    size_t          sent;
+    struct event    write_event;
+} metrics_client;
+
+static void
+metrics_client_close(metrics_client * c) {
+    event_del(&c->write_event);
+    close(c->fd);
+    PAX_FREE(c->buf);
+    PAX_FREE(c);
+}
+
+//Waits until the socket is writable, at most PAXOS_METRICS_CLIENT_TIMEOUT
+static void
+metrics_client_wait(metrics_client * c) {
+    struct timeval tv;
+    tv.tv_sec = PAXOS_METRICS_CLIENT_TIMEOUT / 1000000;
+    tv.tv_usec = PAXOS_METRICS_CLIENT_TIMEOUT % 1000000;
+    if(event_add(&c->write_event, &tv) != 0) {
+        metrics_client_close(c);
+    }
+}
+
+//Writes what the socket takes, closes when done (or on error/timeout)
+static void
+metrics_handle_write(int fd, short event, void *arg) {
+    metrics_client * c = arg;
+    ssize_t n;
+
+    if(event & EV_TIMEOUT) {
+        LOG(VRB, ("Metrics client too slow, dropped\n"));
+        metrics_client_close(c);
+        return;
+    }
+
+    n = write(fd, c->buf + c->sent, c->len - c->sent);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        metrics_client_wait(c);
+        return;
+    }
+    if(n <= 0) {
+        metrics_client_close(c);
+        return;
+    }
+    c->sent += n;
+    if(c->sent == c->len) {
+        metrics_client_close(c);
+        return;
+    }
+    metrics_client_wait(c);
+}
+
+//Someone connected, prepare the dump and write it when possible
+static void
+metrics_handle_connect(int sock, short event, void *arg) {
+    UNUSED_ARG(event);
+    UNUSED_ARG(arg);
+
+    int fd = accept(sock, NULL, NULL);
+    if(fd < 0) {
+        return;
+    }
+    if(fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+        close(fd);
+        return;
+    }
+
+    metrics_client * c = PAX_MALLOC(sizeof(metrics_client));
+    size_t size = pax_metrics_dump(NULL, 0) + 1;
+    c->fd = fd;
+    c->buf = PAX_MALLOC(size);
+    c->len = pax_metrics_dump(c->buf, size);
+    c->sent = 0;
+    if(c->len >= size) {
+        //Registered in between, the dump is truncated
+        c->len = size - 1;
+    }
+
+    event_set(&c->write_event, fd, EV_WRITE, metrics_handle_write, c);
+    event_base_set(metrics_eb, &c->write_event);
+    metrics_client_wait(c);
+}
+#endif
+
+int
+metrics_listen(struct event_base * eb) {
+#ifdef PAXOS_METRICS_SOCKET
+    static pthread_mutex_t listen_lock = PTHREAD_MUTEX_INITIALIZER;
+    struct sockaddr_un addr;
+
+    //Already listening (multiple roles in this process)
+    pthread_mutex_lock(&listen_lock);
+    if(metrics_sock != -1) {
+        pthread_mutex_unlock(&listen_lock);
+        return 0;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path),
+        PAXOS_METRICS_SOCKET, (int)getpid());
+
+    metrics_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(metrics_sock < 0) {
+        perror("metrics socket");
+        metrics_sock = -1;
+        pthread_mutex_unlock(&listen_lock);
+        return -1;
+    }
+
+    //Left there by a previous process with the same pid
+    unlink(addr.sun_path);
+    if(bind(metrics_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("metrics bind");
+        close(metrics_sock);
+        metrics_sock = -1;
+        pthread_mutex_unlock(&listen_lock);
+        return -1;
+    }
+    if(listen(metrics_sock, 8) != 0) {
+        perror("metrics listen");
+        close(metrics_sock);
+        metrics_sock = -1;
+        pthread_mutex_unlock(&listen_lock);
+        return -1;
+    }
+    fcntl(metrics_sock, F_SETFL, O_NONBLOCK);
+
+    metrics_eb = eb;
+    event_set(&metrics_event, metrics_sock, EV_READ|EV_PERSIST,
+        metrics_handle_connect, NULL);
+    event_base_set(eb, &metrics_event);
+    event_add(&metrics_event, NULL);
+    pthread_mutex_unlock(&listen_lock);
+    LOG(VRB, ("Metrics available on %s\n", addr.sun_path));
+#else
+    UNUSED_ARG(eb);
+#endif
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+// Public functions (see libpaxos.h for more details)
+/*-------------------------------------------------------------------------*/
+
+long long
+pax_metric_value(const char * name) {
+    int i, found = 0, count = metrics_count;
+    long long value = 0;
+    paxos_metric * m;
+
+    for(i = 0; i < count; i++) {
+        m = &metrics_table[i];
+        if(strcmp(m->name, name) != 0) {
+            continue;
+        }
+        //Gauges of different contexts cannot be added
+        if(m->type == metric_gauge) {
+            return m->value;
+        }
+        value += (m->type == metric_histogram ? m->count : m->value);
+        found = 1;
+    }
+    return (found ? value : -1);
+}
+
+long long
+pax_metric_value_label(const char * name, const char * label) {
+    paxos_metric * m;
+
+    pthread_mutex_lock(&metrics_lock);
+    m = metrics_lookup(name, label);
+    pthread_mutex_unlock(&metrics_lock);
+
+    if(m == NULL) {
+        return -1;
+    }
+    return (m->type == metric_histogram ? m->count : m->value);
+}
+
+size_t
+pax_metrics_dump(char * buf, size_t size) {
+    size_t len = 0;
+    int i, j, count = metrics_count;
+
+    //Metrics with the same name are listed together, after the
+    // first one registered
+    for(i = 0; i < count; i++) {
+        for(j = 0; j < i; j++) {
+            if(strcmp(metrics_table[j].name, metrics_table[i].name) == 0) {
+                break;
+            }
+        }
+        if(j < i) {
+            continue;
+        }
+        metrics_dump_type(&metrics_table[i], buf, size, &len);
+        for(j = i; j < count; j++) {
+            if(strcmp(metrics_table[j].name, metrics_table[i].name) == 0) {
+                metrics_dump_one(&metrics_table[j], buf, size, &len);
+            }
+        }
+    }
+    return len;
+}
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <memory.h>
+#include <math.h>
+
+#include "event.h"
+#include "evutil.h"
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+#include "paxos_udp.h"
+#include "paxos_metrics.h"
+
+/*
+    Phi-accrual failure detector: instead of a fixed timeout, the
+    oracle keeps the intervals between the last pings of each proposer
+    and computes how unlikely it is that the next ping is still coming,
+    assuming the intervals are normally distributed.
+    The leader is the live proposer with the lowest id.
+*/
+
+//Failure detector state of a proposer
+typedef struct oracle_record_t {
+    //Set after the first ping, cleared when suspected
+    int                 alive;
+    struct timeval      last_ping;
+    //Intervals between pings (circular buffer), in microseconds
+    long                intervals[ORACLE_PHI_WINDOW_SIZE];
+    unsigned int        intervals_count;
+} oracle_record;
+#define GET_INTERVAL(R, I) (&(R)->intervals[((I) % ORACLE_PHI_WINDOW_SIZE)])
+
+//Exported metrics of an oracle (see paxos_metrics.h)
+struct oracle_metrics {
+    paxos_metric * pings;
+    paxos_metric * suspicions;
+    paxos_metric * elections;
+    paxos_metric * leader;
+};
+
+//An oracle, all its events are registered with eb
+struct paxos_oracle_t {
+    //Libevent handle
+    struct event_base * eb;
+
+    //Consensus group of the proposers (see PAXOS_GROUPS)
+    int                 group;
+
+    //Current leader, -1 if none was elected yet
+    short int           current_leader;
+
+    //When the oracle started, elections wait for the first pings
+    struct timeval      started;
+
+    oracle_record       proposers[MAX_N_OF_PROPOSERS];
+
+    //UDP socket managers
+    udp_send_buffer *   to_proposers;
+    udp_receiver *      for_oracle;
+
+    //Event: ping received
+    struct event        msg_event;
+    //Event: time to check for suspects
+    struct event        check_event;
+    struct timeval      check_interval;
+
+    struct oracle_metrics metrics;
+};
+
+//The oracle started by oracle_init
+static paxos_oracle * default_oracle = NULL;
+
+
+/*-------------------------------------------------------------------------*/
+// Helpers
+/*-------------------------------------------------------------------------*/
+
+static long
+ora_usecs_since(struct timeval * from, struct timeval * now) {
+    return (now->tv_sec - from->tv_sec) * 1000000 +
+        (now->tv_usec - from->tv_usec);
+}
+
+//Suspicion level of a proposer that was alive
+static double
+ora_phi(oracle_record * r, struct timeval * now) {
+    unsigned int i, count = r->intervals_count;
+    double mean, var = 0, stddev, y, p_later;
+    double elapsed = (double)ora_usecs_since(&r->last_ping, now);
+
+    if(count > ORACLE_PHI_WINDOW_SIZE) {
+        count = ORACLE_PHI_WINDOW_SIZE;
+    }
+
+    //No interval yet, expect pings as configured
+    if(count == 0) {
+        mean = (double)paxos_conf.ping_interval;
+    } else {
+        mean = 0;
+        for(i = 0; i < count; i++) {
+            mean += r->intervals[i];
+        }
+        mean /= count;
+        for(i = 0; i < count; i++) {
+            var += (r->intervals[i] - mean) * (r->intervals[i] - mean);
+        }
+        var /= count;
+    }
+
+    stddev = sqrt(var);
+    if(stddev < paxos_conf.oracle_min_stddev) {
+        stddev = (double)paxos_conf.oracle_min_stddev;
+    }
+
+    //Probability that the next ping arrives after elapsed
+    y = (elapsed - mean) / stddev;
+    p_later = 0.5 * erfc(y / M_SQRT2);
+    if(p_later < 1e-300) {
+        p_later = 1e-300;
+    }
+    return -log10(p_later);
+}
+
+//Leader is the lowest live proposer, announced only if it changes
+// or if some proposer just (re)appeared and may not know it
+static void
+ora_elect(paxos_oracle * o, int force_announce) {
+    short int i, new_leader = -1;
+
+    for(i = 0; i < MAX_N_OF_PROPOSERS; i++) {
+        if(o->proposers[i].alive) {
+            new_leader = i;
+            break;
+        }
+    }
+
+    //Everybody is suspected, keep the last one
+    if(new_leader == -1) {
+        return;
+    }
+
+    if(new_leader != o->current_leader) {
+        printf("Oracle: proposer %d is the new leader (was %d)\n",
+            new_leader, o->current_leader);
+        o->current_leader = new_leader;
+        METRIC_INC(o->metrics.elections);
+        METRIC_SET(o->metrics.leader, new_leader);
+    } else if (!force_announce) {
+        return;
+    }
+
+    sendbuf_send_leader_announce(o->to_proposers, o->current_leader);
+}
+
+//Elections start once all proposers had the chance to ping,
+// otherwise the first to ping becomes leader
+static int
+ora_can_elect(paxos_oracle * o, struct timeval * now) {
+    return (ora_usecs_since(&o->started, now) >= 2 * paxos_conf.ping_interval);
+}
+
+/*-------------------------------------------------------------------------*/
+// Event handlers
+/*-------------------------------------------------------------------------*/
+
+static void
+ora_handle_ping(paxos_oracle * o, alive_ping_msg * ap) {
+    struct timeval now;
+    oracle_record * r;
+    int appeared = 0;
+
+    if(ap->proposer_id < 0 || ap->proposer_id >= MAX_N_OF_PROPOSERS) {
+        printf("Oracle: invalid proposer id:%d\n", ap->proposer_id);
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    METRIC_INC(o->metrics.pings);
+    r = &o->proposers[ap->proposer_id];
+
+    if(r->alive) {
+        *GET_INTERVAL(r, r->intervals_count) =
+            ora_usecs_since(&r->last_ping, &now);
+        r->intervals_count += 1;
+    } else {
+        //New (or back), intervals restart from scratch
+        LOG(VRB, ("Oracle: proposer %d is alive\n", ap->proposer_id));
+        r->alive = 1;
+        r->intervals_count = 0;
+        appeared = 1;
+    }
+    r->last_ping = now;
+
+    if(appeared && ora_can_elect(o, &now)) {
+        ora_elect(o, 1);
+    }
+}
+
+//Invoked by libevent when a ping was received
+static void
+ora_handle_newmsg(int sock, short event, void *arg) {
+    UNUSED_ARG(sock);
+    UNUSED_ARG(event);
+    paxos_oracle * o = arg;
+
+    assert(sock == o->for_oracle->sock);
+
+    int valid = udp_read_next_message(o->for_oracle);
+    if (valid < 0) {
+        printf("Dropping invalid oracle message\n");
+        return;
+    }
+
+    paxos_msg * msg = (paxos_msg*) &o->for_oracle->recv_buffer;
+    switch(msg->type) {
+        case alive_ping: {
+            ora_handle_ping(o, (alive_ping_msg *) msg->data);
+        }
+        break;
+
+        default: {
+            printf("Unknow msg type %d received by oracle\n", msg->type);
+        }
+    }
+}
+
+//Invoked periodically, suspects the proposers whose phi is too high
+static void
+ora_check_suspects(int fd, short event, void *arg) {
+    UNUSED_ARG(fd);
+    UNUSED_ARG(event);
+    paxos_oracle * o = arg;
+    struct timeval now;
+    short int i;
+    double phi;
+
+    gettimeofday(&now, NULL);
+    for(i = 0; i < MAX_N_OF_PROPOSERS; i++) {
+        if(!o->proposers[i].alive) {
+            continue;
+        }
+        phi = ora_phi(&o->proposers[i], &now);
+        if(phi > paxos_conf.oracle_phi_threshold) {
+            printf("Oracle: proposer %d is suspected (phi:%.1f)\n", i, phi);
+            o->proposers[i].alive = 0;
+            METRIC_INC(o->metrics.suspicions);
+        }
+    }
+
+    if(ora_can_elect(o, &now)) {
+        //The first election is announced
+        ora_elect(o, 0);
+    }
+
+    if(event_add(&o->check_event, &o->check_interval) != 0) {
+        printf("Error while adding next oracle check event\n");
+    }
+}
+
+/*-------------------------------------------------------------------------*/
+// Initialization
+/*-------------------------------------------------------------------------*/
+
+static int
+init_ora_network(paxos_oracle * o) {
+    o->to_proposers = udp_sendbuf_new(CONF_NET_GROUP(oracle_net, o->group));
+    if(o->to_proposers == NULL) {
+        printf("Error creating oracle->proposers network sender\n");
+        return -1;
+    }
+
+    o->for_oracle = udp_receiver_new(CONF_NET_GROUP(pings_net, o->group));
+    if(o->for_oracle == NULL) {
+        printf("Error creating proposers->oracle network receiver\n");
+        return -1;
+    }
+    event_set(&o->msg_event, o->for_oracle->sock, EV_READ|EV_PERSIST, ora_handle_newmsg, o);
+    event_base_set(o->eb, &o->msg_event);
+    event_add(&o->msg_event, NULL);
+    return 0;
+}
+
+//Suspects are checked twice per ping interval
+static int
+init_ora_timers(paxos_oracle * o) {
+    long interval = paxos_conf.ping_interval / 2;
+
+    evtimer_set(&o->check_event, ora_check_suspects, o);
+    event_base_set(o->eb, &o->check_event);
+    evutil_timerclear(&o->check_interval);
+    o->check_interval.tv_sec = interval / 1000000;
+    o->check_interval.tv_usec = interval % 1000000;
+    if(event_add(&o->check_event, &o->check_interval) != 0) {
+        printf("Error while adding first oracle check event\n");
+        return -1;
+    }
+    return 0;
+}
+
+//Labeled with the group
+static void
+init_ora_metrics(paxos_oracle * o) {
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    struct oracle_metrics * m = &o->metrics;
+    
+    snprintf(label, sizeof(label), "group=\"%d\"", o->group);
+    m->pings = metrics_register_label("oracle_pings", label, metric_counter);
+    m->suspicions = metrics_register_label("oracle_suspicions", label, metric_counter);
+    m->elections = metrics_register_label("oracle_elections", label, metric_counter);
+    m->leader = metrics_register_label("oracle_leader", label, metric_gauge);
+}
+
+//Invoked in the oracle thread by paxos_thread_start
+static int
+init_ora_legacy(struct event_base * eb, void * arg) {
+    UNUSED_ARG(arg);
+    default_oracle = oracle_new(eb, 0);
+    return (default_oracle == NULL ? -1 : 0);
+}
+
+/*-------------------------------------------------------------------------*/
+// Public functions (see libpaxos.h for more details)
+/*-------------------------------------------------------------------------*/
+
+paxos_oracle * oracle_new(struct event_base * eb, int group) {
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return NULL;
+    }
+
+    if(group < 0 || group >= paxos_conf.groups) {
+        printf("Invalid group:%d\n", group);
+        return NULL;
+    }
+
+    paxos_oracle * o = PAX_MALLOC(sizeof(paxos_oracle));
+    memset(o, 0, sizeof(paxos_oracle));
+    o->eb = eb;
+    o->group = group;
+    o->current_leader = -1;
+    gettimeofday(&o->started, NULL);
+
+    init_ora_metrics(o);
+    METRIC_SET(o->metrics.leader, -1);
+
+    if(init_ora_network(o) != 0 || init_ora_timers(o) != 0) {
+        printf("Oracle init failed\n");
+        oracle_free(o);
+        return NULL;
+    }
+
+    if(metrics_listen(eb) != 0) {
+        printf("Metrics socket init failed\n");
+        oracle_free(o);
+        return NULL;
+    }
+
+    LOG(VRB, ("Oracle is ready\n"));
+    return o;
+}
+
+void oracle_free(paxos_oracle * o) {
+    event_del(&o->msg_event);
+    event_del(&o->check_event);
+    if(o->for_oracle != NULL) {
+        udp_receiver_destroy(o->for_oracle);
+    }
+    if(o->to_proposers != NULL) {
+        udp_sendbuf_destroy(o->to_proposers);
+    }
+    PAX_FREE(o);
+}
+
+int oracle_init() {
+    return paxos_thread_start(init_ora_legacy, NULL);
+}
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "event.h"
+#include "evutil.h"
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+#include "paxos_udp.h"
+#include "paxos_metrics.h"
+
+/*
+    Simulated network (see pax_sim_start in libpaxos.h).
+    Each receiver gets one end of a datagram socket pair, so that
+    the roles keep reading it trough their libevent events. Messages
+    sent are queued (by delivery time) and written to the other end
+    of the socket pair of every receiver bound to the destination
+    address and port, unless they are lost.
+    The delivery time is the send time plus the latency and a random
+    jitter. With a bandwidth set, each receiver gets one message at a
+    time: a message waits until the previous one was transmitted.
+*/
+
+#define SIM_MAX_RECEIVERS 128
+
+//A receiver bound to an address and port
+typedef struct sim_endpoint_t {
+    //NULL if the slot is free
+    udp_receiver *      rec;
+    struct sockaddr_in  addr;
+    //Other end of the socket pair of rec
+    int                 write_fd;
+    //When the last message queued for it is transmitted (bandwidth)
+    int64_t             busy_until;
+} sim_endpoint;
+
+//A message on its way to a receiver
+typedef struct sim_packet_t {
+    int64_t             deliver_at;
+    sim_endpoint *      dest;
+    struct sim_packet_t * next;
+    size_t              size;
+    char                data[0];
+} sim_packet;
+
+struct sim_state {
+    struct event_base * eb;
+    paxos_sim_params    params;
+    uint64_t            rng;
+
+    sim_endpoint        endpoints[SIM_MAX_RECEIVERS];
+
+    //Sorted by delivery time, in send order for the same time
+    sim_packet *        in_flight;
+
+    //Event: the first message in flight must be delivered
+    struct event        deliver_event;
+};
+static struct sim_state * sim = NULL;
+
+//Exported metrics (see paxos_metrics.h)
+struct sim_metrics {
+    paxos_metric * sent;
+    paxos_metric * delivered;
+    paxos_metric * dropped;
+    paxos_metric * bytes;
+    paxos_metric * sent_prepare_reqs;
+    paxos_metric * sent_prepare_acks;
+    paxos_metric * sent_accept_reqs;
+    paxos_metric * sent_accept_acks;
+    paxos_metric * sent_repeat_reqs;
+    paxos_metric * sent_submit;
+    paxos_metric * sent_other;
+};
+static struct sim_metrics sim_metrics;
+
+/*-------------------------------------------------------------------------*/
+// Helpers
+/*-------------------------------------------------------------------------*/
+
+static int64_t
+sim_now() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+//xorshift64*, the sequence depends only on the seed
+static uint64_t
+sim_random() {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng * 2685821657736338717ULL;
+}
+
+static void
+sim_count_type(paxos_msg * m) {
+    switch(m->type) {
+        case prepare_reqs: METRIC_INC(sim_metrics.sent_prepare_reqs); break;
+        case prepare_acks: METRIC_INC(sim_metrics.sent_prepare_acks); break;
+        case accept_reqs: METRIC_INC(sim_metrics.sent_accept_reqs); break;
+        case accept_acks: METRIC_INC(sim_metrics.sent_accept_acks); break;
+        case repeat_reqs: METRIC_INC(sim_metrics.sent_repeat_reqs); break;
+        case submit: METRIC_INC(sim_metrics.sent_submit); break;
+        default: METRIC_INC(sim_metrics.sent_other);
+    }
+}
+
+//Sets the timer for the first message in flight
+static void
+sim_schedule() {
+    struct timeval tv;
+    int64_t wait;
+
+    event_del(&sim->deliver_event);
+    if(sim->in_flight == NULL) {
+        return;
+    }
+    wait = sim->in_flight->deliver_at - sim_now();
+    if(wait < 0) {
+        wait = 0;
+    }
+    tv.tv_sec = wait / 1000000;
+    tv.tv_usec = wait % 1000000;
+    if(event_add(&sim->deliver_event, &tv) != 0) {
+        printf("Error while adding simulator deliver event\n");
+    }
+}
+
+static void
+sim_enqueue(sim_packet * pk) {
+    sim_packet ** pos = &sim->in_flight;
+
+    while(*pos != NULL && (*pos)->deliver_at <= pk->deliver_at) {
+        pos = &(*pos)->next;
+    }
+    pk->next = *pos;
+    *pos = pk;
+}
+
+//Invoked by libevent when the first message in flight is due
+static void
+sim_deliver(int fd, short event, void *arg) {
+    UNUSED_ARG(fd);
+    UNUSED_ARG(event);
+    UNUSED_ARG(arg);
+    sim_packet * pk;
+    int64_t now = sim_now();
+
+    while(sim->in_flight != NULL && sim->in_flight->deliver_at <= now) {
+        pk = sim->in_flight;
+        sim->in_flight = pk->next;
+
+        //Full socket buffer, lost like in UDP
+        if(write(pk->dest->write_fd, pk->data, pk->size) != (ssize_t)pk->size) {
+            METRIC_INC(sim_metrics.dropped);
+        } else {
+            METRIC_INC(sim_metrics.delivered);
+        }
+        PAX_FREE(pk);
+    }
+    sim_schedule();
+}
+
+/*-------------------------------------------------------------------------*/
+// UDP layer hooks (see paxos_udp.h)
+/*-------------------------------------------------------------------------*/
+
+int sim_is_active() {
+    return (sim != NULL);
+}
+
+int sim_receiver_open(udp_receiver * rec, char* address_string, int port) {
+    int i, fds[2];
+    sim_endpoint * ep = NULL;
+
+    for(i = 0; i < SIM_MAX_RECEIVERS; i++) {
+        if(sim->endpoints[i].rec == NULL) {
+            ep = &sim->endpoints[i];
+            break;
+        }
+    }
+    if(ep == NULL) {
+        printf("Too many simulated receivers\n");
+        return -1;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+    //Never blocks the simulator
+    if(fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    memset(&rec->addr, 0, sizeof(struct sockaddr_in));
+    rec->addr.sin_family = AF_INET;
+    rec->addr.sin_addr.s_addr = inet_addr(address_string);
+    rec->addr.sin_port = htons((uint16_t)port);
+    rec->sock = fds[0];
+
+    ep->rec = rec;
+    ep->addr = rec->addr;
+    ep->write_fd = fds[1];
+    ep->busy_until = 0;
+    LOG(DBG, ("Simulated receiver %d for address %s:%d\n", rec->sock, address_string, port));
+    return 0;
+}
+
+void sim_receiver_close(udp_receiver * rec) {
+    int i;
+    sim_endpoint * ep = NULL;
+    sim_packet ** pos, * pk;
+
+    for(i = 0; i < SIM_MAX_RECEIVERS; i++) {
+        if(sim->endpoints[i].rec == rec) {
+            ep = &sim->endpoints[i];
+            break;
+        }
+    }
+    if(ep == NULL) {
+        return;
+    }
+
+    //Messages in flight to it are lost
+    pos = &sim->in_flight;
+    while(*pos != NULL) {
+        pk = *pos;
+        if(pk->dest == ep) {
+            *pos = pk->next;
+            PAX_FREE(pk);
+            METRIC_INC(sim_metrics.dropped);
+        } else {
+            pos = &pk->next;
+        }
+    }
+    close(ep->write_fd);
+    ep->rec = NULL;
+    sim_schedule();
+}
+
+//Returns size, like sendto, also if the message is lost
+int sim_send(struct sockaddr_in * dest, char * data, size_t size) {
+    int i;
+    sim_endpoint * ep;
+    sim_packet * pk;
+    int64_t now = sim_now(), start;
+
+    METRIC_INC(sim_metrics.sent);
+    METRIC_ADD(sim_metrics.bytes, size);
+    sim_count_type((paxos_msg *)data);
+
+    for(i = 0; i < SIM_MAX_RECEIVERS; i++) {
+        ep = &sim->endpoints[i];
+        if(ep->rec == NULL ||
+            ep->addr.sin_addr.s_addr != dest->sin_addr.s_addr ||
+            ep->addr.sin_port != dest->sin_port) {
+            continue;
+        }
+
+        //Each receiver loses messages independently
+        if(sim->params.loss_permille > 0 &&
+            (int)(sim_random() % 1000) < sim->params.loss_permille) {
+            METRIC_INC(sim_metrics.dropped);
+            continue;
+        }
+
+        //Transmitted after the previous ones
+        start = now;
+        if(sim->params.bandwidth > 0) {
+            if(ep->busy_until > start) {
+                start = ep->busy_until;
+            }
+            start += ((int64_t)size * 1000000) / sim->params.bandwidth;
+            ep->busy_until = start;
+        }
+
+        pk = PAX_MALLOC(sizeof(sim_packet) + size);
+        pk->deliver_at = start + sim->params.latency;
+        if(sim->params.jitter > 0) {
+            pk->deliver_at += sim_random() % (sim->params.jitter + 1);
+        }
+        pk->dest = ep;
+        pk->size = size;
+        memcpy(pk->data, data, size);
+        sim_enqueue(pk);
+    }
+
+    sim_schedule();
+    return (int)size;
+}
+
+/*-------------------------------------------------------------------------*/
+// Public functions (see libpaxos.h for more details)
+/*-------------------------------------------------------------------------*/
+
+int pax_sim_start(struct event_base * eb, paxos_sim_params * params) {
+    if(sim != NULL) {
+        printf("Simulator already started\n");
+        return -1;
+    }
+    if(params->latency < 0 || params->jitter < 0 || params->bandwidth < 0 ||
+        params->loss_permille < 0 || params->loss_permille > 1000) {
+        printf("Invalid simulator parameters\n");
+        return -1;
+    }
+
+    struct sim_state * s = PAX_MALLOC(sizeof(struct sim_state));
+    memset(s, 0, sizeof(struct sim_state));
+    s->eb = eb;
+    s->params = *params;
+    //The state of xorshift cannot be 0
+    s->rng = (uint64_t)params->seed + 1;
+
+    evtimer_set(&s->deliver_event, sim_deliver, NULL);
+    event_base_set(eb, &s->deliver_event);
+
+    sim_metrics.sent = metrics_register("sim_sent", metric_counter);
+    sim_metrics.delivered = metrics_register("sim_delivered", metric_counter);
+    sim_metrics.dropped = metrics_register("sim_dropped", metric_counter);
+    sim_metrics.bytes = metrics_register("sim_bytes", metric_counter);
+    sim_metrics.sent_prepare_reqs = metrics_register("sim_sent_prepare_reqs", metric_counter);
+    sim_metrics.sent_prepare_acks = metrics_register("sim_sent_prepare_acks", metric_counter);
+    sim_metrics.sent_accept_reqs = metrics_register("sim_sent_accept_reqs", metric_counter);
+    sim_metrics.sent_accept_acks = metrics_register("sim_sent_accept_acks", metric_counter);
+    sim_metrics.sent_repeat_reqs = metrics_register("sim_sent_repeat_reqs", metric_counter);
+    sim_metrics.sent_submit = metrics_register("sim_sent_submit", metric_counter);
+    sim_metrics.sent_other = metrics_register("sim_sent_other", metric_counter);
+
+    sim = s;
+    LOG(VRB, ("Simulated network started (seed:%u)\n", params->seed));
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "event.h"
+#include "evutil.h"
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+
+#define THREAD_ERROR (-1)
+#define THREAD_READY (0)
+#define THREAD_STARTING (1)
+
+/*
+    The roles started trough the functions in libpaxos.h (learner_init,
+    acceptor_init, ...) run in an internal thread, with its own libevent
+    loop. The thread calling paxos_thread_start waits until the
+    initialization is complete.
+*/
+typedef struct thread_start_t {
+    paxos_thread_init   init;
+    void *              arg;
+    //Current status of the thread and related signal
+    int                 status;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+} thread_start;
+
+//Sets the status and wakes up the thread that called paxos_thread_start.
+// After this, ts must not be used anymore
+static void
+thread_set_status(thread_start * ts, int status) {
+    pthread_mutex_lock(&ts->lock);
+    ts->status = status;
+    pthread_cond_signal(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+}
+
+//Invoked as first event of libevent loop, if the init
+// completes successfully
+static void
+thread_init_success(int fd, short event, void *arg) {
+    UNUSED_ARG(fd);
+    UNUSED_ARG(event);
+
+    LOG(DBG, ("Thread setting status to ready\n"));
+    thread_set_status((thread_start *)arg, THREAD_READY);
+}
+
+//Body of the new thread: initializes the event base and the role,
+// and starts the libevent loop (which never returns)
+static void*
+thread_main(void* arg) {
+    thread_start * ts = arg;
+    struct event_base * eb;
+    struct event init_complete_event;
+    struct timeval asap_interval = {0, 0};
+
+    //Initialization of libevent handle. This is also the default
+    // base, so that custom init functions can use event_set/event_add
+    if((eb = event_init()) == NULL) {
+        printf("Error in libevent init\n");
+        thread_set_status(ts, THREAD_ERROR);
+        return NULL;
+    }
+
+    if(ts->init(eb, ts->arg) != 0) {
+        thread_set_status(ts, THREAD_ERROR);
+        return NULL;
+    }
+
+    //Signal ready as soon as the loop starts
+    evtimer_set(&init_complete_event, thread_init_success, ts);
+    event_base_set(eb, &init_complete_event);
+	if(event_add(&init_complete_event, &asap_interval) != 0) {
+	   printf("Error while adding successful init event\n");
+       thread_set_status(ts, THREAD_ERROR);
+       return NULL;
+    }
+
+    // Start the libevent loop, should never return
+    LOG(DBG, ("Thread ready, starting libevent loop\n"));
+    event_base_dispatch(eb);
+    printf("libevent loop terminated\n");
+    return NULL;
+}
+
+int
+paxos_thread_start(paxos_thread_init init, void * arg) {
+    thread_start ts;
+    pthread_t thread;
+    int status;
+
+    ts.init = init;
+    ts.arg = arg;
+    ts.status = THREAD_STARTING;
+    pthread_mutex_init(&ts.lock, NULL);
+    pthread_cond_init(&ts.cond, NULL);
+
+    if (pthread_create(&thread, NULL, thread_main, &ts) != 0) {
+        perror("pthread create");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    //Wait until initialization completed
+    LOG(DBG, ("Thread started, waiting for ready signal\n"));
+    pthread_mutex_lock(&ts.lock);
+    while(ts.status == THREAD_STARTING) {
+        pthread_cond_wait(&ts.cond, &ts.lock);
+    }
+    status = ts.status;
+    pthread_mutex_unlock(&ts.lock);
+
+    pthread_mutex_destroy(&ts.lock);
+    pthread_cond_destroy(&ts.cond);
+    return (status == THREAD_READY ? 0 : -1);
+}
@@ -10,43 +10,25 @@
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
 #include "values_handler.h"
+#include "clients_handler.h"
+#include "paxos_metrics.h"
 
 
 #define PROPOSER_ERROR (-1)
 
-//Lowest instance for which no value has been chosen
-static iid_t current_iid = 1;
-
-//Unique identifier of this proposer
-short int this_proposer_id = -1;
-
-//Id of the current leader, proposer 0 starts as leader
-short int current_leader_id = 0;
-#define LEADER_IS_ME (this_proposer_id == current_leader_id)
-
-//Sequence number of the alive message periodically sent to failure oracle
-long unsigned int alive_ping_seqno = 0;
-
-//UDP socket manager for send/recv oracle messages
-static udp_send_buffer * to_oracle;
-static udp_receiver * from_oracle;
-
-
-//UDP socket managers for sending
-static udp_send_buffer * to_acceptors;
-
-//UDP socket manager for receiving
-static udp_receiver * for_proposer;
-
-//Event: Message received (from acceptors)
-static struct event proposer_msg_event;
-//Event: Message received (from oracle)
-static struct event oracle_msg_event;
-//Event: Time to ping failure oracle
-static struct event fe_ping_event;
-
-//Time interval for pings
-struct timeval fe_ping_interval;
+#ifdef PAXOS_MULTI_LEADER
+//Instances are assigned round-robin to proposers 0...N_OF_LEADERS-1,
+// each of them is leader for its own
+#define LEADER_IS_ME(P) ((P)->proposer_id < N_OF_LEADERS)
+#define IID_STEP N_OF_LEADERS
+#define IID_OWNER(I) ((I) % N_OF_LEADERS)
+#define FIRST_OWNED_IID(P, I) ((I) + \
+    ((N_OF_LEADERS + (P)->proposer_id - ((I) % N_OF_LEADERS)) % N_OF_LEADERS))
+#else
+#define LEADER_IS_ME(P) ((P)->proposer_id == (P)->current_leader_id)
+#define IID_STEP 1
+#define FIRST_OWNED_IID(P, I) (I)
+#endif
 
 typedef enum instance_status_e {
     empty, 
@@ -66,33 +48,183 @@ typedef struct proposer_instance_info {
     vh_value_wrapper * p1_value;
     ballot_t        p1_value_ballot;
     vh_value_wrapper * p2_value;
+    //Opened with an any request (fast round)
+    short int       fast_any;
+    //Taken over from another leader (multi-leader mode)
+    short int       revoking;
+#ifdef PAXOS_FAST_MODE
+    //Values accepted in the fast round, found in phase 1
+    vh_value_wrapper * p1_fast_values[N_OF_ACCEPTORS];
+#endif
+    struct timeval  sent;
     struct timeval  timeout;
+    //Links in the leader timer wheel (see proposer_leader.c)
+    struct proposer_instance_info * tw_next;
+    struct proposer_instance_info ** tw_pprev;
 } p_inst_info;
 
-p_inst_info proposer_state[PROPOSER_ARRAY_SIZE];
-#define GET_PRO_INSTANCE(I) &proposer_state[((I) & (PROPOSER_ARRAY_SIZE-1))]
-
-#define FIRST_BALLOT (MAX_N_OF_PROPOSERS + this_proposer_id)
-#define NEXT_BALLOT(B) (B + MAX_N_OF_PROPOSERS)
-
 struct phase1_info {
     unsigned int    pending_count;
     unsigned int    ready_count;
     iid_t           highest_open;
 };
-struct phase1_info p1_info;
 
 struct phase2_info {
     iid_t next_unused_iid;
     unsigned int open_count;
+    //Adaptive window, see PROPOSER_P2_WINDOW_INITIAL in config
+    unsigned int window;
+    unsigned int window_acked;
+    iid_t recovery_iid;
+    long unsigned int min_latency;
 };
-struct phase2_info p2_info;
+
+//Smoothed round trip time for a phase, used to compute its timeout
+// (like the TCP retransmission timeout). Unit is microseconds
+struct rtt_estimator {
+    long unsigned int srtt;
+    long unsigned int rttvar;
+    long unsigned int timeout;
+    long unsigned int min_timeout;
+    long unsigned int max_timeout;
+};
+
+//Instances waiting for a deadline, see proposer_leader.c
+struct timer_wheel {
+    //size slots, a power of 2 spanning the longest timeout
+    p_inst_info **  slots;
+    size_t          size;
+    uint64_t        last_tick;
+    unsigned int    count;
+};
+
+//Exported metrics of a proposer (see paxos_metrics.h), also printed 
+// periodically if LEADER_EVENTS_UPDATE_INTERVAL is defined
+struct leader_event_counters {
+    paxos_metric * p1_timeout;
+    paxos_metric * p2_timeout;
+    paxos_metric * p2_waits_p1;
+    paxos_metric * p2_window_decrease;
+    paxos_metric * fast_recovery;
+    paxos_metric * revoked;
+    paxos_metric * p2_noop;
+    paxos_metric * p1_latency;
+    paxos_metric * p2_latency;
+    paxos_metric * p2_window;
+    paxos_metric * p2_open;
+    paxos_metric * p1_ready;
+    paxos_metric * pending_values;
+    paxos_metric * dropped_values;
+};
+
+//The state of a proposer, all its events are in the same event base
+struct paxos_proposer_t {
+    struct event_base * eb;
+
+    //Unique identifier of this proposer, in its group
+    short int           proposer_id;
+
+    //Consensus group of this proposer (see PAXOS_GROUPS)
+    int                 group;
+
+    //Lowest instance for which no value has been chosen
+    iid_t               current_iid;
+
+    //Id of the current leader, proposer 0 starts as leader
+    short int           current_leader_id;
+
+    //Ballot of phase 1 for new instances, set when promoted
+    ballot_t            first_ballot;
+
+    //Highest ballot of the delivered instances
+    ballot_t            highest_ballot_seen;
+
+    //Leader lease (see PAXOS_LEADER_LEASE in config), read by other
+    // threads: when it expires (microseconds since the epoch, 0 if 
+    // not held) and the last instance a local read must wait for
+    int64_t             lease_expiry;
+    iid_t               lease_read_point;
+    //Highest instance accepted by the acceptors that promised,
+    // holes below it are filled and local reads wait for it
+    iid_t               highest_accepted_iid;
+    //Set when an idle leader must renew the lease with a no-op
+    int                 lease_renew;
+
+    //Sequence number of the alive message periodically sent to failure oracle
+    long unsigned int   alive_ping_seqno;
+
+    //UDP socket manager for send/recv oracle messages
+    udp_send_buffer *   to_oracle;
+    udp_receiver *      from_oracle;
+
+    //UDP socket managers for sending
+    udp_send_buffer *   to_acceptors;
+
+    //UDP socket manager for receiving
+    udp_receiver *      for_proposer;
+
+    //Event: Message received (from acceptors)
+    struct event        proposer_msg_event;
+    //Event: Message received (from oracle)
+    struct event        oracle_msg_event;
+    //Event: Time to ping failure oracle
+    struct event        fe_ping_event;
+
+    //Time interval for pings
+    struct timeval      fe_ping_interval;
+
+    //proposer_array_size entries, allocated at init
+    p_inst_info *       state;
+
+    struct phase1_info  p1_info;
+    struct phase2_info  p2_info;
+
+    //Values submitted to this proposer
+    vh_state *          vh;
+
+    //Learner in the same event base, delivers to the proposer
+    paxos_learner *     learner;
+
+    //Leader only (see proposer_leader.c)
+    struct event        p1_check_event;
+    struct timeval      p1_check_interval;
+    struct event        p2_check_event;
+    struct timeval      p2_check_interval;
+    struct rtt_estimator p1_rtt;
+    struct rtt_estimator p2_rtt;
+    struct timer_wheel  t_wheel;
+    struct leader_event_counters counters;
+#ifdef LEADER_EVENTS_UPDATE_INTERVAL
+    struct event        print_events_event;
+    struct timeval      print_events_interval;
+#endif
+#ifdef PAXOS_MULTI_LEADER
+    //Lowest undelivered instance, owned by some other leader,
+    // and since when it's blocking delivery
+    iid_t               stuck_iid;
+    struct timeval      stuck_since;
+#endif
+#ifdef PROPOSER_THRIFTY_P2
+    //New accept requests go to phase2_quorum consecutive acceptors, 
+    // starting from thrifty_first
+    int                 thrifty_first;
+    //Instances opened since the last rotation
+    unsigned int        thrifty_opened;
+    //Some phase 2 timed out since the last rotation
+    int                 thrifty_timeout;
+#endif
+};
+
+#define GET_PRO_INSTANCE(P, I) &(P)->state[((I) & (paxos_conf.proposer_array_size-1))]
+
+#define FIRST_BALLOT(P) ((P)->first_ballot)
+#define NEXT_BALLOT(B) (B + MAX_N_OF_PROPOSERS)
 
 //Required by leader
-static void pro_clear_instance_info(p_inst_info * ii);
+static void pro_clear_instance_info(paxos_proposer * p, p_inst_info * ii);
 
-//Custom function that allows app on top of proposer to add libevent events
-static custom_init_function client_custom_init = NULL;
+//The proposer started by proposer_init
+static paxos_proposer * default_proposer = NULL;
 
 #include "proposer_leader.c"
 
@@ -100,9 +232,15 @@ static custom_init_function client_custom_init = NULL;
 // Helpers
 /*-------------------------------------------------------------------------*/
 static void
-pro_clear_instance_info(p_inst_info * ii) {
+pro_clear_instance_info(paxos_proposer * p, p_inst_info * ii) {
+    leader_timer_cancel(p, ii);
+#ifdef PAXOS_FAST_MODE
+    leader_fast_clear_values(ii);
+#endif
     ii->iid = 0;
     ii->status = empty;
+    ii->fast_any = 0;
+    ii->revoking = 0;
     ii->my_ballot = 0;
     ii->p1_value_ballot = 0;
     ii->promises_bitvector = 0;
@@ -122,14 +260,14 @@ pro_save_prepare_ack(p_inst_info * ii, prepare_ack * pa, short int acceptor_id)
     
     //Ack from already received!
     if(ii->promises_bitvector & (1<<acceptor_id)) {
-        LOG(DBG, ("Dropping duplicate promise from:%d, iid:%u, \n", acceptor_id, ii->iid));
+        LOG(DBG, ("Dropping duplicate promise from:%d, iid:%"IID_FMT", \n", acceptor_id, ii->iid));
         return;
     }
     
     // promise is new
-    ii->promises_bitvector &= (1<<acceptor_id);
+    ii->promises_bitvector |= (1<<acceptor_id);
     ii->promises_count++;
-    LOG(DBG, ("Received valid promise from:%d, iid:%u, \n", acceptor_id, ii->iid));
+    LOG(DBG, ("Received valid promise from:%d, iid:%"IID_FMT", \n", acceptor_id, ii->iid));
     
     //Promise contains no value
     if(pa->value_size == 0) {
@@ -139,6 +277,14 @@ pro_save_prepare_ack(p_inst_info * ii, prepare_ack * pa, short int acceptor_id)
 
     //Promise contains a value
     
+#ifdef PAXOS_FAST_MODE
+    //Accepted in a fast round, the value to use is picked 
+    // when the quorum is reached (see leader_fast_pick_value)
+    if(IS_FAST_BALLOT(pa->value_ballot)) {
+        ii->p1_fast_values[acceptor_id] = vh_wrap_value(pa->value, pa->value_size);
+    }
+#endif
+
     //Our value has same or greater ballot
     if(ii->p1_value_ballot >= pa->value_ballot) {
         //Keep the current value
@@ -168,16 +314,25 @@ pro_save_prepare_ack(p_inst_info * ii, prepare_ack * pa, short int acceptor_id)
     LOG(DBG, (" Value in promise saved\n"));
 }
 
-void 
-pro_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, int proposer) {
-    LOG(DBG, ("Instance iid:%u delivered to proposer\n", iid));
+static void 
+pro_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, 
+    int proposer, void * arg) {
+    paxos_proposer * p = arg;
+    LOG(DBG, ("Instance iid:%"IID_FMT" delivered to proposer\n", iid));
+    
+    if(ballot > p->highest_ballot_seen) {
+        p->highest_ballot_seen = ballot;
+    }
+    
+    //Client values delivered, also if standby
+    vh_delivered(p->vh, value, size);
     
     //If leader, take the appropriate action
-    if(LEADER_IS_ME) {
-        leader_deliver(value, size, iid, ballot, proposer);
+    if(LEADER_IS_ME(p)) {
+        leader_deliver(p, value, size, iid, ballot, proposer);
     }
     
-    current_iid = iid + 1;
+    p->current_iid = iid + 1;
 
     //clear inst_info not required, done by leader
 }
@@ -187,17 +342,25 @@ pro_deliver_callback(char * value, size_t size, iid_t iid, ballot_t ballot, int
 
 //Returns 1 if the instance became ready, 0 otherwise
 static int
-handle_prepare_ack(prepare_ack * pa, short int acceptor_id) {
-    p_inst_info * ii = GET_PRO_INSTANCE(pa->iid);
+handle_prepare_ack(paxos_proposer * p, prepare_ack * pa, short int acceptor_id, struct timeval * now) {
+    p_inst_info * ii = GET_PRO_INSTANCE(p, pa->iid);
     // If not p1_pending, drop
     if(ii->status != p1_pending) {
-        LOG(DBG, ("Promise dropped, iid:%u not pending\n", pa->iid));
+        LOG(DBG, ("Promise dropped, iid:%"IID_FMT" not pending\n", pa->iid));
         return 0;
     }
     
     // If not our ballot, drop
     if(pa->ballot != ii->my_ballot) {
-        LOG(DBG, ("Promise dropped, iid:%u not our ballot\n", pa->iid));
+        LOG(DBG, ("Promise dropped, iid:%"IID_FMT" not our ballot\n", pa->iid));
+        return 0;
+    }
+    
+    // If not a member for this instance, drop
+    const paxos_membership * m = learner_membership(p->learner, pa->iid);
+    if(!IS_MEMBER(m, acceptor_id)) {
+        LOG(DBG, ("Promise dropped, acceptor %d not a member in iid:%"IID_FMT"\n", 
+            acceptor_id, pa->iid));
         return 0;
     }
     
@@ -205,27 +368,40 @@ handle_prepare_ack(prepare_ack * pa, short int acceptor_id) {
     //Takes also care of value that may be there
     pro_save_prepare_ack(ii, pa, acceptor_id);
     
-    //Not a majority yet for this instance
-    if(ii->promises_count < QUORUM) {
-        LOG(DBG, ("Not yet a quorum for iid:%u\n", pa->iid));
+    //Instances used by previous leaders, known before the learner
+    // sees them (see leader_is_hole and the leader lease)
+    if(pa->highest_accepted_iid > p->highest_accepted_iid) {
+        p->highest_accepted_iid = pa->highest_accepted_iid;
+    }
+    
+    //Not a phase 1 quorum yet for this instance
+    if(ii->promises_count < (unsigned int)m->phase1_quorum) {
+        LOG(DBG, ("Not yet a quorum for iid:%"IID_FMT"\n", pa->iid));
         return 0;
     }
     
     //Quorum reached!
+#ifdef PAXOS_FAST_MODE
+    leader_fast_pick_value(p, ii);
+#endif
     ii->status = p1_ready;
-    p1_info.pending_count -= 1;
-    p1_info.ready_count += 1;
+    leader_timer_cancel(p, ii);
+    leader_p1_latency_sample(p, leader_usecs_since(&ii->sent, now));
+    leader_lease_update_read_point(p);
+    leader_lease_extend(p, &ii->sent);
+    p->p1_info.pending_count -= 1;
+    p->p1_info.ready_count += 1;
 
-    LOG(DBG, ("Quorum for iid:%u reached\n", pa->iid));
+    LOG(DBG, ("Quorum for iid:%"IID_FMT" reached\n", pa->iid));
     
     return 1;
 }
 
 static void
-handle_prepare_ack_batch(prepare_ack_batch* pab) {
+handle_prepare_ack_batch(paxos_proposer * p, prepare_ack_batch* pab) {
     
     //Ignore if not the current leader
-    if(!LEADER_IS_ME) {
+    if(!LEADER_IS_ME(p)) {
         return;
     }
 
@@ -235,25 +411,27 @@ handle_prepare_ack_batch(prepare_ack_batch* pab) {
     prepare_ack * pa;
     size_t data_offset = 0;
     short int i, ready=0;
+    struct timeval now;
+    gettimeofday(&now, NULL);
     
     for(i = 0; i < pab->count; i++) {
         pa = (prepare_ack *)&pab->data[data_offset];
-        ready += handle_prepare_ack(pa, pab->acceptor_id);
+        ready += handle_prepare_ack(p, pa, pab->acceptor_id, &now);
         data_offset += PREPARE_ACK_SIZE(pa);
     }
     LOG(DBG, ("%d instances just completed phase 1.\n \
             Status: p1_pending_count:%d, p1_ready_count:%d\n", 
-            ready, p1_info.pending_count, p1_info.ready_count));
+            ready, p->p1_info.pending_count, p->p1_info.ready_count));
 
     
     //Some instance completed phase 1
     if(ready > 0) {
         // Send a value for p2 timed-out that 
         // had to go trough phase 1 again
-        leader_open_instances_p2_expired();
+        leader_open_instances_p2_expired(p);
         // try to send a value in phase 2
         // for new instances
-        leader_open_instances_p2_new();
+        leader_open_instances_p2_new(p);
     }
 }
 
@@ -264,12 +442,12 @@ pro_handle_newmsg(int sock, short event, void *arg) {
     //Make the compiler happy!
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_proposer * p = arg;
     
-    assert(sock == for_proposer->sock);
+    assert(sock == p->for_proposer->sock);
     
     //Read the next message
-    int valid = udp_read_next_message(for_proposer);
+    int valid = udp_read_next_message(p->for_proposer);
     if (valid < 0) {
         printf("Dropping invalid proposer message\n");
         return;
@@ -277,10 +455,10 @@ pro_handle_newmsg(int sock, short event, void *arg) {
 
     //The message is valid, take the appropriate action
     // based on the type
-    paxos_msg * msg = (paxos_msg*) &for_proposer->recv_buffer;
+    paxos_msg * msg = (paxos_msg*) &p->for_proposer->recv_buffer;
     switch(msg->type) {
         case prepare_acks: {
-            handle_prepare_ack_batch((prepare_ack_batch*) msg->data);
+            handle_prepare_ack_batch(p, (prepare_ack_batch*) msg->data);
         }
         break;
 
@@ -297,12 +475,12 @@ pro_handle_oracle_msg(int sock, short event, void *arg) {
     //Make the compiler happy!
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_proposer * p = arg;
     
-    assert(sock == from_oracle->sock);
+    assert(sock == p->from_oracle->sock);
     
     //Read the next message
-    int valid = udp_read_next_message(from_oracle);
+    int valid = udp_read_next_message(p->from_oracle);
     if (valid < 0) {
         printf("Dropping invalid oracle message\n");
         return;
@@ -310,20 +488,24 @@ pro_handle_oracle_msg(int sock, short event, void *arg) {
 
     //The message is valid, take the appropriate action
     // based on the type
-    paxos_msg * msg = (paxos_msg*) &from_oracle->recv_buffer;
+    paxos_msg * msg = (paxos_msg*) &p->from_oracle->recv_buffer;
     switch(msg->type) {
         case leader_announce: {
+#ifdef PAXOS_MULTI_LEADER
+            //Leaders are fixed
+            break;
+#endif
             leader_announce_msg * la = (leader_announce_msg *)msg->data;
-            if(LEADER_IS_ME && la->current_leader != this_proposer_id) {
+            if(LEADER_IS_ME(p) && la->current_leader != p->proposer_id) {
             //Some other proposer was nominated leader instead of this one, 
             // step down from leadership
-                leader_shutdown();
-            } else if (!LEADER_IS_ME 
-                && la->current_leader == this_proposer_id) {
+                leader_shutdown(p);
+            } else if (!LEADER_IS_ME(p) 
+                && la->current_leader == p->proposer_id) {
             //This proposer has just been promoted to leader
-                leader_init();
+                leader_init(p);
             }
-            current_leader_id = la->current_leader;
+            p->current_leader_id = la->current_leader;
         }
         break;
 
@@ -338,13 +520,13 @@ static void
 pro_ping_failure_detector(int sock, short event, void *arg) {
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_proposer * p = arg;
     
-    alive_ping_seqno += 1;
-    sendbuf_send_ping(to_oracle, this_proposer_id, alive_ping_seqno);
+    p->alive_ping_seqno += 1;
+    sendbuf_send_ping(p->to_oracle, p->proposer_id, p->alive_ping_seqno);
     
     int ret;
-    ret = event_add(&fe_ping_event, &fe_ping_interval);
+    ret = event_add(&p->fe_ping_event, &p->fe_ping_interval);
     assert(ret == 0);
 }
 
@@ -354,150 +536,293 @@ pro_ping_failure_detector(int sock, short event, void *arg) {
 /*-------------------------------------------------------------------------*/
 //Initialize sockets and related events
 static int 
-init_pro_network() {
+init_pro_network(paxos_proposer * p) {
     
     // Send buffer for talking to acceptors
-    to_acceptors = udp_sendbuf_new(PAXOS_ACCEPTORS_NET);
-    if(to_acceptors == NULL) {
+    p->to_acceptors = udp_sendbuf_new(CONF_NET_GROUP(acceptors_net, p->group));
+    if(p->to_acceptors == NULL) {
         printf("Error creating proposer->acceptors network sender\n");
         return PROPOSER_ERROR;
     }
     
     // Message receive event
-    for_proposer = udp_receiver_new(PAXOS_PROPOSERS_NET);
-    if (for_proposer == NULL) {
+    p->for_proposer = udp_receiver_new(CONF_NET_GROUP(proposers_net, p->group));
+    if (p->for_proposer == NULL) {
         printf("Error creating proposer network receiver\n");
         return PROPOSER_ERROR;
     }
-    event_set(&proposer_msg_event, for_proposer->sock, EV_READ|EV_PERSIST, pro_handle_newmsg, NULL);
-    event_add(&proposer_msg_event, NULL);
+    event_set(&p->proposer_msg_event, p->for_proposer->sock, EV_READ|EV_PERSIST, pro_handle_newmsg, p);
+    event_base_set(p->eb, &p->proposer_msg_event);
+    event_add(&p->proposer_msg_event, NULL);
     
     return 0;
 }
 
 //Initialize timers
 static int 
-init_pro_fd_events() {
+init_pro_fd_events(paxos_proposer * p) {
     
     // Send buffer for sending alive pings
-    to_oracle = udp_sendbuf_new(PAXOS_PINGS_NET);
-    if(to_oracle == NULL) {
+    p->to_oracle = udp_sendbuf_new(CONF_NET_GROUP(pings_net, p->group));
+    if(p->to_oracle == NULL) {
         printf("Error creating proposer->oracle network sender\n");
         return PROPOSER_ERROR;
     }
     
     // Message receive event (from oracle)
-    from_oracle = udp_receiver_new(PAXOS_ORACLE_NET);
-    if (from_oracle == NULL) {
+    p->from_oracle = udp_receiver_new(CONF_NET_GROUP(oracle_net, p->group));
+    if (p->from_oracle == NULL) {
         printf("Error creating oracle->proposer network receiver\n");
         return PROPOSER_ERROR;
     }
-    event_set(&oracle_msg_event, from_oracle->sock, EV_READ|EV_PERSIST, pro_handle_oracle_msg, NULL);
-    event_add(&oracle_msg_event, NULL);
+    event_set(&p->oracle_msg_event, p->from_oracle->sock, EV_READ|EV_PERSIST, pro_handle_oracle_msg, p);
+    event_base_set(p->eb, &p->oracle_msg_event);
+    event_add(&p->oracle_msg_event, NULL);
 
     //Set timer for sending alive pings
-    evtimer_set(&fe_ping_event, pro_ping_failure_detector, NULL);
-    evutil_timerclear(&fe_ping_interval);
-    fe_ping_interval.tv_sec = (FAILURE_DETECTOR_PING_INTERVAL / 1000000);
-    fe_ping_interval.tv_usec = (FAILURE_DETECTOR_PING_INTERVAL % 1000000);
+    evtimer_set(&p->fe_ping_event, pro_ping_failure_detector, p);
+    event_base_set(p->eb, &p->fe_ping_event);
+    evutil_timerclear(&p->fe_ping_interval);
+    p->fe_ping_interval.tv_sec = (paxos_conf.ping_interval / 1000000);
+    p->fe_ping_interval.tv_usec = (paxos_conf.ping_interval % 1000000);
 
     //Send the first alive ping
-    pro_ping_failure_detector(0, 0, NULL);
+    pro_ping_failure_detector(0, 0, p);
     
     return 0;
 }
 
 //Initialize structures
 static int 
-init_pro_structs() {
-    //Check array size
-    if ((PROPOSER_ARRAY_SIZE & (PROPOSER_ARRAY_SIZE -1)) != 0) {
-        printf("Error: PROPOSER_ARRAY_SIZE is not a power of 2\n");
-        return PROPOSER_ERROR;        
-    }
-    if (PROPOSER_ARRAY_SIZE <= PROPOSER_PREEXEC_WIN_SIZE) {
-        printf("Error: PROPOSER_ARRAY_SIZE = %d is too small\n",
-            PROPOSER_ARRAY_SIZE);
+init_pro_structs(paxos_proposer * p) {
+    //Check array size (proposer_array_size is checked with the config)
+    if (paxos_conf.proposer_array_size <= 
+        (paxos_conf.preexec_win_size * IID_STEP)) {
+        printf("Error: proposer_array_size = %d is too small\n",
+            paxos_conf.proposer_array_size);
         return PROPOSER_ERROR;
     }
     
-    // Clear the state array
-    memset(proposer_state, 0, (sizeof(p_inst_info) * PROPOSER_ARRAY_SIZE));
-    size_t i;
-    for(i = 0; i < PROPOSER_ARRAY_SIZE; i++) {
-        pro_clear_instance_info(&proposer_state[i]);
+    // Allocate and clear the state array
+    size_t i, size = (sizeof(p_inst_info) * paxos_conf.proposer_array_size);
+    p->state = PAX_MALLOC(size);
+    memset(p->state, 0, size);
+    for(i = 0; i < (size_t)paxos_conf.proposer_array_size; i++) {
+        pro_clear_instance_info(p, &p->state[i]);
+    }
+    
+    //The timer wheel covers the longest timeout (plus the tick 
+    // in progress), so that a deadline never shares its slot 
+    // with the ones of a later round
+    long max_timeout = paxos_conf.p1_timeout_max;
+    if(paxos_conf.p2_timeout_max > max_timeout) {
+        max_timeout = paxos_conf.p2_timeout_max;
+    }
+    size_t ticks = (max_timeout / paxos_conf.p2_check_interval) + 2;
+    p->t_wheel.size = 1;
+    while(p->t_wheel.size < ticks) {
+        p->t_wheel.size *= 2;
     }
+    size = sizeof(p_inst_info *) * p->t_wheel.size;
+    p->t_wheel.slots = PAX_MALLOC(size);
+    memset(p->t_wheel.slots, 0, size);
     return 0;
 
 }
 
-//Proposer initialization, this function is invoked by
-// the underlying learner after it's normal initialization
-static int init_proposer() {
+//Proposer initialization, on the event base of the proposer
+static int init_proposer(paxos_proposer * p) {
+    
+    //Also if it never becomes leader, to export them anyway
+    register_event_counters(p);
+    
+    //The learner delivers to this proposer, in the same event base
+    p->learner = learner_new_instances(p->eb, p->group, pro_deliver_callback, p);
+    if(p->learner == NULL) {
+        printf("Could not start the learner!\n");
+        return -1;
+    }
     
     //Add network events and prepare send buffer
-    if(init_pro_network() != 0) {
+    if(init_pro_network(p) != 0) {
         printf("Proposer network init failed\n");
         return -1;
     }
 
     //Add additional timers to libevent loop
-    if(init_pro_fd_events() != 0){
+    if(init_pro_fd_events(p) != 0){
         printf("Proposer timers init failed\n");
         return -1;
     }
     
     //Normal proposer initialization, private structures
-    if(init_pro_structs() != 0) {
+    if(init_pro_structs(p) != 0) {
         printf("Proposer structs init failed\n");
         return -1;
     }
+    
+    //Values can be submitted even if this proposer is not the leader
+    p->vh = vh_new(p->eb, p->group, p->proposer_id);
+    if(p->vh == NULL) {
+        printf("Values handler init failed\n");
+        return -1;
+    }
         
     //By default, proposer 0 starts as leader, 
     // later on the failure detector may change that
-    if(LEADER_IS_ME) {
-        if(leader_init() != 0) {
+    if(LEADER_IS_ME(p)) {
+        if(leader_init(p) != 0) {
             printf("Proposer Leader init failed\n");
             return -1;
         }
     }
     
+    return 0;
+}
+
+//Arguments of proposer_init, passed to the proposer thread
+typedef struct pro_legacy_args_t {
+    int proposer_id;
+    //Allows app on top of proposer to add libevent events
+    custom_init_function cif;
+} pro_legacy_args;
+
+//Invoked in the proposer thread by paxos_thread_start
+static int
+init_pro_legacy(struct event_base * eb, void * arg) {
+    pro_legacy_args * pa = arg;
+    
+    default_proposer = proposer_new(eb, 0, pa->proposer_id);
+    if(default_proposer == NULL) {
+        return -1;
+    }
+    
     //Call custom init (i.e. to register additional events)
-    if(client_custom_init != NULL && client_custom_init() != 0) {
+    if(pa->cif != NULL && pa->cif() != 0) {
         printf("Error in client_custom_init\n");
         return -1;
     } else {
         LOG(DBG, ("Custom init completed\n"));
     }
-
     return 0;
 }
+
 /*-------------------------------------------------------------------------*/
 // Public functions (see libpaxos.h for more details)
 /*-------------------------------------------------------------------------*/
 
-
-int proposer_init(int proposer_id) {
+paxos_proposer * proposer_new(struct event_base * eb, int group, int proposer_id) {
+    
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return NULL;
+    }
     
     //Check id validity of proposer_id
     if(proposer_id < 0 || proposer_id >= MAX_N_OF_PROPOSERS) {
         printf("Invalid proposer id:%d\n", proposer_id);
-        return -1;
-    }    
-    this_proposer_id = proposer_id;
-    LOG(VRB, ("Proposer %d starting...\n", this_proposer_id));
+        return NULL;
+    }
     
-    //Starts a learner with a custom init function
-    if (learner_init(pro_deliver_callback, init_proposer) != 0) {
-        printf("Could not start the learner!\n");
-        return -1;
+    if(group < 0 || group >= paxos_conf.groups) {
+        printf("Invalid group:%d\n", group);
+        return NULL;
+    }
+    
+    paxos_proposer * p = PAX_MALLOC(sizeof(paxos_proposer));
+    memset(p, 0, sizeof(paxos_proposer));
+    p->eb = eb;
+    p->group = group;
+    p->proposer_id = proposer_id;
+    p->current_iid = 1;
+    p->current_leader_id = 0;
+    p->first_ballot = MAX_N_OF_PROPOSERS + p->proposer_id;
+    LOG(VRB, ("Proposer %d starting...\n", p->proposer_id));
+    
+    if(init_proposer(p) != 0) {
+        proposer_free(p);
+        return NULL;
     }
 
     LOG(VRB, ("Proposer is ready\n"));
-    return 0;
+    return p;
+}
+
+void proposer_free(paxos_proposer * p) {
+    iid_t i;
+    
+    //Values still assigned to instances go back to the values handler
+    if(p->vh != NULL && LEADER_IS_ME(p)) {
+        leader_shutdown(p);
+    }
+    if(p->learner != NULL) {
+        learner_free(p->learner);
+    }
+    event_del(&p->proposer_msg_event);
+    event_del(&p->oracle_msg_event);
+    event_del(&p->fe_ping_event);
+    if(p->for_proposer != NULL) {
+        udp_receiver_destroy(p->for_proposer);
+    }
+    if(p->from_oracle != NULL) {
+        udp_receiver_destroy(p->from_oracle);
+    }
+    if(p->to_acceptors != NULL) {
+        udp_sendbuf_destroy(p->to_acceptors);
+    }
+    if(p->to_oracle != NULL) {
+        udp_sendbuf_destroy(p->to_oracle);
+    }
+    if(p->state != NULL) {
+        for(i = 0; i < (iid_t)paxos_conf.proposer_array_size; i++) {
+            pro_clear_instance_info(p, &p->state[i]);
+        }
+        PAX_FREE(p->state);
+    }
+    if(p->t_wheel.slots != NULL) {
+        PAX_FREE(p->t_wheel.slots);
+    }
+    if(p->vh != NULL) {
+        vh_free(p->vh);
+    }
+    PAX_FREE(p);
+}
+
+int proposer_submit_sharedmem(paxos_proposer * p, char* value, size_t val_size) {
+    return vh_enqueue_value(p->vh, 0, 0, value, val_size);
+}
+
+int proposer_init(int proposer_id) {
+    return proposer_init_cif(proposer_id, NULL);
 }
 
 int proposer_init_cif(int proposer_id, custom_init_function cif) {
-    client_custom_init = cif;
-    return proposer_init(proposer_id);
+    pro_legacy_args pa = {proposer_id, cif};
+    return paxos_thread_start(init_pro_legacy, &pa);
+}
+
+int proposer_read_point(paxos_proposer * p, iid_t * iid) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    
+    if(__atomic_load_n(&p->lease_expiry, __ATOMIC_ACQUIRE) <= 
+        (int64_t)now.tv_sec * 1000000 + now.tv_usec) {
+        return -1;
+    }
+    *iid = __atomic_load_n(&p->lease_read_point, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+int pax_read_point(iid_t * iid) {
+    if(default_proposer == NULL) {
+        return -1;
+    }
+    return proposer_read_point(default_proposer, iid);
+}
+
+int pax_submit_sharedmem(char* value, size_t val_size) {
+    if(default_proposer == NULL) {
+        return PAXOS_SUBMIT_REJECTED;
+    }
+    return proposer_submit_sharedmem(default_proposer, value, val_size);
 }
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "evutil.h"
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+#include "paxos_udp.h"
+#include "clients_handler.h"
+
+/*
+    The leader keeps the address of each client that submitted a
+    tagged value (client_id != 0), so that the outcome can be unicast
+    back to it. Clients are stored in an open addressing hash table,
+    if the probed slots are all taken the home slot is overwritten.
+    The leader also tracks the next sequence number expected from 
+    each client: values received out of order are held back in a
+    small per-client buffer, indexed by sequence number.
+    Values older than the next expected one may have been skipped
+    or rejected (queue full) rather than enqueued, they are enqueued 
+    again and the learners deliver them once (see lea_dedup_check).
+    The table is kept also when the proposer is not the leader 
+    (hot standby): it registers the clients that submit and tracks 
+    the last value delivered for each, so that once promoted it
+    starts from the next one.
+*/
+typedef struct client_record_t {
+    unsigned int        client_id;
+    struct sockaddr_in  addr;
+    //Next value to enqueue, 0 if nothing was received yet
+    unsigned int        next_seqno;
+    //Last value delivered, 0 if none
+    unsigned int        delivered_seqno;
+    int                 held_count;
+    //When the oldest gap was first seen
+    struct timeval      held_since;
+    vh_value_wrapper *  held[LEADER_CLIENT_REORDER_SIZE];
+} client_record;
+
+//The clients handler of a proposer
+struct ch_state_t {
+    vh_state *          vh;
+    int                 group;
+    
+    //LEADER_CLIENTS_TABLE_SIZE records
+    client_record *     clients_table;
+
+    //Total number of values held, in all clients
+    int                 held_values;
+
+    //UDP socket manager for sending replies, the destination
+    // address is set for each message
+    udp_send_buffer *   to_clients;
+};
+#define GET_CLIENT_SLOT(CH, I) (&(CH)->clients_table[((I) & (LEADER_CLIENTS_TABLE_SIZE-1))])
+#define CLIENTS_TABLE_BYTES (sizeof(client_record) * LEADER_CLIENTS_TABLE_SIZE)
+#define CLIENT_PROBES 8
+#define GET_HELD_SLOT(C, S) (&(C)->held[((S) & (LEADER_CLIENT_REORDER_SIZE-1))])
+
+//Returns the record for the given client, NULL if unknown
+static client_record *
+ch_lookup(ch_state * ch, unsigned int client_id) {
+    unsigned int i;
+    client_record * cr;
+    
+    for(i = 0; i < CLIENT_PROBES; i++) {
+        cr = GET_CLIENT_SLOT(ch, client_id + i);
+        if(cr->client_id == client_id) {
+            return cr;
+        }
+        if(cr->client_id == 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+//Enqueues a value in the leader pending queue, 
+// notifies the client if the queue is full
+static void
+ch_enqueue(ch_state * ch, vh_value_wrapper * vw) {
+    if(vh_enqueue_wrapper(ch->vh, vw) == PAXOS_SUBMIT_REJECTED) {
+        ch_notify(ch, vw->client_id, vw->seqno, 0, PAXOS_SUBMIT_REJECTED);
+        PAX_FREE(vw);
+    }
+}
+
+//Enqueues the held values that are next in sequence
+static void
+ch_release_in_order(ch_state * ch, client_record * cr) {
+    vh_value_wrapper ** slot = GET_HELD_SLOT(cr, cr->next_seqno);
+    
+    while(*slot != NULL) {
+        ch_enqueue(ch, *slot);
+        *slot = NULL;
+        cr->held_count -= 1;
+        ch->held_values -= 1;
+        cr->next_seqno += 1;
+        slot = GET_HELD_SLOT(cr, cr->next_seqno);
+    }
+    
+    //Start timing the gap before the held values
+    if(cr->held_count == 0) {
+        evutil_timerclear(&cr->held_since);
+    } else if(!evutil_timerisset(&cr->held_since)) {
+        gettimeofday(&cr->held_since, NULL);
+    }
+}
+
+//Gives up waiting for the values before new_next, 
+// the held ones are enqueued
+static void
+ch_skip_gap(ch_state * ch, client_record * cr, unsigned int new_next) {
+    vh_value_wrapper ** slot;
+    
+    LOG(VRB, ("Client %u: skipping values %u to %u\n", 
+        cr->client_id, cr->next_seqno, new_next));
+    while(cr->next_seqno != new_next) {
+        slot = GET_HELD_SLOT(cr, cr->next_seqno);
+        if(*slot != NULL) {
+            ch_enqueue(ch, *slot);
+            *slot = NULL;
+            cr->held_count -= 1;
+            ch->held_values -= 1;
+        }
+        cr->next_seqno += 1;
+    }
+    evutil_timerclear(&cr->held_since);
+    ch_release_in_order(ch, cr);
+}
+
+//Drops the held values of a client (when it's evicted or at shutdown)
+static void
+ch_drop_held(ch_state * ch, client_record * cr) {
+    int i;
+    for(i = 0; i < LEADER_CLIENT_REORDER_SIZE; i++) {
+        if(cr->held[i] != NULL) {
+            vh_notify_client(ch->vh, PAXOS_SUBMIT_FAILED, 0, cr->held[i]);
+            PAX_FREE(cr->held[i]);
+            cr->held[i] = NULL;
+            ch->held_values -= 1;
+        }
+    }
+    cr->held_count = 0;
+}
+
+ch_state *
+ch_new(vh_state * vh, int group) {
+    if ((LEADER_CLIENTS_TABLE_SIZE & (LEADER_CLIENTS_TABLE_SIZE -1)) != 0) {
+        printf("Error: LEADER_CLIENTS_TABLE_SIZE is not a power of 2\n");
+        return NULL;
+    }
+    if ((LEADER_CLIENT_REORDER_SIZE & (LEADER_CLIENT_REORDER_SIZE -1)) != 0) {
+        printf("Error: LEADER_CLIENT_REORDER_SIZE is not a power of 2\n");
+        return NULL;
+    }
+    
+    ch_state * ch = PAX_MALLOC(sizeof(ch_state));
+    ch->vh = vh;
+    ch->group = group;
+    ch->clients_table = PAX_MALLOC(CLIENTS_TABLE_BYTES);
+    memset(ch->clients_table, 0, CLIENTS_TABLE_BYTES);
+    ch->held_values = 0;
+    ch->to_clients = NULL;
+    return ch;
+}
+
+void
+ch_free(ch_state * ch) {
+    ch_shutdown(ch);
+    if(ch->to_clients != NULL) {
+        udp_sendbuf_destroy(ch->to_clients);
+    }
+    PAX_FREE(ch->clients_table);
+    PAX_FREE(ch);
+}
+
+int
+ch_init(ch_state * ch) {
+    unsigned int i;
+    client_record * cr;
+    
+    //Clients registered as standby, sequenced after the last delivered
+    for(i = 0; i < LEADER_CLIENTS_TABLE_SIZE; i++) {
+        cr = &ch->clients_table[i];
+        cr->next_seqno = (cr->delivered_seqno == 0 ? 0 : cr->delivered_seqno + 1);
+    }
+    
+    //Created once, reused when leadership is acquired again
+    if(ch->to_clients == NULL) {
+        ch->to_clients = udp_sendbuf_new(CONF_NET_GROUP(submit_net, ch->group));
+        if(ch->to_clients == NULL) {
+            printf("Error creating leader->clients network sender\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+ch_shutdown(ch_state * ch) {
+    unsigned int i;
+    for(i = 0; i < LEADER_CLIENTS_TABLE_SIZE && ch->held_values > 0; i++) {
+        ch_drop_held(ch, &ch->clients_table[i]);
+    }
+    //Addresses and delivered values are kept for the next leadership
+    for(i = 0; i < LEADER_CLIENTS_TABLE_SIZE; i++) {
+        ch->clients_table[i].next_seqno = 0;
+        evutil_timerclear(&ch->clients_table[i].held_since);
+    }
+}
+
+//A value of the client was delivered
+void
+ch_delivered(ch_state * ch, unsigned int client_id, unsigned int seqno) {
+    if(client_id == 0 || client_id == MEMBERSHIP_CLIENT_ID) {
+        return;
+    }
+    client_record * cr = ch_lookup(ch, client_id);
+    if(cr == NULL) {
+        return;
+    }
+    if(cr->delivered_seqno == 0 || (int)(seqno - cr->delivered_seqno) > 0) {
+        cr->delivered_seqno = seqno;
+    }
+}
+
+//Returns 1 if the value (or a later one of the same client) was delivered
+int
+ch_is_delivered(ch_state * ch, vh_value_wrapper * vw) {
+    if(vw->client_id == 0 || vw->client_id == MEMBERSHIP_CLIENT_ID) {
+        return 0;
+    }
+    client_record * cr = ch_lookup(ch, vw->client_id);
+    if(cr == NULL || cr->delivered_seqno == 0) {
+        return 0;
+    }
+    return ((int)(vw->seqno - cr->delivered_seqno) <= 0);
+}
+
+//Saves (or updates) the address of a client
+void
+ch_register(ch_state * ch, unsigned int client_id, struct sockaddr_in * addr) {
+    unsigned int i;
+    client_record * cr;
+    
+    //Anonymous client (or membership change), cannot be notified
+    if(client_id == 0 || client_id == MEMBERSHIP_CLIENT_ID) {
+        return;
+    }
+    
+    for(i = 0; i < CLIENT_PROBES; i++) {
+        cr = GET_CLIENT_SLOT(ch, client_id + i);
+        if(cr->client_id == client_id || cr->client_id == 0) {
+            break;
+        }
+    }
+    
+    //Table region is full, evict
+    if(i == CLIENT_PROBES) {
+        cr = GET_CLIENT_SLOT(ch, client_id);
+        LOG(VRB, ("Client %u evicted by client %u\n", cr->client_id, client_id));
+        ch_drop_held(ch, cr);
+        memset(cr, 0, sizeof(client_record));
+    }
+    
+    cr->client_id = client_id;
+    cr->addr = *addr;
+}
+
+//Enqueues the value if it's the next in sequence for its client,
+// otherwise holds it back. Older values are enqueued out of sequence.
+// The client must be registered already
+void
+ch_submit(ch_state * ch, vh_value_wrapper * vw) {
+    client_record * cr = NULL;
+    
+    //Anonymous clients and membership changes are not sequenced
+    if(vw->client_id != 0 && vw->client_id != MEMBERSHIP_CLIENT_ID) {
+        cr = ch_lookup(ch, vw->client_id);
+    }
+    if(cr == NULL) {
+        ch_enqueue(ch, vw);
+        return;
+    }
+    
+    //First value seen from this client (or since the leader changed)
+    if(cr->next_seqno == 0) {
+        cr->next_seqno = vw->seqno;
+    }
+
+    int distance = (int)(vw->seqno - cr->next_seqno);
+    
+    //Retransmission: it was skipped, rejected or it's a duplicate,
+    // the leader does not know. Learners drop duplicates
+    // and the client gets the reply of the new instance
+    if(distance < 0) {
+        LOG(DBG, ("Client %u: value %u resubmitted\n", 
+            vw->client_id, vw->seqno));
+        ch_enqueue(ch, vw);
+        return;
+    }
+    
+    //Does not fit in the buffer, the missing values are 
+    // probably lost: make space
+    if(distance >= LEADER_CLIENT_REORDER_SIZE) {
+        ch_skip_gap(ch, cr, vw->seqno - LEADER_CLIENT_REORDER_SIZE + 1);
+    }
+    
+    //Held already, the client gets the reply of the held one
+    vh_value_wrapper ** slot = GET_HELD_SLOT(cr, vw->seqno);
+    if(*slot != NULL) {
+        LOG(DBG, ("Client %u: duplicate value %u dropped\n", 
+            vw->client_id, vw->seqno));
+        PAX_FREE(vw);
+        return;
+    }
+    *slot = vw;
+    cr->held_count += 1;
+    ch->held_values += 1;
+    
+    ch_release_in_order(ch, cr);
+}
+
+//Gives up waiting for values missing since more than 
+// leader_client_reorder_timeout, invoked periodically by the leader
+void
+ch_check_held(ch_state * ch) {
+    unsigned int i;
+    long int elapsed;
+    client_record * cr;
+    struct timeval time_now;
+    
+    if(ch->held_values == 0) {
+        return;
+    }
+    
+    gettimeofday(&time_now, NULL);
+    for(i = 0; i < LEADER_CLIENTS_TABLE_SIZE; i++) {
+        cr = &ch->clients_table[i];
+        if(cr->held_count == 0) {
+            continue;
+        }
+        
+        elapsed = (time_now.tv_sec - cr->held_since.tv_sec) * 1000000 + 
+            (time_now.tv_usec - cr->held_since.tv_usec);
+        if(elapsed < paxos_conf.leader_client_reorder_timeout) {
+            continue;
+        }
+        
+        //Skip to the first value held
+        unsigned int next = cr->next_seqno;
+        while(*GET_HELD_SLOT(cr, next) == NULL) {
+            next++;
+        }
+        ch_skip_gap(ch, cr, next);
+    }
+}
+
+//Sends the outcome of a submitted value to the client (if known)
+void
+ch_notify(ch_state * ch, unsigned int client_id, unsigned int seqno, iid_t iid, int result) {
+    if(client_id == 0 || client_id == MEMBERSHIP_CLIENT_ID) {
+        return;
+    }
+    
+    client_record * cr = ch_lookup(ch, client_id);
+    if(cr == NULL) {
+        LOG(DBG, ("Cannot notify unknown client %u\n", client_id));
+        return;
+    }
+    
+    sendbuf_send_submit_reply(ch->to_clients, &cr->addr, 
+        client_id, seqno, iid, result);
+}
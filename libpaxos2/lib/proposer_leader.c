@@ -1,55 +1,92 @@
-struct event p1_check_event;
-struct timeval p1_check_interval;
+/*
+    Instances waiting for a deadline (p1_pending or p2_pending) are kept
+    in a hashed timer wheel: a circular array of lists indexed by deadline 
+    tick, where a tick lasts p2_check_interval. Each periodic check only 
+    visits the slots for the ticks elapsed since the previous check,
+    instead of scanning the whole window of open instances.
+    The wheel spans the longest timeout (see init_pro_structs), so the
+    deadlines in a visited slot are all expired.
+*/
+#define TW_SLOT(P, T) (&(P)->t_wheel.slots[((T) & ((P)->t_wheel.size-1))])
 
-struct event p2_check_event;
-struct timeval p2_check_interval;
+#ifdef PAXOS_FAST_MODE
+//See the Fast Paxos section below
+static void leader_fast_clear_values(p_inst_info * ii);
+#endif
 
 
-#ifndef LEADER_EVENTS_UPDATE_INTERVAL
-//Leader events display is disabled
-static void empty_fun() {};
-#define COUNT_EVENT(E) empty_fun()
-#else
-//Leader events display is enabled
-struct leader_event_counters {
-    long unsigned int p1_timeout;
-    long unsigned int p2_timeout;
-    long unsigned int p2_waits_p1;
-};
-struct leader_event_counters lead_counters;
-struct event print_events_event;
-struct timeval print_events_interval;
-#define COUNT_EVENT(E) (lead_counters.E += 1)
-static void clear_event_counters() {
-    lead_counters.p1_timeout = 0;    
-    lead_counters.p2_timeout = 0;
-    lead_counters.p2_waits_p1 = 0;
+//Exported metrics (see struct leader_event_counters)
+#define COUNT_EVENT(E) METRIC_INC(p->counters.E)
+
+//Registered once, when the proposer is created,
+// labeled with its group and id
+static void register_event_counters(paxos_proposer * p) {
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    struct leader_event_counters * c = &p->counters;
+    
+    snprintf(label, sizeof(label), "group=\"%d\",proposer=\"%d\"", 
+        p->group, p->proposer_id);
+    c->p1_timeout = metrics_register_label("leader_p1_timeout", label, metric_counter);
+    c->p2_timeout = metrics_register_label("leader_p2_timeout", label, metric_counter);
+    c->p2_waits_p1 = metrics_register_label("leader_p2_waits_p1", label, metric_counter);
+    c->p2_window_decrease = metrics_register_label("leader_p2_window_decrease", label, metric_counter);
+    c->fast_recovery = metrics_register_label("leader_fast_recovery", label, metric_counter);
+    c->revoked = metrics_register_label("leader_revoked", label, metric_counter);
+    c->p2_noop = metrics_register_label("leader_p2_noop", label, metric_counter);
+    c->p1_latency = metrics_register_label("leader_p1_latency_us", label, metric_histogram);
+    c->p2_latency = metrics_register_label("leader_p2_latency_us", label, metric_histogram);
+    c->p2_window = metrics_register_label("leader_p2_window", label, metric_gauge);
+    c->p2_open = metrics_register_label("leader_p2_open", label, metric_gauge);
+    c->p1_ready = metrics_register_label("leader_p1_ready", label, metric_gauge);
+    c->pending_values = metrics_register_label("leader_pending_values", label, metric_gauge);
+    c->dropped_values = metrics_register_label("leader_dropped_values", label, metric_gauge);
 }
 
+//Gauges are sampled at each periodic check
+static void update_event_gauges(paxos_proposer * p) {
+    METRIC_SET(p->counters.p2_window, p->p2_info.window);
+    METRIC_SET(p->counters.p2_open, p->p2_info.open_count);
+    METRIC_SET(p->counters.p1_ready, p->p1_info.ready_count);
+    METRIC_SET(p->counters.pending_values, vh_pending_list_size(p->vh));
+    METRIC_SET(p->counters.dropped_values, vh_get_dropped_count(p->vh));
+}
+
+#ifdef LEADER_EVENTS_UPDATE_INTERVAL
+//Leader events display is enabled
 static void 
 leader_print_event_counters(int fd, short event, void *arg) {
     UNUSED_ARG(fd);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    paxos_proposer * p = arg;
     printf("-----------------------------------------------\n");
-    printf("current_iid:%u\n", current_iid);
+    printf("current_iid:%"IID_FMT"\n", p->current_iid);
     printf("Phase 1_____________________:\n");
-    printf("p1_timeout:%lu\n", lead_counters.p1_timeout);
-    printf("p1_info.pending_count:%u\n", p1_info.pending_count);
-    printf("p1_info.ready_count:%u\n", p1_info.ready_count);
-    printf("p1_info.highest_open:%u\n", p1_info.highest_open);
+    printf("p1_timeout:%ld\n", p->counters.p1_timeout->value);
+    printf("p1_info.pending_count:%u\n", p->p1_info.pending_count);
+    printf("p1_info.ready_count:%u\n", p->p1_info.ready_count);
+    printf("p1_info.highest_open:%"IID_FMT"\n", p->p1_info.highest_open);
+    printf("p1_rtt.srtt:%lu\n", p->p1_rtt.srtt);
+    printf("p1_rtt.timeout:%lu\n", p->p1_rtt.timeout);
     printf("Phase 2_____________________:\n");    
-    printf("p2_timeout:%lu\n", lead_counters.p2_timeout);
-    printf("p2_waits_p1:%lu\n", lead_counters.p2_waits_p1);
-    printf("p2_info.open_count:%u\n", p2_info.open_count);
-    printf("p2_info.next_unused_iid:%u\n", p2_info.next_unused_iid);
+    printf("p2_timeout:%ld\n", p->counters.p2_timeout->value);
+    printf("p2_waits_p1:%ld\n", p->counters.p2_waits_p1->value);
+    printf("p2_info.open_count:%u\n", p->p2_info.open_count);
+    printf("p2_info.next_unused_iid:%"IID_FMT"\n", p->p2_info.next_unused_iid);
+    printf("p2_info.window:%u\n", p->p2_info.window);
+    printf("p2_rtt.srtt:%lu\n", p->p2_rtt.srtt);
+    printf("p2_rtt.timeout:%lu\n", p->p2_rtt.timeout);
+    printf("p2_info.min_latency:%lu\n", p->p2_info.min_latency);
+    printf("p2_window_decrease:%ld\n", p->counters.p2_window_decrease->value);
+    printf("fast_recovery:%ld\n", p->counters.fast_recovery->value);
+    printf("revoked:%ld\n", p->counters.revoked->value);
     printf("Misc._______________________:\n");
-    printf("dropped_count:%lu\n", vh_get_dropped_count());
+    printf("dropped_count:%lu\n", vh_get_dropped_count(p->vh));
+    printf("timers_armed:%u\n", p->t_wheel.count);
     printf("-----------------------------------------------\n");
     
     //Keep printing if the current leader is still this proposer
     int ret;
-    ret = event_add(&print_events_event, &print_events_interval);
+    ret = event_add(&p->print_events_event, &p->print_events_interval);
     assert(ret == 0);
 
 }
@@ -61,8 +98,154 @@ leader_print_event_counters(int fd, short event, void *arg) {
 // Timing routines
 /*-------------------------------------------------------------------------*/
 
+//Microseconds elapsed from t to now
+static long unsigned int
+leader_usecs_since(struct timeval * t, struct timeval * now) {
+    return ((now->tv_sec - t->tv_sec) * 1000000) + 
+        (now->tv_usec - t->tv_usec);
+}
+
+static void
+leader_rtt_init(struct rtt_estimator * est, long unsigned int initial,
+    long unsigned int min, long unsigned int max) {
+    est->srtt = 0;
+    est->rttvar = 0;
+    est->timeout = initial;
+    est->min_timeout = min;
+    est->max_timeout = max;
+}
+
+static void
+leader_rtt_set_timeout(struct rtt_estimator * est, long unsigned int timeout) {
+    if(timeout < est->min_timeout) {
+        timeout = est->min_timeout;
+    } else if(timeout > est->max_timeout) {
+        timeout = est->max_timeout;
+    }
+    est->timeout = timeout;
+}
+
+//Updates the estimator with a new measurement:
+// srtt = 7/8 srtt + 1/8 sample, rttvar = 3/4 rttvar + 1/4 |srtt - sample|
+static void
+leader_rtt_sample(struct rtt_estimator * est, long unsigned int sample) {
+    if(est->srtt == 0) {
+        //First measurement
+        est->srtt = sample;
+        est->rttvar = sample / 2;
+    } else {
+        long unsigned int delta = (est->srtt > sample) ? 
+            (est->srtt - sample) : (sample - est->srtt);
+        est->rttvar = ((3 * est->rttvar) + delta) / 4;
+        est->srtt = ((7 * est->srtt) + sample) / 8;
+    }
+    leader_rtt_set_timeout(est, est->srtt + (4 * est->rttvar));
+}
+
+//Phase 1 completed for an instance opened by this leader
+static void
+leader_p1_latency_sample(paxos_proposer * p, long unsigned int latency) {
+    leader_rtt_sample(&p->p1_rtt, latency);
+    metrics_observe(p->counters.p1_latency, latency);
+}
+
+//Some instance expired, back off until the next measurement
+static void
+leader_rtt_backoff(struct rtt_estimator * est) {
+    leader_rtt_set_timeout(est, est->timeout * 2);
+}
+
+static int
+leader_is_expired(struct timeval * deadline, struct timeval * time_now) {
+    return (deadline->tv_sec < time_now->tv_sec ||
+            (deadline->tv_sec == time_now->tv_sec &&
+            deadline->tv_usec < time_now->tv_usec));
+}
+
+
+static uint64_t
+leader_timer_tick(struct timeval * tv) {
+    uint64_t usecs = ((uint64_t)tv->tv_sec * 1000000) + tv->tv_usec;
+    return usecs / paxos_conf.p2_check_interval;
+}
+
+//Removes the instance from the wheel, if it's there
+static void
+leader_timer_cancel(paxos_proposer * p, p_inst_info * ii) {
+    if(ii->tw_pprev == NULL) {
+        return;
+    }
+    *ii->tw_pprev = ii->tw_next;
+    if(ii->tw_next != NULL) {
+        ii->tw_next->tw_pprev = ii->tw_pprev;
+    }
+    ii->tw_next = NULL;
+    ii->tw_pprev = NULL;
+    p->t_wheel.count -= 1;
+}
+
+//Adds the instance to the slot corresponding to its deadline
+static void
+leader_timer_insert(paxos_proposer * p, p_inst_info * ii) {
+    uint64_t tick = leader_timer_tick(&ii->timeout);
+    
+    //Slots up to last_tick were already visited
+    if(tick <= p->t_wheel.last_tick) {
+        tick = p->t_wheel.last_tick + 1;
+    }
+    
+    p_inst_info ** head = TW_SLOT(p, tick);
+    ii->tw_next = *head;
+    ii->tw_pprev = head;
+    if(*head != NULL) {
+        (*head)->tw_pprev = &ii->tw_next;
+    }
+    *head = ii;
+    p->t_wheel.count += 1;
+}
+
+//Removes from the wheel all the instances expired at time_now, 
+// returns them as a list linked trough tw_next
+static p_inst_info *
+leader_timer_collect_expired(paxos_proposer * p, struct timeval * time_now) {
+    p_inst_info * expired = NULL;
+    p_inst_info * ii, * next;
+    
+    //Only ticks entirely in the past are visited, 
+    // all deadlines in their slots (for this round) are expired
+    uint64_t now_tick = leader_timer_tick(time_now) - 1;
+    if(now_tick <= p->t_wheel.last_tick) {
+        return NULL;
+    }
+    
+    //If too much time elapsed, visit each slot once
+    uint64_t tick = p->t_wheel.last_tick + 1;
+    if(now_tick - p->t_wheel.last_tick > p->t_wheel.size) {
+        tick = now_tick - p->t_wheel.size + 1;
+    }
+    p->t_wheel.last_tick = now_tick;
+    
+    for(; tick <= now_tick && p->t_wheel.count > 0; tick++) {
+        ii = *TW_SLOT(p, tick);
+        while(ii != NULL) {
+            next = ii->tw_next;
+            //Not expired means it belongs to some later round, skip
+            if(leader_is_expired(&ii->timeout, time_now)) {
+                leader_timer_cancel(p, ii);
+                ii->tw_next = expired;
+                expired = ii;
+            }
+            ii = next;
+        }
+    }
+    return expired;
+}
+
+//Sets the deadline for the instance to now+usec_interval
+// and (re)schedules it in the timer wheel. 
+// Also saves the send time for round trip measurement
 static void
-leader_set_expiration(p_inst_info * ii, unsigned int usec_interval) {
+leader_set_expiration(paxos_proposer * p, p_inst_info * ii, unsigned int usec_interval) {
     struct timeval current_time;
     gettimeofday(&current_time, NULL);
 
@@ -77,130 +260,105 @@ leader_set_expiration(p_inst_info * ii, unsigned int usec_interval) {
     usec_sum = current_time.tv_usec + (usec_interval % a_second);
     
     //If sum of mircosecs exceeds 10d6, add another second
-    if(usec_sum > a_second) {
+    if(usec_sum >= a_second) {
         deadline->tv_sec += 1; 
     }
 
     //Set microseconds
     deadline->tv_usec = (usec_sum % a_second);
-}
-
-static int
-leader_is_expired(struct timeval * deadline, struct timeval * time_now) {
-    return (deadline->tv_sec < time_now->tv_sec ||
-            (deadline->tv_sec == time_now->tv_sec &&
-            deadline->tv_usec < time_now->tv_usec));
+    
+    ii->sent = current_time;
+    leader_timer_cancel(p, ii);
+    leader_timer_insert(p, ii);
 }
 
 /*-------------------------------------------------------------------------*/
 // Phase 1 routines
 /*-------------------------------------------------------------------------*/
 
+//Phase 1 of this instance expired, 
+// increment ballot and re-send prepare_req
 static void
-leader_check_p1_pending() {
-    iid_t iid_iterator;
-    p_inst_info * ii;
+leader_p1_expired(paxos_proposer * p, p_inst_info * ii) {
+    LOG(DBG, ("Phase 1 of instance %"IID_FMT" expired!\n", ii->iid));
 
-    //Create an empty prepare batch in send buffer
-    sendbuf_clear(to_acceptors, prepare_reqs, this_proposer_id);
-    LOG(DBG, ("Checking pending phase 1 from %u to %u\n",
-        current_iid, p1_info.highest_open));
-    
-    //Get current time for checking expired    
-    struct timeval time_now;
-    gettimeofday(&time_now, NULL);
+    //Reset fields used for previous phase 1
+    ii->promises_bitvector = 0;
+    ii->promises_count = 0;
+    ii->p1_value_ballot = 0;
+    if(ii->p1_value != NULL) {
+        PAX_FREE(ii->p1_value);
+    }
+    ii->p1_value = NULL;
+#ifdef PAXOS_FAST_MODE
+    leader_fast_clear_values(ii);
+#endif
     
-    for(iid_iterator = current_iid; 
-        iid_iterator <= p1_info.highest_open; iid_iterator++) {
-
-        //Get instance from state array
-        ii = GET_PRO_INSTANCE(iid_iterator);
-        assert(ii->iid == iid_iterator);
-        
-        //Still pending -> it's expired
-        if(ii->status == p1_pending && leader_is_expired(&ii->timeout, &time_now)) {
-            LOG(DBG, ("Phase 1 of instance %u expired!\n", ii->iid));
+    //Ballot is incremented
+    ii->my_ballot = NEXT_BALLOT(ii->my_ballot);
 
-            //Reset fields used for previous phase 1
-            ii->promises_bitvector = 0;
-            ii->promises_count = 0;
-            ii->p1_value_ballot = 0;
-            if(ii->p1_value != NULL) {
-                PAX_FREE(ii->p1_value);
-            }
-            ii->p1_value = NULL;
-            
-            //Ballot is incremented
-            ii->my_ballot = NEXT_BALLOT(ii->my_ballot);
-
-
-            //Send prepare to acceptors
-            sendbuf_add_prepare_req(to_acceptors, ii->iid, ii->my_ballot);        
-            leader_set_expiration(ii, P1_TIMEOUT_INTERVAL);
-            
-            COUNT_EVENT(p1_timeout);
-        }
-    }    
-
-    //Send if something is still there
-    sendbuf_flush(to_acceptors);
+    //Send prepare to acceptors
+    sendbuf_add_prepare_req(p->to_acceptors, ii->iid, ii->my_ballot);        
+    leader_set_expiration(p, ii, p->p1_rtt.timeout);
+    
+    COUNT_EVENT(p1_timeout);
 }
 
 //Opens instances at the "end" of the proposer state array 
 //Those instances were not opened before
 static void
-leader_open_instances_p1() {
-    int active_count = p1_info.pending_count + p1_info.ready_count;
+leader_open_instances_p1(paxos_proposer * p) {
+    int active_count = p->p1_info.pending_count + p->p1_info.ready_count;
     
     assert(active_count >= 0);
     
-    if(active_count >= (PROPOSER_PREEXEC_WIN_SIZE/2)) {
+    if(active_count >= (paxos_conf.preexec_win_size/2)) {
         //More than half are active/pending
         // Wait before opening more
         return;
     }
     
     //Create an empty prepare batch in send buffer
-    sendbuf_clear(to_acceptors, prepare_reqs, this_proposer_id);
+    sendbuf_clear(p->to_acceptors, prepare_reqs, p->proposer_id);
     
     //How many new instances to open now
-    unsigned int to_open = PROPOSER_PREEXEC_WIN_SIZE - active_count;
-    assert(to_open >= (PROPOSER_PREEXEC_WIN_SIZE/2));
+    unsigned int to_open = paxos_conf.preexec_win_size - active_count;
+    assert(to_open >= (unsigned int)(paxos_conf.preexec_win_size/2));
 
     iid_t i, curr_iid;
     p_inst_info * ii;
     for(i = 1; i <= to_open; i++) {
         //Get instance from state array
-        curr_iid = i + p1_info.highest_open; 
-        ii = GET_PRO_INSTANCE(curr_iid);
+        curr_iid = p->p1_info.highest_open + (i * IID_STEP); 
+        ii = GET_PRO_INSTANCE(p, curr_iid);
         assert(ii->status == empty);
         
         //Create initial record
         ii->iid = curr_iid;
         ii->status = p1_pending;
-        ii->my_ballot = FIRST_BALLOT;
+        ii->my_ballot = FIRST_BALLOT(p);
         //Send prepare to acceptors
-        sendbuf_add_prepare_req(to_acceptors, ii->iid, ii->my_ballot);
-        leader_set_expiration(ii, P1_TIMEOUT_INTERVAL);       
+        sendbuf_add_prepare_req(p->to_acceptors, ii->iid, ii->my_ballot);
+        leader_set_expiration(p, ii, p->p1_rtt.timeout);       
     }
 
     //Send if something is still there
-    sendbuf_flush(to_acceptors);
+    sendbuf_flush(p->to_acceptors);
     
     //Keep track of pending count
-    p1_info.pending_count += to_open;
+    p->p1_info.pending_count += to_open;
 
     //Set new higher bound for checking
-    p1_info.highest_open += to_open; 
+    p->p1_info.highest_open += (to_open * IID_STEP); 
     
     LOG(DBG, ("Opened %d new instances\n", to_open));
 
     
 }
 
-static void leader_set_next_p1_check() {
+static void leader_set_next_p1_check(paxos_proposer * p) {
     int ret;
-    ret = event_add(&p1_check_event, &p1_check_interval);
+    ret = event_add(&p->p1_check_event, &p->p1_check_interval);
     assert(ret == 0);
 }
 
@@ -212,36 +370,140 @@ leader_periodic_p1_check(int fd, short event, void *arg)
 {
     UNUSED_ARG(fd);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
-    
-    //All instances in status p1_pending are expired
-    // increment ballot and re-send prepare_req
-    leader_check_p1_pending();
+    paxos_proposer * p = arg;
     
     //Try to open new instances if some were used
-    leader_open_instances_p1();
+    leader_open_instances_p1(p);
     
     //Set next check timeout for calling this function
-    leader_set_next_p1_check();
+    leader_set_next_p1_check(p);
     
 }
 
 /*-------------------------------------------------------------------------*/
 // Phase 2 routines
 /*-------------------------------------------------------------------------*/
-static void leader_set_next_p2_check() {
+static void leader_set_next_p2_check(paxos_proposer * p) {
     int ret;
-    ret = event_add(&p2_check_event, &p2_check_interval);
+    ret = event_add(&p->p2_check_event, &p->p2_check_interval);
     assert(ret == 0);
 }
 
+//An instance opened by this leader was closed with its value.
+// The window grows by one every 'window' instances closed, 
+// unless the latency shows that some queue is building up.
+// Latency is measured up to the close, not the delivery, 
+// which may wait for some earlier hole
+static void
+leader_window_on_close(paxos_proposer * p, p_inst_info * ii) {
+    struct timeval closed_at;
+    if(learner_closed_time(p->learner, ii->iid, &closed_at) != 0) {
+        gettimeofday(&closed_at, NULL);
+    }
+    long unsigned int latency = leader_usecs_since(&ii->sent, &closed_at);
+    leader_rtt_sample(&p->p2_rtt, latency);
+    metrics_observe(p->counters.p2_latency, latency);
+    
+    if(p->p2_info.min_latency == 0 || latency < p->p2_info.min_latency) {
+        p->p2_info.min_latency = latency;
+    }
+    
+    //Too slow, or window already at maximum
+    if(latency > (p->p2_info.min_latency * paxos_conf.p2_latency_factor) ||
+        p->p2_info.window >= (unsigned int)paxos_conf.p2_window_max) {
+        return;
+    }
+    
+    p->p2_info.window_acked += 1;
+    if(p->p2_info.window_acked >= p->p2_info.window) {
+        p->p2_info.window += 1;
+        p->p2_info.window_acked = 0;
+        LOG(DBG, ("Phase 2 window is now %u\n", p->p2_info.window));
+    }
+}
+
+//An instance opened by this leader was not closed in time.
+// The window is halved, but only once for all the instances 
+// that were already open when the previous decrease happened
+static void
+leader_window_on_loss(paxos_proposer * p, p_inst_info * ii) {
+    if(ii->iid < p->p2_info.recovery_iid) {
+        return;
+    }
+    
+    p->p2_info.window = p->p2_info.window / 2;
+    if(p->p2_info.window < (unsigned int)paxos_conf.p2_window_min) {
+        p->p2_info.window = paxos_conf.p2_window_min;
+    }
+    p->p2_info.window_acked = 0;
+    p->p2_info.recovery_iid = p->p2_info.next_unused_iid;
+    LOG(VRB, ("Phase 2 window reduced to %u\n", p->p2_info.window));
+    COUNT_EVENT(p2_window_decrease);
+}
+
+/*-------------------------------------------------------------------------*/
+// Leader lease (see PAXOS_LEADER_LEASE in config)
+/*-------------------------------------------------------------------------*/
+
+static int64_t
+leader_lease_usecs(struct timeval * t) {
+    return (int64_t)t->tv_sec * 1000000 + t->tv_usec;
+}
+
+//A quorum answered the requests sent at the given time, 
+// each of those acceptors granted the lease after that
+static void
+leader_lease_extend(paxos_proposer * p, struct timeval * sent) {
+    int64_t expiry;
+    
+    if(paxos_conf.leader_lease == 0) {
+        return;
+    }
+    expiry = leader_lease_usecs(sent) + paxos_conf.leader_lease - 
+        paxos_conf.leader_lease_margin;
+    if(expiry > p->lease_expiry) {
+        __atomic_store_n(&p->lease_expiry, expiry, __ATOMIC_RELEASE);
+    }
+}
+
+//Local reads wait for the instances opened by this leader and 
+// for the ones accepted before it was promoted
+static void
+leader_lease_update_read_point(paxos_proposer * p) {
+    iid_t read_point = p->p2_info.next_unused_iid - IID_STEP;
+    
+    if(p->highest_accepted_iid > read_point) {
+        read_point = p->highest_accepted_iid;
+    }
+    __atomic_store_n(&p->lease_read_point, read_point, __ATOMIC_RELEASE);
+}
+
+//An idle leader renews the lease with a no-op when half of it is left
+static void
+leader_lease_check(paxos_proposer * p) {
+    struct timeval now;
+    
+    if(paxos_conf.leader_lease == 0 || p->p2_info.open_count > 0) {
+        return;
+    }
+    gettimeofday(&now, NULL);
+    if(p->lease_expiry - leader_lease_usecs(&now) < paxos_conf.leader_lease / 2) {
+        p->lease_renew = 1;
+    }
+}
+
 static void
-leader_execute_p2(p_inst_info * ii) {
+leader_execute_p2(paxos_proposer * p, p_inst_info * ii) {
     
     if(ii->p1_value == NULL && ii->p2_value == NULL) {
         //Happens when p1 completes without value        
-        //Assign a p2_value and execute
-        ii->p2_value = vh_get_next_pending();
+        //Assign a batch of pending values and execute
+        ii->p2_value = vh_get_next_batch(p->vh);
+        //Nothing pending, but the instance must be filled 
+        // (hole, recovered fast round, or multi-leader), use a no-op
+        if(ii->p2_value == NULL) {
+            ii->p2_value = vh_empty_batch();
+        }
         assert(ii->p2_value != NULL);
         
     } else if (ii->p1_value != NULL) {
@@ -266,7 +528,7 @@ leader_execute_p2(p_inst_info * ii) {
         } else {
             // Different values
             // p2_value is pushed back to pending list
-            vh_push_back_value(ii->p2_value);
+            vh_push_back_value(p->vh, ii->p2_value);
             // Must execute p2 with p1 value
             ii->p2_value = ii->p1_value;
             ii->p1_value = NULL;
@@ -277,20 +539,20 @@ leader_execute_p2(p_inst_info * ii) {
     ii->status = p2_pending;
 
     //Send the accept request
-    sendbuf_add_accept_req(to_acceptors, ii->iid, ii->my_ballot, ii->p2_value->value, ii->p2_value->value_size);
+    sendbuf_add_accept_req(p->to_acceptors, ii->iid, ii->my_ballot, ii->p2_value->value, ii->p2_value->value_size);
     
     //Set the deadline for this instance
-    leader_set_expiration(ii, P2_TIMEOUT_INTERVAL);
+    leader_set_expiration(p, ii, p->p2_rtt.timeout);
 }
 
 // Scan trough p1_ready that have a value
 // assigned or found, execute phase2
 static void
-leader_open_instances_p2_expired() {
+leader_open_instances_p2_expired(paxos_proposer * p) {
     unsigned int count = 0;
     
     //Create a batch of accept requests
-    sendbuf_clear(to_acceptors, accept_reqs, this_proposer_id);
+    sendbuf_clear(p->to_acceptors, accept_reqs, p->proposer_id);
         
     //Start new phase 2 for all instances found in status p1_ready
     // if they are in the range below, phase2 timed-out and 
@@ -298,67 +560,341 @@ leader_open_instances_p2_expired() {
     iid_t iid;
     p_inst_info * ii;
     
-    for(iid = current_iid; iid < p2_info.next_unused_iid; iid++) {
+    for(iid = p->current_iid; iid < p->p2_info.next_unused_iid; iid++) {
     
-        ii = GET_PRO_INSTANCE(iid);
-        assert(ii->iid == iid);
+        ii = GET_PRO_INSTANCE(p, iid);
+        //Owned by some other leader (multi-leader mode)
+        if(ii->iid != iid) {
+            assert(IID_STEP > 1);
+            continue;
+        }
 
         //This instance is in status p1_ready but it's in the range
         // of previously opened phase2, it's now time to retry
         if(ii->status == p1_ready) {
-            assert(ii->p2_value != NULL || ii->p2_value != NULL);
-            leader_execute_p2(ii);
+            assert(ii->p1_value != NULL || ii->p2_value != NULL || 
+                ii->fast_any || ii->revoking);
+            leader_execute_p2(p, ii);
             //Count opened
             count += 1;
         }
     }
     
     //Count p1_ready that were consumed
-    p1_info.ready_count -= count;
+    p->p1_info.ready_count -= count;
     
     //Flush last accept_req batch
-    sendbuf_flush(to_acceptors);
+    sendbuf_flush(p->to_acceptors);
     
     LOG(DBG, ("Opened %u old (timed-out) instances\n", count));
     
 }
 
 
+/*-------------------------------------------------------------------------*/
+// Fast Paxos (see PAXOS_FAST_MODE in config)
+/*-------------------------------------------------------------------------*/
+#ifdef PAXOS_FAST_MODE
+static void
+leader_fast_clear_values(p_inst_info * ii) {
+    int i;
+    for(i = 0; i < N_OF_ACCEPTORS; i++) {
+        if(ii->p1_fast_values[i] != NULL) {
+            PAX_FREE(ii->p1_fast_values[i]);
+            ii->p1_fast_values[i] = NULL;
+        }
+    }
+}
+
+//Phase 1 completed and some acceptors reported a value accepted in
+// the fast round. If a value may have been chosen by a fast quorum, 
+// it's the one reported by most acceptors: it becomes the p1_value.
+// The other values were not chosen, they are pushed back
+// to be proposed again in some other instance
+static void
+leader_fast_pick_value(paxos_proposer * p, p_inst_info * ii) {
+    int i, j, count, best_count = 0, best_index = -1;
+    vh_value_wrapper ** values = ii->p1_fast_values;
+    
+    //A value accepted in a classic round has precedence
+    if(!IS_FAST_BALLOT(ii->p1_value_ballot)) {
+        leader_fast_clear_values(ii);
+        return;
+    }
+    
+    for(i = 0; i < N_OF_ACCEPTORS; i++) {
+        if(values[i] == NULL) {
+            continue;
+        }
+        count = 0;
+        for(j = 0; j < N_OF_ACCEPTORS; j++) {
+            if(values[j] != NULL && vh_value_compare(values[i], values[j]) == 0) {
+                count++;
+            }
+        }
+        if(count > best_count) {
+            best_count = count;
+            best_index = i;
+        }
+    }
+    
+    if(best_index == -1) {
+        return;
+    }
+    
+    //Replace the value found in phase 1
+    if(ii->p1_value != NULL) {
+        PAX_FREE(ii->p1_value);
+    }
+    ii->p1_value = values[best_index];
+    values[best_index] = NULL;
+    COUNT_EVENT(fast_recovery);
+    
+    //Push back the other values, once each
+    for(i = 0; i < N_OF_ACCEPTORS; i++) {
+        if(values[i] == NULL) {
+            continue;
+        }
+        for(j = i + 1; j < N_OF_ACCEPTORS; j++) {
+            if(values[j] != NULL && vh_value_compare(values[i], values[j]) == 0) {
+                PAX_FREE(values[j]);
+                values[j] = NULL;
+            }
+        }
+        if(vh_value_compare(values[i], ii->p1_value) == 0) {
+            PAX_FREE(values[i]);
+        } else {
+            vh_push_back_value(p->vh, values[i]);
+        }
+        values[i] = NULL;
+    }
+}
+
+//An instance in any state that no acceptor used yet, 
+// and with no later instance used either
+static int
+leader_fast_is_idle(paxos_proposer * p, p_inst_info * ii) {
+    return (ii->fast_any && ii->p2_value == NULL && 
+        !learner_seen_accepts(p->learner, ii->iid));
+}
+
+//Instances ready after phase 1 are opened with an any request, 
+// so that clients can send values directly to the acceptors.
+// Values found in phase 1 or pending in the leader are sent 
+// with a normal accept request instead
 static void
-leader_open_instances_p2_new() {
+leader_fast_open_instances(paxos_proposer * p) {
     unsigned int count = 0;
     p_inst_info * ii;
+    
+    sendbuf_clear(p->to_acceptors, accept_reqs, p->proposer_id);
+    
+    //Any instances cost nothing until clients use them,
+    // the window is not adapted
+    while((count + p->p2_info.open_count) < (unsigned int)paxos_conf.p2_window_max) {
+        ii = GET_PRO_INSTANCE(p, p->p2_info.next_unused_iid);
+        
+        if(ii->status != p1_ready || ii->iid != p->p2_info.next_unused_iid) {
+            COUNT_EVENT(p2_waits_p1);
+            break;
+        }
+        
+        if(ii->p1_value != NULL || vh_batch_ready(p->vh) || 
+            !IS_FAST_BALLOT(ii->my_ballot)) {
+            leader_execute_p2(p, ii);
+        } else {
+            ii->status = p2_pending;
+            ii->fast_any = 1;
+            sendbuf_add_accept_req(p->to_acceptors, ii->iid, ii->my_ballot, NULL, 0);
+            leader_set_expiration(p, ii, p->p2_rtt.timeout);
+        }
+        
+        count += 1;
+        p->p2_info.next_unused_iid += IID_STEP;
+    }
 
-    //For better batching, opening new instances at the end
-    // is preferred when more than 1 can be opened together
-    unsigned int treshold = (PROPOSER_P2_CONCURRENCY/3)*2;
-    if (p2_info.open_count > treshold) {
-        LOG(DBG, ("Skipping Phase2 open, %u are still active (tresh:%u)\n", p2_info.open_count, treshold));
+    p->p1_info.ready_count -= count;
+    p->p2_info.open_count += count;
+    sendbuf_flush(p->to_acceptors);
+    if(count > 0) {
+        LOG(DBG, ("Opened %u new instances (fast)\n", count));
+    }
+}
+#endif
+
+/*-------------------------------------------------------------------------*/
+// Multiple leaders (see PAXOS_MULTI_LEADER in config)
+/*-------------------------------------------------------------------------*/
+#ifdef PAXOS_MULTI_LEADER
+//If the lowest undelivered instance belongs to some other leader 
+// and later instances are being decided, the owner may be crashed.
+// After MULTI_LEADER_REVOKE_TIMEOUT, the instance is taken over with
+// an higher ballot: phase 2 uses the value found or a no-op
+static void
+leader_multi_check_revoke(paxos_proposer * p) {
+    struct timeval now;
+    p_inst_info * ii;
+    
+    if(IID_OWNER(p->current_iid) == (iid_t)p->proposer_id || 
+        !learner_seen_accepts(p->learner, p->current_iid + 1)) {
+        p->stuck_iid = 0;
+        return;
+    }
+    
+    gettimeofday(&now, NULL);
+    if(p->stuck_iid != p->current_iid) {
+        p->stuck_iid = p->current_iid;
+        p->stuck_since = now;
+        return;
+    }
+    
+    if(leader_usecs_since(&p->stuck_since, &now) < 
+        (long unsigned int)paxos_conf.multi_leader_revoke_timeout) {
         return;
     }
-    LOG(DBG, ("Could open %u p2 instances\n", 
-        (PROPOSER_P2_CONCURRENCY - p2_info.open_count)));
+    
+    //Already taking over
+    ii = GET_PRO_INSTANCE(p, p->current_iid);
+    if(ii->status != empty) {
+        return;
+    }
+    
+    LOG(0, ("Taking over instance %"IID_FMT" of proposer %"IID_FMT"\n", 
+        p->current_iid, IID_OWNER(p->current_iid)));
+    ii->iid = p->current_iid;
+    ii->status = p1_pending;
+    ii->revoking = 1;
+    //Higher than the first ballot of the owner
+    ii->my_ballot = NEXT_BALLOT(FIRST_BALLOT(p));
+    p->p1_info.pending_count += 1;
+    p->p2_info.open_count += 1;
+    
+    sendbuf_clear(p->to_acceptors, prepare_reqs, p->proposer_id);
+    sendbuf_add_prepare_req(p->to_acceptors, ii->iid, ii->my_ballot);
+    sendbuf_flush(p->to_acceptors);
+    leader_set_expiration(p, ii, p->p1_rtt.timeout);
+    COUNT_EVENT(revoked);
+}
+#endif
+
+/*-------------------------------------------------------------------------*/
+// Thrifty phase 2 (see PROPOSER_THRIFTY_P2 in config)
+/*-------------------------------------------------------------------------*/
+#ifdef PROPOSER_THRIFTY_P2
+static void
+leader_thrifty_rotate(paxos_proposer * p) {
+    p->thrifty_first = (p->thrifty_first + 1) % N_OF_ACCEPTORS;
+    p->thrifty_opened = 0;
+    p->thrifty_timeout = 0;
+    LOG(VRB, ("Accept requests now sent from acceptor %d on\n", p->thrifty_first));
+}
+
+//The phase 2 quorum of members following thrifty_first, for the 
+// membership of the next instance. If a membership change applies 
+// within the batch, the later instances may time out and be retried
+static unsigned int
+leader_thrifty_acceptors(paxos_proposer * p) {
+    const paxos_membership * m;
+    unsigned int mask = 0;
+    int i, id, count = 0;
+    
+    //Rotate once, even if many instances timed out together
+    if(p->thrifty_timeout) {
+        leader_thrifty_rotate(p);
+    }
+    
+    m = learner_membership(p->learner, p->p2_info.next_unused_iid);
+    for(i = 0; i < N_OF_ACCEPTORS && count < m->phase2_quorum; i++) {
+        id = (p->thrifty_first + i) % N_OF_ACCEPTORS;
+        if(IS_MEMBER(m, id)) {
+            mask |= (1U << id);
+            count++;
+        }
+    }
+    return mask;
+}
+
+static void
+leader_thrifty_count_opened(paxos_proposer * p, unsigned int count) {
+    p->thrifty_opened += count;
+    if(p->thrifty_opened >= (unsigned int)paxos_conf.thrifty_rotate) {
+        leader_thrifty_rotate(p);
+    }
+}
+#endif
+
+//The next unused instance has no value found in phase 1 and nothing 
+// to propose, but the acceptors accepted later instances: it is a hole
+// left by the previous leader (or by another leader, in multi-leader 
+// mode) and blocks delivery. The highest accepted iid comes with the
+// promises of phase 1, or later trough the learner (acceptors 
+// periodically repeat their latest accept).
+// Also filled when a merged learner waits for it, since the other
+// groups are ahead (see noop_request)
+static int
+leader_is_hole(paxos_proposer * p, p_inst_info * ii) {
+    iid_t iid = p->p2_info.next_unused_iid;
+    return (ii->p1_value == NULL && !vh_batch_ready(p->vh) &&
+        (iid < p->highest_accepted_iid || iid <= vh_noop_target(p->vh) ||
+        learner_seen_accepts(p->learner, iid)));
+}
+
+static void
+leader_open_instances_p2_new(paxos_proposer * p) {
+    unsigned int count = 0;
+    p_inst_info * ii;
+    int noop;
+
+#ifdef PAXOS_FAST_MODE
+    leader_fast_open_instances(p);
+    return;
+#endif
+
+    //For better batching, opening new instances at the end
+    // is preferred when more than 1 can be opened together.
+    // Holes are filled anyway
+    unsigned int treshold = (p->p2_info.window/3)*2;
+    int skip_new = (p->p2_info.open_count > treshold);
+    if (skip_new) {
+        LOG(DBG, ("Skipping Phase2 open, %u are still active (tresh:%u)\n", p->p2_info.open_count, treshold));
+    } else {
+        LOG(DBG, ("Could open %u p2 instances\n", 
+            (p->p2_info.window - p->p2_info.open_count)));
+    }
 
     //Create a batch of accept requests
-    sendbuf_clear(to_acceptors, accept_reqs, this_proposer_id);
+    sendbuf_clear(p->to_acceptors, accept_reqs, p->proposer_id);
+#ifdef PROPOSER_THRIFTY_P2
+    //Only to the current quorum, retries go to all (see p2_expired)
+    sendbuf_set_acceptors(p->to_acceptors, leader_thrifty_acceptors(p));
+#endif
     
     //Start new phase 2 while there is some value from 
-    // client to send and we can open more concurrent instances
-    while((count + p2_info.open_count) <= PROPOSER_P2_CONCURRENCY) {
+    // client to send and we can open more concurrent instances.
+    // Holes (and the instance that renews the lease) are closed with 
+    // no-ops without waiting for a batch, but within the window too:
+    // a merged learner may ask for a long range of them
+    while(1) {
 
-        ii = GET_PRO_INSTANCE(p2_info.next_unused_iid);
+        ii = GET_PRO_INSTANCE(p, p->p2_info.next_unused_iid);
         assert(ii->p2_value == NULL);
+        noop = leader_is_hole(p, ii) || p->lease_renew;
+        
+        //No value (or batch) to send for next unused, stop
+        if(ii->p1_value == NULL && !vh_batch_ready(p->vh) && !noop) {
+            LOG(DBG, ("No value to use for next instance\n"));
+            break;
+        }
         
-        //No value to send for next unused, stop
-        if(ii->p1_value == NULL &&
-            vh_pending_list_size() == 0) {
-                LOG(DBG, ("No value to use for next instance\n"));
-                break;
+        //Window is full, stop
+        if((!noop && skip_new) || 
+            (count + p->p2_info.open_count) >= p->p2_info.window) {
+            break;
         }
         
         //Next unused is not ready, stop
-        if(ii->status != p1_ready || ii->iid != p2_info.next_unused_iid) {
-            LOG(DBG, ("Next instance to use for P2 (iid:%u) is not ready yet\n", p2_info.next_unused_iid));
+        if(ii->status != p1_ready || ii->iid != p->p2_info.next_unused_iid) {
+            LOG(DBG, ("Next instance to use for P2 (iid:%"IID_FMT") is not ready yet\n", p->p2_info.next_unused_iid));
             COUNT_EVENT(p2_waits_p1);
             break;
         }
@@ -366,86 +902,160 @@ leader_open_instances_p2_new() {
 
         //Executes phase2, sending an accept request
         //Using the found value or getting the next from list
-        leader_execute_p2(ii);
+        // (an empty batch if nothing is pending)
+        leader_execute_p2(p, ii);
+        if(noop) {
+            COUNT_EVENT(p2_noop);
+            p->lease_renew = 0;
+        }
         
         //Count opened
         count += 1;
         //Update next to use
-        p2_info.next_unused_iid += 1;
+        p->p2_info.next_unused_iid += IID_STEP;
     }
     
+#ifdef PROPOSER_THRIFTY_P2
+    leader_thrifty_count_opened(p, count);
+#endif
+    
     //Count p1_ready that were consumed
-    p1_info.ready_count -= count;
+    p->p1_info.ready_count -= count;
     //Count newly opened
-    p2_info.open_count += count;
+    p->p2_info.open_count += count;
     //Flush last accept_req batch
-    sendbuf_flush(to_acceptors);
+    sendbuf_flush(p->to_acceptors);
     if(count > 0) {
         LOG(DBG, ("Opened %u new instances\n", count));
+        leader_lease_update_read_point(p);
     }
 }
 
-static void
-leader_periodic_p2_check(int fd, short event, void *arg) {
-    UNUSED_ARG(fd);
-    UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+//Phase 2 of this instance expired, unless it was closed 
+// in the meanwhile it must restart from phase 1.
+// Returns 1 if it restarts, 0 if it was closed
+static int
+leader_p2_expired(paxos_proposer * p, p_inst_info * ii) {
+    //Check if it was closed in the meanwhile 
+    // (but not delivered yet, i.e. waiting behind a lower hole):
+    // nothing was lost
+    if(learner_is_closed(p->learner, ii->iid)) {
+        ii->status = p2_completed;
+        p->p2_info.open_count -= 1;
+        //The rest (i.e. answering client)
+        // is done when the value is actually delivered
+        LOG(VRB, ("Instance %"IID_FMT" closed, waiting for deliver\n", ii->iid));
+        return 0;
+    }
     
-    // create a prepare batch for expired instances
-    sendbuf_clear(to_acceptors, prepare_reqs, this_proposer_id);
+    //Either the accepts or the learns were lost, 
+    // the phase 2 window is too large
+    leader_window_on_loss(p, ii);
     
+    //Expired and not closed: must restart from phase 1
+    ii->status = p1_pending;
+    p->p1_info.pending_count += 1;
+    ii->my_ballot = NEXT_BALLOT(ii->my_ballot);
+    //Send prepare to acceptors
+    sendbuf_add_prepare_req(p->to_acceptors, ii->iid, ii->my_ballot);
+    leader_set_expiration(p, ii, p->p1_rtt.timeout);
+    
+    LOG(VRB, ("Instance %"IID_FMT" restarts from phase 1\n", ii->iid));
+
+#ifdef PROPOSER_THRIFTY_P2
+    //Some acceptor in the quorum may be slow or crashed
+    p->thrifty_timeout = 1;
+#endif
+    COUNT_EVENT(p2_timeout);
+    return 1;
+}
+
+//Handles the instances whose deadline passed since the last check
+static void
+leader_check_expired(paxos_proposer * p) {
     struct timeval now;
     gettimeofday(&now, NULL);
-    // from current to highest open, check deadline
-    // if instances in status p2_pending
-    iid_t i;
+    
     p_inst_info * ii;
-    for(i = current_iid; i < p2_info.next_unused_iid; i++) {
-        ii = GET_PRO_INSTANCE(i);
-        
-        //Not p2_pending, skip
-        if(ii->status != p2_pending) {
-            continue;
-        }
-        
-        //Check if it was closed in the meanwhile 
-        // (but not delivered yet)
-        if(learner_is_closed(i)) {
-            ii->status = p2_completed;
-            p2_info.open_count -= 1;
-            //The rest (i.e. answering client)
-            // is done when the value is actually delivered
-            LOG(VRB, ("Instance %u closed, waiting for deliver\n", i));
-            continue;
-        }
+    p_inst_info * expired = leader_timer_collect_expired(p, &now);
+    if(expired == NULL) {
+        return;
+    }
+    
+    //Timeouts of the expired instances are doubled only once
+    int p1_expired = 0, p2_expired = 0;
+    
+    // create a prepare batch for expired instances
+    sendbuf_clear(p->to_acceptors, prepare_reqs, p->proposer_id);
+    
+    while(expired != NULL) {
+        ii = expired;
+        expired = ii->tw_next;
+        ii->tw_next = NULL;
         
-        //Not expired yet, skip
-        if(!leader_is_expired(&ii->timeout, &now)) {
-            continue;
+        switch(ii->status) {
+            case p1_pending: {
+                if(!p1_expired) {
+                    leader_rtt_backoff(&p->p1_rtt);
+                    p1_expired = 1;
+                }
+                leader_p1_expired(p, ii);
+            }
+            break;
+            
+            case p2_pending: {
+#ifdef PAXOS_FAST_MODE
+                //Clients did not use this instance yet, not a loss
+                if(leader_fast_is_idle(p, ii)) {
+                    leader_set_expiration(p, ii, p->p2_rtt.timeout);
+                    break;
+                }
+#endif
+                //Closed instances were not lost, no back off
+                if(leader_p2_expired(p, ii) && !p2_expired) {
+                    leader_rtt_backoff(&p->p2_rtt);
+                    p2_expired = 1;
+                }
+            }
+            break;
+            
+            default: {
+                //Deadline is meaningless in other states
+            }
         }
-        
-        //Expired and not closed: must restart from phase 1
-        ii->status = p1_pending;
-        p1_info.pending_count += 1;
-        ii->my_ballot = NEXT_BALLOT(ii->my_ballot);
-        //Send prepare to acceptors
-        sendbuf_add_prepare_req(to_acceptors, ii->iid, ii->my_ballot);
-        leader_set_expiration(ii, P1_TIMEOUT_INTERVAL);
-        
-        LOG(VRB, ("Instance %u restarts from phase 1\n", i));
-
-        COUNT_EVENT(p2_timeout);
-
     }
     
     //Flush last message if any
-    sendbuf_flush(to_acceptors);
+    sendbuf_flush(p->to_acceptors);
+}
+
+static void
+leader_periodic_p2_check(int fd, short event, void *arg) {
+    UNUSED_ARG(fd);
+    UNUSED_ARG(event);
+    paxos_proposer * p = arg;
+    
+    //Restart expired instances (phase 1 and phase 2)
+    leader_check_expired(p);
+    
+    //Stop waiting for lost client values
+    vh_check_held(p->vh);
+    
+#ifdef PAXOS_MULTI_LEADER
+    //Take over instances of crashed leaders
+    leader_multi_check_revoke(p);
+#endif
+    
+    //Renew the lease if idle
+    leader_lease_check(p);
     
     //Open new instances
-    leader_open_instances_p2_new();
+    leader_open_instances_p2_new(p);
+    
+    update_event_gauges(p);
     
     //Set next invokation of this function
-    leader_set_next_p2_check();
+    leader_set_next_p2_check(p);
 
 }
 
@@ -453,43 +1063,51 @@ leader_periodic_p2_check(int fd, short event, void *arg) {
 // Deliver callback
 /*-------------------------------------------------------------------------*/
 static void 
-leader_deliver(char * value, size_t size, iid_t iid, ballot_t ballot, int proposer) {
-    UNUSED_ARG(ballot);
+leader_deliver(paxos_proposer * p, char * value, size_t size, iid_t iid, ballot_t ballot, int proposer) {
     UNUSED_ARG(proposer);
-    LOG(DBG, ("Instance %u delivered to Leader\n", iid));
+    LOG(DBG, ("Instance %"IID_FMT" delivered to Leader\n", iid));
 
     //Verify that the value is the one found or associated
-    p_inst_info * ii = GET_PRO_INSTANCE(iid);
+    p_inst_info * ii = GET_PRO_INSTANCE(p, iid);
     //Instance not even initialized, skip
     if(ii->iid != iid) {
         return;
     }
     
     if(ii->status == p1_pending) {
-        p1_info.pending_count -= 1;
+        p->p1_info.pending_count -= 1;
     }
     
-    if(p2_info.next_unused_iid == iid) {
-        p2_info.next_unused_iid += 1;
+    if(p->p2_info.next_unused_iid == iid) {
+        p->p2_info.next_unused_iid += IID_STEP;
     }
     
     int opened_by_me = (ii->status == p1_pending && ii->p2_value != NULL) ||
         (ii->status == p1_ready && ii->p2_value != NULL) ||
-        (ii->status == p2_pending);
+        (ii->status == p2_pending) ||
+        ((ii->fast_any || ii->revoking) && ii->status != p2_completed);
     if(opened_by_me) {
-        p2_info.open_count -= 1;
+        p->p2_info.open_count -= 1;
     }
 
     int my_val = (ii->p2_value != NULL) &&
         (ii->p2_value->value_size == size) &&
         (memcmp(value, ii->p2_value->value, size) == 0);
 
+    if(my_val && (ii->status == p2_pending || ii->status == p2_completed)) {
+        leader_window_on_close(p, ii);
+        //Accepted by a quorum in the ballot of the last accept_req
+        if(ballot == ii->my_ballot) {
+            leader_lease_extend(p, &ii->sent);
+        }
+    }
+
     if(my_val) {
     //Our value accepted, notify client that submitted it
-        vh_notify_client(0, ii->p2_value);
+        vh_notify_batch(p->vh, PAXOS_SUBMIT_COMMITTED, iid, ii->p2_value);
     } else if(ii->p2_value != NULL) {
     //Different value accepted, push back our value
-        vh_push_back_value(ii->p2_value);
+        vh_push_back_value(p->vh, ii->p2_value);
         ii->p2_value = NULL;
     } else {
         //We assigned no value to this instance, 
@@ -497,11 +1115,11 @@ leader_deliver(char * value, size_t size, iid_t iid, ballot_t ballot, int propos
     }
 
     //Clear current instance
-    pro_clear_instance_info(ii);
+    pro_clear_instance_info(p, ii);
     
     //If enough instances are ready to 
     // be opened, start phase2 for them
-    leader_open_instances_p2_new();
+    leader_open_instances_p2_new(p);
 }
 
 
@@ -509,85 +1127,134 @@ leader_deliver(char * value, size_t size, iid_t iid, ballot_t ballot, int propos
 // Initialization/shutdown
 /*-------------------------------------------------------------------------*/
 
+//Smallest ballot of this proposer higher than any delivered one,
+// phase 1 of the old leader is not repeated with ballots that fail
+static void
+leader_set_first_ballot(paxos_proposer * p) {
+#if defined(PAXOS_FAST_MODE) || defined(PAXOS_MULTI_LEADER)
+    //The first ballot is fixed (fast round, revoke) 
+    p->first_ballot = MAX_N_OF_PROPOSERS + p->proposer_id;
+#else
+    ballot_t lowest = MAX_N_OF_PROPOSERS + p->proposer_id;
+    ballot_t b = (p->highest_ballot_seen / MAX_N_OF_PROPOSERS) * 
+        MAX_N_OF_PROPOSERS + p->proposer_id;
+    if(b <= p->highest_ballot_seen) {
+        b = NEXT_BALLOT(b);
+    }
+    if(b < lowest) {
+        b = lowest;
+    }
+    p->first_ballot = b;
+    LOG(VRB, ("First ballot is %"BALLOT_FMT"\n", b));
+#endif
+}
+
+//A promoted proposer runs phase 1 for the preexecution window from
+// current_iid, as in a cold start: the values mirrored while standby 
+// are not lost, but the takeover waits a phase 1 round trip (or more, 
+// if the old leader opened instances beyond the window)
 static int
-leader_init() {
-    LOG(0, ("Proposer %d promoted to leader\n", this_proposer_id));
+leader_init(paxos_proposer * p) {
+    LOG(0, ("Proposer %d promoted to leader\n", p->proposer_id));
+    leader_set_first_ballot(p);
+    p->highest_accepted_iid = 0;
+    p->lease_renew = 0;
     
 #ifdef LEADER_EVENTS_UPDATE_INTERVAL
-    clear_event_counters();
-    evtimer_set(&print_events_event, leader_print_event_counters, NULL);
-    evutil_timerclear(&print_events_interval);
-    print_events_interval.tv_sec = (LEADER_EVENTS_UPDATE_INTERVAL / 1000000);
-    print_events_interval.tv_usec = (LEADER_EVENTS_UPDATE_INTERVAL % 1000000);
-    leader_print_event_counters(0, 0, NULL);
+    evtimer_set(&p->print_events_event, leader_print_event_counters, p);
+    event_base_set(p->eb, &p->print_events_event);
+    evutil_timerclear(&p->print_events_interval);
+    p->print_events_interval.tv_sec = (LEADER_EVENTS_UPDATE_INTERVAL / 1000000);
+    p->print_events_interval.tv_usec = (LEADER_EVENTS_UPDATE_INTERVAL % 1000000);
+    leader_print_event_counters(0, 0, p);
 #endif
 
     //Initialize values handler
-    if(vh_init()!= 0) {
+    if(vh_init(p->vh)!= 0) {
         printf("Values handler initialization failed!\n");
         return -1;
     }
 
+    //Timeouts start from the configured values
+    leader_rtt_init(&p->p1_rtt, paxos_conf.p1_timeout_initial, 
+        paxos_conf.p1_timeout_min, paxos_conf.p1_timeout_max);
+    leader_rtt_init(&p->p2_rtt, paxos_conf.p2_timeout_initial, 
+        paxos_conf.p2_timeout_min, paxos_conf.p2_timeout_max);
+
+    //Reset the timer wheel, first visited slot is the current tick
+    struct timeval time_now;
+    gettimeofday(&time_now, NULL);
+    memset(p->t_wheel.slots, 0, sizeof(p_inst_info *) * p->t_wheel.size);
+    p->t_wheel.count = 0;
+    p->t_wheel.last_tick = leader_timer_tick(&time_now) - 1;
+
     // Reset phase 1 counters
-    p1_info.pending_count = 0;
-    p1_info.ready_count = 0;
+    p->p1_info.pending_count = 0;
+    p->p1_info.ready_count = 0;
     // Set so that next p1 to open is current_iid
-    p1_info.highest_open = current_iid - 1;
+    p->p1_info.highest_open = FIRST_OWNED_IID(p, p->current_iid) - IID_STEP;
     
     //Initialize timer and corresponding event for
     // checking timeouts of instances, phase 1
-    evtimer_set(&p1_check_event, leader_periodic_p1_check, NULL);
-    evutil_timerclear(&p1_check_interval);
-    p1_check_interval.tv_sec = 0; //(P1_TIMEOUT_INTERVAL/3 / 1000000);
-    p1_check_interval.tv_usec = 10000; //(P1_TIMEOUT_INTERVAL/3 % 1000000);
+    evtimer_set(&p->p1_check_event, leader_periodic_p1_check, p);
+    event_base_set(p->eb, &p->p1_check_event);
+    evutil_timerclear(&p->p1_check_interval);
+    p->p1_check_interval.tv_sec = 0;
+    p->p1_check_interval.tv_usec = 10000;
     
-    //Check pending, open new, set next timeout
-    leader_periodic_p1_check(0, 0, NULL);
+    //Open new, set next timeout
+    leader_periodic_p1_check(0, 0, p);
     
     //Reset phase 2 counters
-    p2_info.next_unused_iid = current_iid;
-    p2_info.open_count = 0;
+    p->p2_info.next_unused_iid = FIRST_OWNED_IID(p, p->current_iid);
+    p->p2_info.open_count = 0;
+    p->p2_info.window = paxos_conf.p2_window_initial;
+    p->p2_info.window_acked = 0;
+    p->p2_info.recovery_iid = p->current_iid;
+    p->p2_info.min_latency = 0;
     
     //Initialize timer and corresponding event for
     // checking timeouts of instances, phase 2
-    evtimer_set(&p2_check_event, leader_periodic_p2_check, NULL);
-    evutil_timerclear(&p2_check_interval);
-    p2_check_interval.tv_sec = (((int)P2_CHECK_INTERVAL) / 1000000);
-    p2_check_interval.tv_usec = ((P2_CHECK_INTERVAL) % 1000000);
-    leader_set_next_p2_check();
+    evtimer_set(&p->p2_check_event, leader_periodic_p2_check, p);
+    event_base_set(p->eb, &p->p2_check_event);
+    evutil_timerclear(&p->p2_check_interval);
+    p->p2_check_interval.tv_sec = (paxos_conf.p2_check_interval / 1000000);
+    p->p2_check_interval.tv_usec = (paxos_conf.p2_check_interval % 1000000);
+    leader_set_next_p2_check(p);
     
     LOG(VRB, ("Leader is ready\n"));
     return 0;        
 }
 
 static void
-leader_shutdown() {
-    LOG(0, ("Proposer %d dropping leadership\n", this_proposer_id));
+leader_shutdown(paxos_proposer * p) {
+    LOG(0, ("Proposer %d dropping leadership\n", p->proposer_id));
+    __atomic_store_n(&p->lease_expiry, 0, __ATOMIC_RELEASE);
 
-    evtimer_del(&p1_check_event);
-    evtimer_del(&p2_check_event);
+    evtimer_del(&p->p1_check_event);
+    evtimer_del(&p->p2_check_event);
     
 #ifdef LEADER_EVENTS_UPDATE_INTERVAL
-    evtimer_del(&print_events_event);
+    evtimer_del(&p->print_events_event);
 #endif
 
     //Iterate over currently open instances 
     p_inst_info * ii;
-    unsigned int i;
-    for(i = current_iid; i <= p1_info.highest_open; i++) {
-        ii = GET_PRO_INSTANCE(i);
+    iid_t i;
+    for(i = p->current_iid; i <= p->p1_info.highest_open; i++) {
+        ii = GET_PRO_INSTANCE(p, i);
         
         if(ii->status != p2_completed && ii->p2_value != NULL) {
             // A value was assigned to this instance, but it did 
             // not complete. Send back to the pending list for now
-            vh_push_back_value(ii->p2_value);
+            vh_push_back_value(p->vh, ii->p2_value);
             ii->p2_value = NULL;
         }
         //Clear all instances
-        pro_clear_instance_info(ii);
+        pro_clear_instance_info(p, ii);
     }
         
     //This will clear all values in the pending list
     // and notify the respective clients
-    vh_shutdown();
+    vh_shutdown(p->vh);
 }
@@ -2,34 +2,183 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
-#include <pthread.h>
 
 #include "event.h"
+#include "evutil.h"
 #include "libpaxos.h"
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
+#include "clients_handler.h"
+#include "paxos_metrics.h"
 
-static int vh_list_size = 0;
-static vh_value_wrapper * vh_list_head = NULL;
-static vh_value_wrapper * vh_list_tail = NULL;
+/*
+    Pending values are kept in two places:
+    - a bounded lock-free ring (multiple producers, single consumer), 
+      where any thread can enqueue new values (see Vyukov's bounded queue)
+    - a list of values to retry, that were pushed back by the leader.
+      Only the leader (the libevent thread, the consumer) touches it, 
+      so no lock is required
+    The retry list is always consumed before the ring.
+    Every proposer receives the values submitted by clients. When it's
+    not the leader (hot standby) it keeps them in a mirror, and drops 
+    them as they are delivered. If it's promoted, the values still in 
+    the mirror are enqueued: the ones the old leader did not propose
+    are not lost, the ones it proposed are filtered by the learners.
+    The mirror grows up to PROPOSER_MIRROR_MAX_LENGTH, a value that does
+    not fit is not kept: it's lost if the leader fails.
+    Only the submitted values are mirrored, not the instances the old 
+    leader opened: a new leader still runs phase 1 from current_iid,
+    a preexecution window at a time (see leader_init).
+*/
+typedef struct vh_ring_cell_t {
+    size_t sequence;
+    vh_value_wrapper * vw;
+} vh_ring_cell;
+
+//The values handler of a proposer
+struct vh_state_t {
+    struct event_base * eb;
+    short int           proposer_id;
+    int                 group;
+
+    //LEADER_MAX_QUEUE_LENGTH cells
+    vh_ring_cell *      ring;
+    size_t              ring_enqueue_pos;
+    size_t              ring_dequeue_pos;
+
+    //Size of the values in the ring, as they are packed in a batch
+    size_t              ring_bytes;
+
+    int                 retry_list_size;
+    size_t              retry_list_bytes;
+    vh_value_wrapper *  retry_list_head;
+    vh_value_wrapper *  retry_list_tail;
+
+    //When the leader first saw some value pending, zero if none
+    struct timeval      pending_since;
+
+    long unsigned int   dropped_count;
+
+    //Set while the proposer is the leader
+    int                 leading;
+
+    //Highest instance a merged learner asked to fill with no-ops
+    iid_t               noop_target;
+
+    //Values received as standby (mirror_size cells, a power of 2),
+    // in arrival order
+    vh_value_wrapper ** mirror;
+    size_t              mirror_size;
+    size_t              mirror_head;
+    size_t              mirror_tail;
+    //Values not kept, the mirror was full
+    paxos_metric *      mirror_dropped;
+
+    struct event        leader_msg_event;
+    udp_receiver *      for_leader;
 
-static long unsigned int dropped_count = 0;
+    ch_state *          ch;
+};
+#define GET_RING_CELL(VH, P) (&(VH)->ring[((P) & (LEADER_MAX_QUEUE_LENGTH-1))])
+#define GET_MIRROR_SLOT(VH, P) (&(VH)->mirror[((P) & ((VH)->mirror_size-1))])
 
-static struct event leader_msg_event;
-static udp_receiver * for_leader;
+/*-------------------------------------------------------------------------*/
+// Submit ring
+/*-------------------------------------------------------------------------*/
 
-static pthread_mutex_t pending_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static void
+vh_ring_init(vh_state * vh) {
+    size_t i;
+    vh->ring = PAX_MALLOC(sizeof(vh_ring_cell) * LEADER_MAX_QUEUE_LENGTH);
+    for(i = 0; i < LEADER_MAX_QUEUE_LENGTH; i++) {
+        vh->ring[i].sequence = i;
+        vh->ring[i].vw = NULL;
+    }
+    vh->ring_enqueue_pos = 0;
+    vh->ring_dequeue_pos = 0;
+    vh->ring_bytes = 0;
+}
+
+//Called by any thread. Returns -1 if the ring is full
+static int
+vh_ring_push(vh_state * vh, vh_value_wrapper * vw) {
+    vh_ring_cell * cell;
+    size_t pos = __atomic_load_n(&vh->ring_enqueue_pos, __ATOMIC_RELAXED);
+    
+    while(1) {
+        cell = GET_RING_CELL(vh, pos);
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long int diff = (long int)seq - (long int)pos;
+        
+        if(diff == 0) {
+            //Cell is free, try to reserve it
+            if(__atomic_compare_exchange_n(&vh->ring_enqueue_pos, &pos, pos + 1, 
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            //Cell still holds a value from the previous round, full
+            return -1;
+        } else {
+            //Another producer took this cell
+            pos = __atomic_load_n(&vh->ring_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    __atomic_add_fetch(&vh->ring_bytes, CLIENT_VALUE_SIZE(vw), __ATOMIC_RELAXED);
+    cell->vw = vw;
+    //Publish to the consumer
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+//Called by the leader only. Returns NULL if the ring is empty
+static vh_value_wrapper *
+vh_ring_pop(vh_state * vh) {
+    vh_ring_cell * cell = GET_RING_CELL(vh, vh->ring_dequeue_pos);
+    size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    
+    //Not yet published (or empty)
+    if(seq != vh->ring_dequeue_pos + 1) {
+        return NULL;
+    }
+    
+    vh_value_wrapper * vw = cell->vw;
+    cell->vw = NULL;
+    __atomic_sub_fetch(&vh->ring_bytes, CLIENT_VALUE_SIZE(vw), __ATOMIC_RELAXED);
+    //Give the cell back to producers, for the next round
+    __atomic_store_n(&cell->sequence, 
+        vh->ring_dequeue_pos + LEADER_MAX_QUEUE_LENGTH, __ATOMIC_RELEASE);
+    vh->ring_dequeue_pos += 1;
+    return vw;
+}
+
+static int
+vh_ring_size(vh_state * vh) {
+    size_t enq = __atomic_load_n(&vh->ring_enqueue_pos, __ATOMIC_RELAXED);
+    return (int)(enq - vh->ring_dequeue_pos);
+}
 
 vh_value_wrapper * 
 vh_wrap_value(char * value, size_t size) {
     vh_value_wrapper * vw = PAX_MALLOC(sizeof(vh_value_wrapper) + size);
     vw->value_size = size;
     vw->next = NULL;
+    vw->client_id = 0;
+    vw->seqno = 0;
     //Copy value in
     memcpy(vw->value, value, size);
     return vw;
 }
 
+//An instance value with no client values (a no-op)
+vh_value_wrapper * 
+vh_empty_batch() {
+    value_batch vb;
+    vb.count = 0;
+    return vh_wrap_value((char*)&vb, sizeof(value_batch));
+}
+
 //Return 0 for equals, like memcmp()
 int vh_value_compare(vh_value_wrapper * vw1, vh_value_wrapper * vw2) {
     if(vw1->value_size != vw2->value_size) {
@@ -38,17 +187,191 @@ int vh_value_compare(vh_value_wrapper * vw1, vh_value_wrapper * vw2) {
     return memcmp(vw1->value, vw2->value, vw1->value_size);
 }
 
+/*-------------------------------------------------------------------------*/
+// Hot standby mirror
+/*-------------------------------------------------------------------------*/
+
+//Drops the oldest mirrored values, as long as they are delivered
+static void
+vh_mirror_trim(vh_state * vh) {
+    vh_value_wrapper ** slot;
+    
+    while(vh->mirror_head != vh->mirror_tail) {
+        slot = GET_MIRROR_SLOT(vh, vh->mirror_head);
+        if(!ch_is_delivered(vh->ch, *slot)) {
+            break;
+        }
+        PAX_FREE(*slot);
+        *slot = NULL;
+        vh->mirror_head += 1;
+    }
+}
+
+//Doubles the size of the mirror, returns -1 if it's at the maximum
+static int
+vh_mirror_grow(vh_state * vh) {
+    size_t pos, new_size = vh->mirror_size * 2;
+    vh_value_wrapper ** old = vh->mirror;
+    
+    if(new_size > PROPOSER_MIRROR_MAX_LENGTH) {
+        return -1;
+    }
+    vh->mirror = PAX_MALLOC(sizeof(vh_value_wrapper*) * new_size);
+    memset(vh->mirror, 0, sizeof(vh_value_wrapper*) * new_size);
+    for(pos = vh->mirror_head; pos != vh->mirror_tail; pos++) {
+        vh->mirror[pos & (new_size-1)] = old[pos & (vh->mirror_size-1)];
+    }
+    vh->mirror_size = new_size;
+    PAX_FREE(old);
+    LOG(VRB, ("Standby mirror grown to %lu values\n", new_size));
+    return 0;
+}
+
+//Keeps a value received while not leader. Anonymous values cannot be
+// told apart from the delivered ones, they are left to the leader
+static void
+vh_mirror_push(vh_state * vh, vh_value_wrapper * vw) {
+    if(vw->client_id == 0 || vw->client_id == MEMBERSHIP_CLIENT_ID) {
+        PAX_FREE(vw);
+        return;
+    }
+    
+    //Full, only delivered values can be dropped
+    if(vh->mirror_tail - vh->mirror_head == vh->mirror_size) {
+        vh_mirror_trim(vh);
+    }
+    if(vh->mirror_tail - vh->mirror_head == vh->mirror_size &&
+        vh_mirror_grow(vh) != 0) {
+        LOG(VRB, ("Standby mirror full, value dropped\n"));
+        METRIC_INC(vh->mirror_dropped);
+        PAX_FREE(vw);
+        return;
+    }
+    *GET_MIRROR_SLOT(vh, vh->mirror_tail) = vw;
+    vh->mirror_tail += 1;
+}
+
+//Promoted: values not delivered yet are sequenced and enqueued
+static void
+vh_mirror_resume(vh_state * vh) {
+    vh_value_wrapper * vw;
+    int resumed = 0;
+    
+    while(vh->mirror_head != vh->mirror_tail) {
+        vw = *GET_MIRROR_SLOT(vh, vh->mirror_head);
+        *GET_MIRROR_SLOT(vh, vh->mirror_head) = NULL;
+        vh->mirror_head += 1;
+        
+        if(ch_is_delivered(vh->ch, vw)) {
+            PAX_FREE(vw);
+            continue;
+        }
+        ch_submit(vh->ch, vw);
+        resumed++;
+    }
+    LOG(VRB, ("Resuming %d values received as standby\n", resumed));
+}
+
+//An instance value was delivered: the client values in it
+// are not needed anymore
+void
+vh_delivered(vh_state * vh, char * value, size_t size) {
+    value_batch * vb = (value_batch *)value;
+    client_value * cv;
+    size_t offset = sizeof(value_batch);
+    short int i;
+    
+    if(size < sizeof(value_batch)) {
+        return;
+    }
+    for(i = 0; i < vb->count; i++) {
+        cv = (client_value *)&value[offset];
+        if(offset + sizeof(client_value) > size ||
+            offset + CLIENT_VALUE_SIZE(cv) > size) {
+            return;
+        }
+        ch_delivered(vh->ch, cv->client_id, cv->seqno);
+        offset += CLIENT_VALUE_SIZE(cv);
+    }
+    
+    if(!vh->leading) {
+        vh_mirror_trim(vh);
+    }
+}
+
+/*-------------------------------------------------------------------------*/
+// Submit messages
+/*-------------------------------------------------------------------------*/
+
+//A merged learner waits for the instances up to target_iid,
+// the leader fills them with no-ops
+static void
+vh_noop_request(vh_state * vh, client_value * cv) {
+    noop_request * nr = (noop_request *)cv->value;
+    if(cv->value_size != sizeof(noop_request)) {
+        return;
+    }
+    if(vh->leading && nr->target_iid > vh->noop_target) {
+        vh->noop_target = nr->target_iid;
+    }
+}
+
+//Enqueues the values of a submit message, in order
+static void
+vh_handle_submit_batch(vh_state * vh, value_batch * vb) {
+    client_value * cv;
+    vh_value_wrapper * vw;
+    size_t offset = 0;
+    short int i;
+    
+    for(i = 0; i < vb->count; i++) {
+        cv = (client_value *)&vb->data[offset];
+        offset += CLIENT_VALUE_SIZE(cv);
+
+        //Not a value, see noop_request
+        if(cv->client_id == NOOP_REQUEST_CLIENT_ID) {
+            vh_noop_request(vh, cv);
+            continue;
+        }
+
+#ifdef PAXOS_MULTI_LEADER
+        //Every leader receives all values, 
+        // only the ones of its own clients are handled
+        if((cv->client_id % N_OF_LEADERS) != (unsigned int)vh->proposer_id) {
+            continue;
+        }
+#endif
+
+        //Remember where to send the outcome
+        ch_register(vh->ch, cv->client_id, &vh->for_leader->addr);
+        
+        vw = vh_wrap_value(cv->value, cv->value_size);
+        vw->client_id = cv->client_id;
+        vw->seqno = cv->seqno;
+        
+        //Not the leader, kept in case of promotion
+        if(!vh->leading) {
+            vh_mirror_push(vh, vw);
+            continue;
+        }
+        
+        //Enqueued when all the previous values of 
+        // the same client are enqueued
+        ch_submit(vh->ch, vw);
+    }
+}
+
 static void 
 vh_handle_newmsg(int sock, short event, void *arg) {
     //Make the compiler happy!
     UNUSED_ARG(sock);
     UNUSED_ARG(event);
-    UNUSED_ARG(arg);
+    vh_state * vh = arg;
     
-    assert(sock == for_leader->sock);
+    assert(sock == vh->for_leader->sock);
     
     //Read the next message
-    int valid = udp_read_next_message(for_leader);
+    int valid = udp_read_next_message(vh->for_leader);
     if (valid < 0) {
         printf("Dropping invalid client-to-leader message\n");
         return;
@@ -56,10 +379,10 @@ vh_handle_newmsg(int sock, short event, void *arg) {
 
     //The message is valid, take the appropriate action
     // based on the type
-    paxos_msg * msg = (paxos_msg*) &for_leader->recv_buffer;
+    paxos_msg * msg = (paxos_msg*) &vh->for_leader->recv_buffer;
     switch(msg->type) {
         case submit: {
-            vh_enqueue_value(msg->data, msg->data_size);
+            vh_handle_submit_batch(vh, (value_batch *)msg->data);
         }
         break;
 
@@ -69,147 +392,366 @@ vh_handle_newmsg(int sock, short event, void *arg) {
     }
 }
 
-int
-vh_init() {
-    //Create the emtpy values list
-    vh_list_size = 0;
-    vh_list_head = NULL;
-    vh_list_tail = NULL;
-    dropped_count = 0;
-    
-    // Start listening on net where clients send values
-    for_leader = udp_receiver_new(PAXOS_SUBMIT_NET);
-    if (for_leader == NULL) {
+//Created with the proposer, values can be enqueued 
+// even if it's not the leader
+vh_state *
+vh_new(struct event_base * eb, int group, short int proposer_id) {
+    char label[PAXOS_METRIC_LABEL_SIZE];
+    
+    if ((LEADER_MAX_QUEUE_LENGTH & (LEADER_MAX_QUEUE_LENGTH -1)) != 0) {
+        printf("Error: LEADER_MAX_QUEUE_LENGTH is not a power of 2\n");
+        return NULL;
+    }
+    if ((PROPOSER_MIRROR_MAX_LENGTH & (PROPOSER_MIRROR_MAX_LENGTH -1)) != 0 ||
+        PROPOSER_MIRROR_MAX_LENGTH < LEADER_MAX_QUEUE_LENGTH) {
+        printf("Error: PROPOSER_MIRROR_MAX_LENGTH is not a power of 2 (or too small)\n");
+        return NULL;
+    }
+    
+    vh_state * vh = PAX_MALLOC(sizeof(vh_state));
+    memset(vh, 0, sizeof(vh_state));
+    vh->eb = eb;
+    vh->proposer_id = proposer_id;
+    vh->group = group;
+    vh_ring_init(vh);
+    
+    vh->mirror_size = LEADER_MAX_QUEUE_LENGTH;
+    vh->mirror = PAX_MALLOC(sizeof(vh_value_wrapper*) * vh->mirror_size);
+    memset(vh->mirror, 0, sizeof(vh_value_wrapper*) * vh->mirror_size);
+    snprintf(label, sizeof(label), "group=\"%d\",proposer=\"%d\"", 
+        group, proposer_id);
+    vh->mirror_dropped = metrics_register_label("proposer_mirror_dropped", 
+        label, metric_counter);
+    
+    vh->ch = ch_new(vh, group);
+    if(vh->ch == NULL) {
+        printf("Clients handler initialization failed\n");
+        vh_free(vh);
+        return NULL;
+    }
+    
+    // Start listening on net where clients send values,
+    // also as standby
+    vh->for_leader = udp_receiver_new(CONF_NET_GROUP(submit_net, vh->group));
+    if (vh->for_leader == NULL) {
         printf("Error creating proposer network receiver\n");
+        vh_free(vh);
+        return NULL;
+    }
+    event_set(&vh->leader_msg_event, vh->for_leader->sock, EV_READ|EV_PERSIST, vh_handle_newmsg, vh);
+    event_base_set(vh->eb, &vh->leader_msg_event);
+    event_add(&vh->leader_msg_event, NULL);    
+    return vh;
+}
+
+void
+vh_free(vh_state * vh) {
+    vh_value_wrapper * vw;
+    
+    if(vh->for_leader != NULL) {
+        event_del(&vh->leader_msg_event);
+        udp_receiver_destroy(vh->for_leader);
+    }
+    
+    //Values still pending (the leader was shut down already)
+    while ((vw = vh_get_next_pending(vh)) != NULL) {
+        PAX_FREE(vw);
+    }
+    while(vh->mirror_head != vh->mirror_tail) {
+        PAX_FREE(*GET_MIRROR_SLOT(vh, vh->mirror_head));
+        vh->mirror_head += 1;
+    }
+    PAX_FREE(vh->mirror);
+    if(vh->ch != NULL) {
+        ch_free(vh->ch);
+    }
+    PAX_FREE(vh->ring);
+    PAX_FREE(vh);
+}
+
+//Invoked when the proposer becomes leader
+int
+vh_init(vh_state * vh) {
+    if(ch_init(vh->ch) != 0) {
+        printf("Clients handler initialization failed\n");
         return -1;
     }
-    event_set(&leader_msg_event, for_leader->sock, EV_READ|EV_PERSIST, vh_handle_newmsg, NULL);
-    event_add(&leader_msg_event, NULL);    
     
+    //Create the emtpy retry list
+    vh->retry_list_size = 0;
+    vh->retry_list_bytes = 0;
+    vh->retry_list_head = NULL;
+    vh->retry_list_tail = NULL;
+    evutil_timerclear(&vh->pending_since);
+    __atomic_store_n(&vh->dropped_count, 0, __ATOMIC_RELAXED);
+    
+    //Values received as standby
+    vh->leading = 1;
+    vh->noop_target = 0;
+    vh_mirror_resume(vh);
     return 0;
 }
 
 void 
-vh_shutdown() {
-    //Delete event
-    event_del(&leader_msg_event);
-
-    //Close socket and free receiver
-    udp_receiver_destroy(for_leader);
+vh_shutdown(vh_state * vh) {
+    vh->leading = 0;
     
-    //All values in pending could not be delivered yet.
-    // Notify the respective clients
+    //Values in pending could not be delivered yet, the new leader 
+    // received them too (but the anonymous ones)
     vh_value_wrapper * vw;
-    while ((vw = vh_get_next_pending()) != NULL) {
-        vh_notify_client(-1, vw);
-        PAX_FREE(vw);        
+    while ((vw = vh_get_next_pending(vh)) != NULL) {
+        if(vw->client_id == 0) {
+            vh_notify_client(vh, PAXOS_SUBMIT_FAILED, 0, vw);
+        }
+        vh_mirror_push(vh, vw);
     }
+    
+    ch_shutdown(vh->ch);
 }
 
 
-int vh_pending_list_size() {
-    pthread_mutex_lock(&pending_list_lock);
-    int ls = vh_list_size;
-    pthread_mutex_unlock(&pending_list_lock);
-    return ls;
+//Stop waiting for lost client values (see ch_check_held)
+void vh_check_held(vh_state * vh) {
+    ch_check_held(vh->ch);
+}
+
+int vh_pending_list_size(vh_state * vh) {
+    return vh->retry_list_size + vh_ring_size(vh);
 }
 
-long unsigned int vh_get_dropped_count() {
-    pthread_mutex_lock(&pending_list_lock);
-    int dc = dropped_count;
-    pthread_mutex_unlock(&pending_list_lock);
-    return dc;
+iid_t vh_noop_target(vh_state * vh) {
+    return vh->noop_target;
 }
 
-void vh_enqueue_value(char * value, size_t value_size) {
+long unsigned int vh_get_dropped_count(vh_state * vh) {
+    return __atomic_load_n(&vh->dropped_count, __ATOMIC_RELAXED);
+}
+
+//Can be invoked by any thread. 
+// Returns PAXOS_SUBMIT_ACCEPTED, or PAXOS_SUBMIT_BUSY if the value was 
+// accepted but the queue is almost full, or PAXOS_SUBMIT_REJECTED if 
+// the queue is full and the value was dropped
+int vh_enqueue_value(vh_state * vh, unsigned int client_id, unsigned int seqno, 
+    char * value, size_t value_size) {
     
-    pthread_mutex_lock(&pending_list_lock);
     //Create wrapper
+    vh_value_wrapper * new_vw = vh_wrap_value(value, value_size);
+    new_vw->client_id = client_id;
+    new_vw->seqno = seqno;
     
-    if(vh_list_size > LEADER_MAX_QUEUE_LENGTH) {
-        pthread_mutex_unlock(&pending_list_lock);
-        LOG(VRB, ("Value dropped, list is already too long\n"));
-#ifdef LEADER_EVENTS_UPDATE_INTERVAL
-        dropped_count += 1;
-#endif
-        return;
+    int result = vh_enqueue_wrapper(vh, new_vw);
+    if(result == PAXOS_SUBMIT_REJECTED) {
+        PAX_FREE(new_vw);
     }
+    return result;
+}
+
+//Like vh_enqueue_value, for an already wrapped value.
+// If rejected, the wrapper is still owned by the caller
+int vh_enqueue_wrapper(vh_state * vh, vh_value_wrapper * vw) {
+    if(vh_ring_push(vh, vw) != 0) {
+        LOG(VRB, ("Value dropped, queue is full\n"));
+        __atomic_add_fetch(&vh->dropped_count, 1, __ATOMIC_RELAXED);
+        return PAXOS_SUBMIT_REJECTED;
+    }
+    LOG(DBG, ("Value of size %lu enqueued\n", vw->value_size));
     
-    vh_value_wrapper * new_vw = vh_wrap_value(value, value_size);
+    if(vh_ring_size(vh) >= LEADER_QUEUE_HIGH_WATERMARK) {
+        return PAXOS_SUBMIT_BUSY;
+    }
+    return PAXOS_SUBMIT_ACCEPTED;
+}
+
+//Pops the next pending value, retried ones first
+static vh_value_wrapper *
+vh_pop_next(vh_state * vh) {
+    vh_value_wrapper * vw = vh->retry_list_head;
+    
+    if(vw == NULL) {
+        return vh_ring_pop(vh);
+    }
     
-    /* List is empty*/
-	if (vh_list_head == NULL && vh_list_tail == NULL) {
-		vh_list_head = new_vw;
-		vh_list_tail = new_vw;
-        vh_list_size = 1;
+    vh->retry_list_head = vw->next;
+    if(vh->retry_list_tail == vw) {
+        vh->retry_list_tail = NULL;
+    }
+    vw->next = NULL;
+    vh->retry_list_size -= 1;
+    vh->retry_list_bytes -= CLIENT_VALUE_SIZE(vw);
+    return vw;
+}
 
-	/* List is not empty*/
-	} else {
-		vh_list_tail->next = new_vw;
-		vh_list_tail = new_vw;
-        vh_list_size += 1;
-	}
-    pthread_mutex_unlock(&pending_list_lock);
-    LOG(DBG, ("Value of size %lu enqueued\n", value_size));
+//Puts a chain of values (first...last) at the head of the retry list
+static void
+vh_retry_push_front(vh_state * vh, vh_value_wrapper * first, vh_value_wrapper * last, 
+    int count, size_t bytes) {
+    last->next = vh->retry_list_head;
+    if(vh->retry_list_tail == NULL) {
+        vh->retry_list_tail = last;
+    }
+    vh->retry_list_head = first;
+    vh->retry_list_size += count;
+    vh->retry_list_bytes += bytes;
 }
 
 vh_value_wrapper * 
-vh_get_next_pending() {
-    pthread_mutex_lock(&pending_list_lock);
+vh_get_next_pending(vh_state * vh) {
+    vh_value_wrapper * first_vw = vh_pop_next(vh);
+    if(first_vw != NULL) {
+        LOG(DBG, ("Popping value of size %lu\n", first_vw->value_size));
+    }
+    return first_vw;
+}
+
+//Returns 1 if a batch should be sent now: pending values fill a batch
+// or the oldest one waited more than leader_batch_delay
+int
+vh_batch_ready(vh_state * vh) {
+    struct timeval now;
     
-    /* List is empty*/
-	if (vh_list_head == NULL && vh_list_tail == NULL) {
-        pthread_mutex_unlock(&pending_list_lock);
-        return NULL;
+    if(vh_pending_list_size(vh) == 0) {
+        evutil_timerclear(&vh->pending_since);
+        return 0;
+    }
+    
+    if(paxos_conf.leader_batch_delay == 0 || vh->retry_list_size > 0) {
+        return 1;
+    }
+    
+    size_t bytes = sizeof(value_batch) + 
+        __atomic_load_n(&vh->ring_bytes, __ATOMIC_RELAXED);
+    if(bytes >= (size_t)paxos_conf.leader_batch_max_size) {
+        return 1;
     }
     
-    /* Pop */
-    vh_value_wrapper * first_vw = vh_list_head;
-    vh_list_head = first_vw->next;
+    //Start counting from the first time values are seen
+    gettimeofday(&now, NULL);
+    if(!evutil_timerisset(&vh->pending_since)) {
+        vh->pending_since = now;
+        return 0;
+    }
+    long int waited = ((now.tv_sec - vh->pending_since.tv_sec) * 1000000) +
+        (now.tv_usec - vh->pending_since.tv_usec);
+    return (waited >= paxos_conf.leader_batch_delay);
+}
 
-    /* Also last element */
-    if(vh_list_tail == first_vw) {
-        vh_list_tail = NULL;
+//Packs pending values (in order) in a single value_batch, 
+// up to leader_batch_max_size bytes.
+//Returns NULL if there is no pending value
+vh_value_wrapper * 
+vh_get_next_batch(vh_state * vh) {
+    vh_value_wrapper * first = NULL;
+    vh_value_wrapper * last = NULL;
+    vh_value_wrapper * vw;
+    size_t batch_size = sizeof(value_batch);
+    short int count = 0;
+    
+    //Take values until the batch is full, at least one is sent
+    while((vw = vh_pop_next(vh)) != NULL) {
+        if(count > 0 && 
+            (batch_size + CLIENT_VALUE_SIZE(vw)) > (size_t)paxos_conf.leader_batch_max_size) {
+            //Does not fit, will be the first of next batch
+            vh_retry_push_front(vh, vw, vw, 1, CLIENT_VALUE_SIZE(vw));
+            break;
+        }
+        if(first == NULL) {
+            first = vw;
+        } else {
+            last->next = vw;
+        }
+        last = vw;
+        batch_size += CLIENT_VALUE_SIZE(vw);
+        count += 1;
+    }
+    
+    if(count == 0) {
+        return NULL;
+    }
+    evutil_timerclear(&vh->pending_since);
+    
+    //Copy the values in the batch
+    vh_value_wrapper * batch_vw = PAX_MALLOC(sizeof(vh_value_wrapper) + batch_size);
+    batch_vw->value_size = batch_size;
+    batch_vw->next = NULL;
+    value_batch * vb = (value_batch *)batch_vw->value;
+    vb->count = count;
+    
+    size_t offset = 0;
+    client_value * bv;
+    while(first != NULL) {
+        vw = first;
+        first = vw->next;
+        bv = (client_value *)&vb->data[offset];
+        bv->client_id = vw->client_id;
+        bv->seqno = vw->seqno;
+        bv->value_size = vw->value_size;
+        memcpy(bv->value, vw->value, vw->value_size);
+        offset += CLIENT_VALUE_SIZE(bv);
+        PAX_FREE(vw);
     }
-    vh_list_size -= 1;
-    pthread_mutex_unlock(&pending_list_lock);
 
-    LOG(DBG, ("Popping value of size %lu\n", first_vw->value_size));
-    return first_vw;
+    LOG(DBG, ("Packed %d values in a batch of size %lu\n", count, batch_size));
+    return batch_vw;
 }
 
+//The batch could not be delivered, the values in it are 
+// put back at the head of the pending list (in the same order)
+// The batch wrapper is freed
 void 
-vh_push_back_value(vh_value_wrapper * vw) {
-    pthread_mutex_lock(&pending_list_lock);
-
-    /* Adds as list head*/
-    vw->next = vh_list_head;
-    
-    /* List is empty*/
-	if (vh_list_head == NULL && vh_list_tail == NULL) {
-		vh_list_head = vw;
-		vh_list_tail = vw;
-        vh_list_size = 1;
-
-	/* List is not empty*/
-	} else {
-		vh_list_head = vw;
-        vh_list_size += 1;
-	}
-    pthread_mutex_unlock(&pending_list_lock);
-}
-
-void vh_notify_client(unsigned int result, vh_value_wrapper * vw) {
-    // This is a stub for notifying a client that its value
-    // could not be delivered (notice that the value may actually
-    // be delivered afterward by some other proposer)
+vh_push_back_value(vh_state * vh, vh_value_wrapper * vw) {
+    value_batch * vb = (value_batch *)vw->value;
+    vh_value_wrapper * first = NULL;
+    vh_value_wrapper * last = NULL;
+    vh_value_wrapper * new_vw;
+    client_value * bv;
+    size_t offset = 0;
+    size_t bytes = 0;
+    short int i;
+    
+    //Unpack into a chain of values
+    for(i = 0; i < vb->count; i++) {
+        bv = (client_value *)&vb->data[offset];
+        new_vw = vh_wrap_value(bv->value, bv->value_size);
+        new_vw->client_id = bv->client_id;
+        new_vw->seqno = bv->seqno;
+        if(first == NULL) {
+            first = new_vw;
+        } else {
+            last->next = new_vw;
+        }
+        last = new_vw;
+        bytes += CLIENT_VALUE_SIZE(bv);
+        offset += CLIENT_VALUE_SIZE(bv);
+    }
+    PAX_FREE(vw);
+    
+    if(first != NULL) {
+        vh_retry_push_front(vh, first, last, i, bytes);
+    }
+}
+
+//Notifies the client that submitted the value of the outcome.
+// (notice that if the submit failed, the value may actually
+// be delivered afterward by some other proposer)
+void vh_notify_client(vh_state * vh, int result, iid_t iid, vh_value_wrapper * vw) {
     if(result != 0) {
         LOG(DBG, ("Notify client -> Submit failed\n"));
     } else {
         LOG(DBG, ("Notify client -> Submit successful\n"));
     }
+    ch_notify(vh->ch, vw->client_id, vw->seqno, iid, result);
 }
 
-void pax_submit_sharedmem(char* value, size_t val_size) {
-    vh_enqueue_value(value, val_size);
+//Like vh_notify_client, for each value packed in the given batch
+void vh_notify_batch(vh_state * vh, int result, iid_t iid, vh_value_wrapper * vw) {
+    value_batch * vb = (value_batch *)vw->value;
+    client_value * cv;
+    size_t offset = 0;
+    short int i;
+    
+    for(i = 0; i < vb->count; i++) {
+        cv = (client_value *)&vb->data[offset];
+        ch_notify(vh->ch, cv->client_id, cv->seqno, iid, result);
+        offset += CLIENT_VALUE_SIZE(cv);
+    }
 }
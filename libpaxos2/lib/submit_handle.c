@@ -1,28 +1,236 @@
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include "libpaxos.h"
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
 
+//Random nonzero id for this handle, used by the leader to 
+// identify the client. Does not touch the random() state of the 
+// application
+static unsigned int
+submit_random_client_id() {
+    struct timeval tv;
+    unsigned int seed, id;
+    
+    gettimeofday(&tv, NULL);
+    seed = ((unsigned int)getpid() << 16) ^ 
+        (unsigned int)tv.tv_sec ^ (unsigned int)tv.tv_usec;
+    id = seed;
+    id ^= ((unsigned int)rand_r(&seed) << 1);
+    return (id == 0 ? 1 : id);
+}
+
+paxos_submit_handle * pax_submit_handle_init_proposer(int proposer_id) {
+    paxos_submit_handle * psh = pax_submit_handle_init();
+    if(psh == NULL) {
+        return NULL;
+    }
+#ifdef PAXOS_MULTI_LEADER
+    //Values are handled by proposer (client_id % N_OF_LEADERS)
+    psh->client_id -= (psh->client_id % N_OF_LEADERS);
+    psh->client_id += (proposer_id % N_OF_LEADERS);
+    if(psh->client_id == 0) {
+        psh->client_id = N_OF_LEADERS;
+    }
+#else
+    UNUSED_ARG(proposer_id);
+#endif
+    return psh;
+}
+
 paxos_submit_handle * pax_submit_handle_init() {
+    return pax_submit_handle_init_group(0);
+}
+
+paxos_submit_handle * pax_submit_handle_init_group(int group) {
     //TODO print errors, 
+    if(paxos_config_ready() != 0) {
+        return NULL;
+    }
+    if(group < 0 || group >= paxos_conf.groups) {
+        printf("Invalid group:%d\n", group);
+        return NULL;
+    }
     paxos_submit_handle * psh = malloc(sizeof(paxos_submit_handle));
     if(psh == NULL) {
         return NULL;
     }
     
-    psh->sendbuf = udp_sendbuf_new(PAXOS_SUBMIT_NET);
-    if(psh->sendbuf == NULL) {
+#ifdef PAXOS_FAST_MODE
+    //Values go directly to the acceptors
+    udp_send_buffer * sb = udp_sendbuf_new(CONF_NET_GROUP(acceptors_net, group));
+#else
+    udp_send_buffer * sb = udp_sendbuf_new(CONF_NET_GROUP(submit_net, group));
+#endif
+    if(sb == NULL) {
+        free(psh);
         return NULL;
     }
+    psh->sendbuf = sb;
+    
+    //The leader replies to the address the submit came from,
+    // replies are therefore read from the sender socket
+    udp_receiver * rec = malloc(sizeof(udp_receiver));
+    if(rec == NULL) {
+        udp_sendbuf_destroy(sb);
+        free(psh);
+        return NULL;
+    }
+    rec->sock = sb->sock;
+    psh->replies = rec;
+    
+    psh->client_id = submit_random_client_id();
+    psh->next_seqno = 1;
+    psh->pending = 0;
     
     return psh;
 }
 
+//FNV-1a, the same on every client
+int pax_group_of_key(const char * key, size_t size) {
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619U;
+    }
+    return (int)(hash % (uint32_t)paxos_conf.groups);
+}
+
+int pax_submit_membership(paxos_submit_handle * h, unsigned int members, 
+    int phase1_quorum, int phase2_quorum, int fast_quorum) {
+    membership_cmd mc;
+    int n = __builtin_popcount(members);
+    
+    if(n == 0 || (members & ~ALL_ACCEPTORS) != 0) {
+        printf("Invalid membership:%x\n", members);
+        return -1;
+    }
+    if(paxos_quorums_check(n, &phase1_quorum, &phase2_quorum, &fast_quorum) != 0) {
+        return -1;
+    }
+    
+    mc.members = members;
+    mc.phase1_quorum = phase1_quorum;
+    mc.phase2_quorum = phase2_quorum;
+    mc.fast_quorum = fast_quorum;
+    
+    //Sent with the values already pending, not sequenced
+    if(!h->pending) {
+        sendbuf_clear((udp_send_buffer*)h->sendbuf, submit, 0);
+        h->pending = 1;
+    }
+    sendbuf_add_submit_val((udp_send_buffer*)h->sendbuf, MEMBERSHIP_CLIENT_ID, 
+        0, (char*)&mc, sizeof(membership_cmd));
+    pax_submit_flush(h);
+    return 0;
+}
+
+//Returns 1 if the values held by the handle should be sent
+static int
+submit_window_expired(paxos_submit_handle * h) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long elapsed = (now.tv_sec - h->pending_since.tv_sec) * 1000000 + 
+        (now.tv_usec - h->pending_since.tv_usec);
+    return (elapsed >= paxos_conf.client_coalesce_delay);
+}
+
 int pax_submit_nonblock(paxos_submit_handle * h, char * value, size_t val_size) {
-    udp_send_buffer* sb = (udp_send_buffer*)h->sendbuf;
-    sendbuf_clear(sb, submit, 0);
-    sendbuf_add_submit_val(sb, value, val_size);
-    sendbuf_flush(sb);
+    pax_submit_async(h, value, val_size);
+    pax_submit_flush(h);
     return 0;
 }
+
+void pax_submit_flush(paxos_submit_handle * h) {
+    if(h->pending) {
+        sendbuf_flush((udp_send_buffer*)h->sendbuf);
+        h->pending = 0;
+    }
+}
+
+paxos_ticket pax_submit_async(paxos_submit_handle * h, char * value, size_t val_size) {
+    udp_send_buffer* sb = (udp_send_buffer*)h->sendbuf;
+    
+    if(val_size > PAXOS_MAX_VALUE_SIZE) {
+        printf("Value too big (%lu bytes)\n", val_size);
+        return 0;
+    }
+    
+    //0 is not a valid ticket
+    paxos_ticket t = h->next_seqno;
+    h->next_seqno += 1;
+    if(h->next_seqno == 0) {
+        h->next_seqno = 1;
+    }
+    
+    //Open a new submit message, the sendbuf sends it
+    // by itself when the next value does not fit
+    if(!h->pending) {
+        sendbuf_clear(sb, submit, 0);
+        gettimeofday(&h->pending_since, NULL);
+        h->pending = 1;
+    }
+    sendbuf_add_submit_val(sb, h->client_id, t, value, val_size);
+    
+    if(submit_window_expired(h)) {
+        pax_submit_flush(h);
+    }
+    return t;
+}
+
+void pax_submit_retry(paxos_submit_handle * h, paxos_ticket t, char * value, size_t val_size) {
+    udp_send_buffer* sb = (udp_send_buffer*)h->sendbuf;
+    
+    if(!h->pending) {
+        sendbuf_clear(sb, submit, 0);
+        gettimeofday(&h->pending_since, NULL);
+        h->pending = 1;
+    }
+    sendbuf_add_submit_val(sb, h->client_id, t, value, val_size);
+    pax_submit_flush(h);
+}
+
+int pax_submit_fd(paxos_submit_handle * h) {
+    return ((udp_receiver*)h->replies)->sock;
+}
+
+int pax_submit_poll(paxos_submit_handle * h, submit_callback cb, void * arg) {
+    udp_receiver * rec = (udp_receiver*)h->replies;
+    int count = 0;
+    int ret;
+    
+    if(h->pending && submit_window_expired(h)) {
+        pax_submit_flush(h);
+    }
+    
+    while((ret = udp_try_read_next_message(rec)) != 1) {
+        //Would fail again at each iteration
+        if(ret == -2) {
+            return -1;
+        }
+        if(ret < 0) {
+            printf("Dropping invalid submit reply\n");
+            continue;
+        }
+        
+        paxos_msg * msg = (paxos_msg*) &rec->recv_buffer;
+        if(msg->type != submit_reply) {
+            printf("Unknow msg type %d received\n", msg->type);
+            continue;
+        }
+        
+        submit_reply_msg * sr = (submit_reply_msg *)msg->data;
+        //Reply for a different handle
+        if(sr->client_id != h->client_id) {
+            continue;
+        }
+        
+        cb(sr->seqno, sr->result, sr->iid, arg);
+        count++;
+    }
+    
+    return count;
+}
@@ -2,9 +2,37 @@
 #include <memory.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
+#include "paxos_metrics.h"
+
+static paxos_metric * m_received = NULL;
+static paxos_metric * m_received_bytes;
+static paxos_metric * m_invalid;
+
+static void
+udp_receiver_metrics_init() {
+    if(m_received != NULL) {
+        return;
+    }
+    m_received_bytes = metrics_register("udp_received_bytes", metric_counter);
+    m_invalid = metrics_register("udp_invalid_msgs", metric_counter);
+    m_received = metrics_register("udp_received_msgs", metric_counter);
+}
+
+//Counts a message read from the socket
+static int
+udp_receiver_count(int msg_size, int valid) {
+    udp_receiver_metrics_init();
+    METRIC_INC(m_received);
+    METRIC_ADD(m_received_bytes, msg_size);
+    if(valid != 0) {
+        METRIC_INC(m_invalid);
+    }
+    return valid;
+}
 
 //Calculate size of dynamic structure by iterating
 size_t prepare_ack_batch_size_calc(prepare_ack_batch * pab) {
@@ -132,7 +160,31 @@ static int validate_paxos_msg(paxos_msg * m, size_t msg_size) {
         break;
 
         case submit: {
-            expected_size += m->data_size;
+            //Values are sent by clients, check bounds before 
+            // reading each of them
+            value_batch * vb = (value_batch *)m->data;
+            size_t offset = sizeof(value_batch);
+            client_value * cv;
+            short int i;
+            if(m->data_size < sizeof(value_batch)) {
+                printf("Invalid submit message\n");
+                return -1;
+            }
+            for(i = 0; i < vb->count; i++) {
+                cv = (client_value *)&m->data[offset];
+                if(offset + sizeof(client_value) > m->data_size || 
+                    offset + CLIENT_VALUE_SIZE(cv) > m->data_size) {
+                    printf("Invalid submit message, value %d truncated\n", i);
+                    return -1;
+                }
+                offset += CLIENT_VALUE_SIZE(cv);
+            }
+            expected_size += offset;
+        }
+        break;
+
+        case submit_reply: {
+            expected_size += sizeof(submit_reply_msg);
         }
         break;
         
@@ -176,7 +228,7 @@ void print_paxos_msg(paxos_msg * msg) {
             prepare_req * pr;
             for(i = 0; i < prb->count; i++) {
                 pr = (prepare_req *) &prb->prepares[i];
-                printf("\n (%d) iid:%u bal:%u ", 
+                printf("\n (%d) iid:%"IID_FMT" bal:%"BALLOT_FMT" ", 
                     (int)i, pr->iid, pr->ballot);
             }
 
@@ -191,7 +243,7 @@ void print_paxos_msg(paxos_msg * msg) {
             prepare_ack * pa;
             for(i = 0; i < pab->count; i++) {
                 pa = (prepare_ack *) &pab->data[offset];
-                printf("\n (%p)(%d) iid:%u bal:%u vbal:%u val_size:%lu", 
+                printf("\n (%p)(%d) iid:%"IID_FMT" bal:%"BALLOT_FMT" vbal:%"BALLOT_FMT" val_size:%lu", 
                     (void*)pa, (int)i, pa->iid, pa->ballot, 
                     pa->value_ballot, pa->value_size);
                 offset += PREPARE_ACK_SIZE(pa);
@@ -208,7 +260,7 @@ void print_paxos_msg(paxos_msg * msg) {
             accept_req * ar;
             for(i = 0; i < arb->count; i++) {
                 ar = (accept_req *) &arb->data[offset];
-                printf("\n (%d) iid:%u bal:%u val_size:%lu", 
+                printf("\n (%d) iid:%"IID_FMT" bal:%"BALLOT_FMT" val_size:%lu", 
                     (int)i, ar->iid, ar->ballot, ar->value_size);
                 offset += ACCEPT_REQ_SIZE(ar);
             }
@@ -223,7 +275,7 @@ void print_paxos_msg(paxos_msg * msg) {
             accept_ack * aa;
             for(i = 0; i < aab->count; i++) {
                 aa = (accept_ack *) &aab->data[offset];
-                printf("\n (%d) iid:%u bal:%u vbal:%u val_size:%lu", 
+                printf("\n (%d) iid:%"IID_FMT" bal:%"BALLOT_FMT" vbal:%"BALLOT_FMT" val_size:%lu", 
                     (int)i, aa->iid, aa->ballot, 
                     aa->value_ballot, aa->value_size);
                 offset += ACCEPT_ACK_SIZE(aa);
@@ -236,7 +288,7 @@ void print_paxos_msg(paxos_msg * msg) {
             printf("(repeat request batch)\n");
             printf(" count:%d\n", rrb->count);
             for(i = 0; i < rrb->count; i++) {
-                printf("\n (%d) iid:%u ", 
+                printf("\n (%d) iid:%"IID_FMT" ", 
                     (int)i, rrb->requests[i]);
             }
         }
@@ -253,6 +305,15 @@ void print_paxos_msg(paxos_msg * msg) {
 udp_receiver * udp_receiver_blocking_new(char* address_string, int port) {
     udp_receiver * rec = PAX_MALLOC(sizeof(udp_receiver));
 
+    //Simulated network, messages come from the simulator
+    if(sim_is_active()) {
+        if(sim_receiver_open(rec, address_string, port) != 0) {
+            PAX_FREE(rec);
+            return NULL;
+        }
+        return rec;
+    }
+
     struct ip_mreq mreq;
     
     memset(&mreq, '\0', sizeof(struct ip_mreq));
@@ -326,6 +387,10 @@ udp_receiver * udp_receiver_new(char* address_string, int port) {
 int udp_receiver_destroy(udp_receiver * rec) {
     int ret = 0;
     
+    if(sim_is_active()) {
+        sim_receiver_close(rec);
+    }
+    
     // Close the socket
     if (close(rec->sock) != 0) {
         printf("Error closing socket\n");
@@ -361,5 +426,33 @@ int udp_read_next_message(udp_receiver * recv_info) {
         return -1;
     }
     
-    return validate_paxos_msg((paxos_msg*)recv_info->recv_buffer, msg_size);
+    return udp_receiver_count(msg_size, 
+        validate_paxos_msg((paxos_msg*)recv_info->recv_buffer, msg_size));
+}
+
+//Like udp_read_next_message, but does not wait if no message
+// is available in the system buffer.
+// Returns 0 for a valid message, 1 for no message, -1 for an invalid 
+// message, -2 if the socket cannot be read
+int udp_try_read_next_message(udp_receiver * recv_info) {
+    
+    //Get the message
+    socklen_t addrlen = sizeof(struct sockaddr);
+    int msg_size = recvfrom(recv_info->sock,    //Socket to read from
+        recv_info->recv_buffer,                 //Where to store the msg
+        MAX_UDP_MSG_SIZE,                       //Size of buffer
+        MSG_DONTWAIT,                           //Do not block
+        (struct sockaddr *)&recv_info->addr,    //Address
+        &addrlen);                              //Address length
+
+    if (msg_size < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 1;
+        }
+        perror("recvfrom");
+        return -2;
+    }
+    
+    return udp_receiver_count(msg_size, 
+        validate_paxos_msg((paxos_msg*)recv_info->recv_buffer, msg_size));
 }
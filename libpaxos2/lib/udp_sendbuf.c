@@ -2,10 +2,32 @@
 #include <memory.h>
 #include <stdio.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "libpaxos_priv.h"
 #include "paxos_udp.h"
 #include "acceptor_stable_storage.h"
+#include "paxos_metrics.h"
+
+static paxos_metric * m_sent = NULL;
+static paxos_metric * m_sent_bytes;
+static paxos_metric * m_send_errors;
+
+//Counts a message written to the socket
+static void
+sendbuf_count(int cnt, size_t msg_size) {
+    if(m_sent == NULL) {
+        m_sent_bytes = metrics_register("udp_sent_bytes", metric_counter);
+        m_send_errors = metrics_register("udp_send_errors", metric_counter);
+        m_sent = metrics_register("udp_sent_msgs", metric_counter);
+    }
+    if(cnt != (int)msg_size) {
+        METRIC_INC(m_send_errors);
+        return;
+    }
+    METRIC_INC(m_sent);
+    METRIC_ADD(m_sent_bytes, msg_size);
+}
 
 /*
     This module automates sending of UDP messages, when data is added to an "open" message,
@@ -39,6 +61,7 @@ void sendbuf_clear(udp_send_buffer * sb, paxos_msg_code type, short int sender_i
             accept_req_batch * arb = (accept_req_batch *)&m->data;
             arb->count = 0;
             arb->proposer_id = sender_id;
+            arb->acceptors = ALL_ACCEPTORS;
         } break;
 
         //Acceptor
@@ -65,7 +88,9 @@ void sendbuf_clear(udp_send_buffer * sb, paxos_msg_code type, short int sender_i
 
         //Client
         case submit: {
-            m->data_size += 0;
+            m->data_size += sizeof(value_batch);
+            value_batch * vb = (value_batch *)&m->data;
+            vb->count = 0;
         } break;
             
         default: {            
@@ -100,7 +125,7 @@ void sendbuf_add_prepare_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot) {
 }
 
 //Adds a prepare_ack to the current message (a prepare_ack_batch)
-void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec) {
+void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec, acceptor_storage * s, iid_t highest_accepted) {
     paxos_msg * m = (paxos_msg *) &sb->buffer;
     assert(m->type == prepare_acks);    
 
@@ -110,16 +135,17 @@ void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec) {
     if(PAXOS_MSG_SIZE(m) + pa_size >= MAX_UDP_MSG_SIZE) {
         // Next propose_ack to add does not fit, flush the current 
         // message before adding it
-        stablestorage_tx_end();
+        stablestorage_tx_end(s);
         sendbuf_flush(sb);
         sendbuf_clear(sb, m->type, pab->acceptor_id);
-        stablestorage_tx_begin();
+        stablestorage_tx_begin(s);
     }
     
     prepare_ack * pa = (prepare_ack *)&m->data[m->data_size];
     pa->iid = rec->iid;
     pa->ballot = rec->ballot;
     pa->value_ballot = rec->value_ballot;
+    pa->highest_accepted_iid = highest_accepted;
     pa->value_size = rec->value_size;
     
     //If there's no value this copies 0 bytes!
@@ -130,6 +156,14 @@ void sendbuf_add_prepare_ack(udp_send_buffer * sb, acceptor_record * rec) {
 
 }
 
+//Sets the acceptors that should handle the current accept_req_batch
+void sendbuf_set_acceptors(udp_send_buffer * sb, unsigned int acceptors) {
+    paxos_msg * m = (paxos_msg *) &sb->buffer;
+    assert(m->type == accept_reqs);
+    accept_req_batch * arb = (accept_req_batch *)&m->data;
+    arb->acceptors = acceptors;
+}
+
 void sendbuf_add_accept_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot, char * value, size_t val_size) {
     paxos_msg * m = (paxos_msg *) &sb->buffer;
     assert(m->type == accept_reqs);
@@ -141,8 +175,10 @@ void sendbuf_add_accept_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot, ch
     if(PAXOS_MSG_SIZE(m) + ar_size >= MAX_UDP_MSG_SIZE) {
         // Next accept to add does not fit, flush the current 
         // message before adding it
+        unsigned int acceptors = arb->acceptors;
         sendbuf_flush(sb);
         sendbuf_clear(sb, m->type, arb->proposer_id);
+        arb->acceptors = acceptors;
     }
 
     accept_req * ar = (accept_req *)&m->data[m->data_size];
@@ -159,7 +195,7 @@ void sendbuf_add_accept_req(udp_send_buffer * sb, iid_t iid, ballot_t ballot, ch
 
 
 //Adds an accept_ack to the current message (an accept_ack_batch)
-void sendbuf_add_accept_ack(udp_send_buffer * sb, acceptor_record * rec) {    
+void sendbuf_add_accept_ack(udp_send_buffer * sb, acceptor_record * rec, acceptor_storage * s) {    
     paxos_msg * m = (paxos_msg *) &sb->buffer;
     assert(m->type == accept_acks);
 
@@ -170,10 +206,10 @@ void sendbuf_add_accept_ack(udp_send_buffer * sb, acceptor_record * rec) {
     if(PAXOS_MSG_SIZE(m) + aa_size >= MAX_UDP_MSG_SIZE) {
         // Next accept to add does not fit, flush the current 
         // message before adding it
-        stablestorage_tx_end();
+        stablestorage_tx_end(s);
         sendbuf_flush(sb);
         sendbuf_clear(sb, m->type, aab->acceptor_id);
-        stablestorage_tx_begin();
+        stablestorage_tx_begin(s);
     }
     
 
@@ -206,13 +242,59 @@ void sendbuf_add_repeat_req(udp_send_buffer * sb, iid_t iid) {
     rrb->count += 1;
 }
 
-void sendbuf_add_submit_val(udp_send_buffer * sb, char * value, size_t val_size) {
+void sendbuf_add_submit_val(udp_send_buffer * sb, unsigned int client_id, 
+    unsigned int seqno, char * value, size_t val_size) {
     paxos_msg * m = (paxos_msg *) &sb->buffer;
     assert(m->type == submit);
 
+    if(PAXOS_MSG_SIZE(m) + sizeof(client_value) + val_size >= MAX_UDP_MSG_SIZE) {
+        // Next value to add does not fit, flush the current 
+        // message before adding it
+        sendbuf_flush(sb);
+        sendbuf_clear(sb, m->type, -1);
+    }
+
+    value_batch * vb = (value_batch *)&m->data;
+    client_value * cv = (client_value *)&m->data[m->data_size];
+    cv->client_id = client_id;
+    cv->seqno = seqno;
+    cv->value_size = val_size;
+    memcpy(cv->value, value, val_size);
+
     sb->dirty = 1;
-    m->data_size += val_size;
-    memcpy(m->data, value, val_size);
+    m->data_size += CLIENT_VALUE_SIZE(cv);
+    vb->count += 1;
+}
+
+//Sends a submit_reply to the given address 
+// (instead of the address the sendbuf was created for)
+void sendbuf_send_submit_reply(udp_send_buffer * sb, struct sockaddr_in * dest, 
+    unsigned int client_id, unsigned int seqno, iid_t iid, int result) {
+    paxos_msg * m = (paxos_msg *) &sb->buffer;
+    m->type = submit_reply;
+    m->data_size = sizeof(submit_reply_msg);
+    submit_reply_msg * sr = (submit_reply_msg *) m->data;
+    sr->client_id = client_id;
+    sr->seqno = seqno;
+    sr->iid = iid;
+    sr->result = result;
+    
+    int cnt;
+    if(sim_is_active()) {
+        cnt = sim_send(dest, sb->buffer, PAXOS_MSG_SIZE(m));
+    } else {
+        cnt = sendto(sb->sock,          //Sock
+            sb->buffer,                     //Data
+            PAXOS_MSG_SIZE(m),              //Data size
+            0,                              //Flags
+            (struct sockaddr *)dest,        //Addr
+            sizeof(struct sockaddr_in));    //Addr size
+    }
+        
+    sendbuf_count(cnt, PAXOS_MSG_SIZE(m));
+    if (cnt != (int)PAXOS_MSG_SIZE(m)) {
+        perror("failed to send submit reply");
+    }
 }
 
 void sendbuf_send_ping(udp_send_buffer * sb, short int proposer_id, long unsigned int sequence_number) {
@@ -252,13 +334,19 @@ void sendbuf_flush(udp_send_buffer * sb) {
     
     //Send the current message in buffer
     paxos_msg * m = (paxos_msg *) &sb->buffer;
-    cnt = sendto(sb->sock,              //Sock
-        sb->buffer,                     //Data
-        PAXOS_MSG_SIZE(m),              //Data size
-        0,                              //Flags
-        (struct sockaddr *)&sb->addr,   //Addr
-        sizeof(struct sockaddr_in));    //Addr size
+    if(sim_is_active()) {
+        //Simulated network, see paxos_sim.c
+        cnt = sim_send(&sb->addr, sb->buffer, PAXOS_MSG_SIZE(m));
+    } else {
+        cnt = sendto(sb->sock,              //Sock
+            sb->buffer,                     //Data
+            PAXOS_MSG_SIZE(m),              //Data size
+            0,                              //Flags
+            (struct sockaddr *)&sb->addr,   //Addr
+            sizeof(struct sockaddr_in));    //Addr size
+    }
         
+    sendbuf_count(cnt, PAXOS_MSG_SIZE(m));
     if (cnt != (int)PAXOS_MSG_SIZE(m) || cnt == -1) {
         perror("failed to send message");
     }
@@ -311,3 +399,20 @@ udp_send_buffer * udp_sendbuf_new(char* address_string, int port) {
     return sb;
 }
     
+
+//Destroys the given UDP sender
+int udp_sendbuf_destroy(udp_send_buffer * sb) {
+    int ret = 0;
+    
+    // Close the socket
+    if (close(sb->sock) != 0) {
+        printf("Error closing socket\n");
+        perror("close");
+        ret = -1;
+    }
+    LOG(DBG, ("Socket %d closed\n", sb->sock));
+    
+    //Free the structure
+    PAX_FREE(sb);
+    return ret;
+}
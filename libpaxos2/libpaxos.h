@@ -2,26 +2,135 @@
 #define _LIBPAXOS_H_
 #include <sys/types.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <sys/time.h>
 #include "paxos_config.h"
 
 /* 
     The maximum size that can be submitted by a client.
     Set MAX_UDP_MSG_SIZE in config file to reflect your network MTU.
     Max packet size minus largest header possible
-    (should be accept_ack_batch+accept_ack, around 30 bytes)
+    (should be accept_ack_batch+accept_ack plus the headers of the 
+    instance value batch, around 60 bytes)
 */
-#define PAXOS_MAX_VALUE_SIZE (MAX_UDP_MSG_SIZE - 40)
+#define PAXOS_MAX_VALUE_SIZE (MAX_UDP_MSG_SIZE - 64)
 
 /* 
     Alias for instance identificator and ballot number.
+    Both are 64 bits, so that they never wrap around in a long-lived log.
+    Use the IID_FMT/BALLOT_FMT when printing them, i.e.:
+    printf("Instance %"IID_FMT" delivered\n", iid);
 */
-typedef unsigned int ballot_t;
-typedef uint32_t iid_t;
+typedef uint64_t ballot_t;
+typedef uint64_t iid_t;
+#define IID_FMT PRIu64
+#define BALLOT_FMT PRIu64
+
+/*
+    Multicast <address, port> of a group
+*/
+typedef struct paxos_net_t {
+    char    addr[16];
+    int     port;
+} paxos_net;
+
+/*
+    Runtime configuration, shared by all the roles in this process.
+    Defaults are the values in paxos_config.h, see there for the meaning
+    of each field. The configuration can be changed only before
+    starting any role, either by setting the fields directly or by
+    loading a file (see pax_config_load). If the environment variable
+    PAXOS_CONFIG is set, the file it names is loaded at init, unless
+    pax_config_load was already invoked.
+    N_OF_ACCEPTORS is the maximum for acceptors, the per-instance
+    tables are sized at compile time.
+    A quorum set to 0 is computed from the number of acceptors.
+    Acceptors and quorums are the initial membership (acceptors 
+    0...acceptors-1), it can be changed later trough the log
+    (see pax_submit_membership).
+*/
+typedef struct paxos_config_t {
+    int         acceptors;
+    int         phase1_quorum;
+    int         phase2_quorum;
+    int         fast_quorum;
+
+    int         proposer_array_size;
+    int         learner_array_size;
+
+    int         preexec_win_size;
+    int         p2_window_initial;
+    int         p2_window_min;
+    int         p2_window_max;
+    int         p2_latency_factor;
+
+    //Timeouts and intervals in microseconds
+    // (but acceptor_repeat_interval, in seconds)
+    long        p1_timeout_initial;
+    long        p1_timeout_min;
+    long        p1_timeout_max;
+    long        p2_timeout_initial;
+    long        p2_timeout_min;
+    long        p2_timeout_max;
+    long        p2_check_interval;
+    long        multi_leader_revoke_timeout;
+    long        leader_lease;
+    long        leader_lease_margin;
+    long        leader_client_reorder_timeout;
+    long        leader_batch_delay;
+    long        client_coalesce_delay;
+    long        learner_holecheck_interval;
+    long        ping_interval;
+    long        oracle_min_stddev;
+    long        acceptor_repeat_interval;
+
+    int         leader_batch_max_size;
+    int         thrifty_rotate;
+    int         oracle_phi_threshold;
+
+    int         durability_mode;
+    //%d is replaced by the acceptor id
+    char        acceptor_db_path[256];
+    char        acceptor_db_fname[256];
+
+    paxos_net   learners_net;
+    paxos_net   acceptors_net;
+    paxos_net   proposers_net;
+    paxos_net   submit_net;
+    paxos_net   oracle_net;
+    paxos_net   pings_net;
+
+    int         groups;
+    int         group_port_stride;
+    long        learner_merged_noop_interval;
+
+    int         membership_alpha;
+} paxos_config;
+
+/*
+    Returns the configuration of this process, to be modified
+    before starting any role.
+*/
+paxos_config * pax_config();
+
+/*
+    Loads the configuration from a file, overriding the current values.
+    Each line is a field name and its value, '#' starts a comment, i.e.:
+        acceptors 5
+        phase2_quorum 2
+        acceptors_net 239.1.0.1:6002
+    The configuration is checked when the first role starts.
+    Returns 0 if successful, -1 for error (the error is printed)
+*/
+int pax_config_load(const char * path);
 
 /* 
     When starting a learner you must pass a function to be invoked whenever
     a value is delivered.
     This defines the type of such function.
+    The leader may pack multiple client values in the same instance,
+    in that case the function is invoked once for each of them, 
+    in order, with the same iid.
     Example: 
     void my_deliver_fun(char * value, size_t size, iid_t iid, ballot_t ballot, int proposer) {
         ...
@@ -59,6 +168,21 @@ typedef int (* custom_init_function)(void);
 */
 int learner_init(deliver_function f, custom_init_function cif);
 
+/*
+    Values resubmitted by a client (with pax_submit_retry) may be 
+    decided in more than one instance: learners remember the last 
+    values delivered for each client and deliver each of them once.
+    The application should store this table together with its own 
+    snapshots, and restore it before calling learner_init.
+    Save must be called from within the deliver function, so that the
+    table includes exactly the values delivered until then.
+    buf must be learner_dedup_state_size() bytes.
+    Restore returns -1 if the size does not match.
+*/
+size_t learner_dedup_state_size();
+void learner_dedup_state_save(char * buf);
+int learner_dedup_state_restore(char * buf, size_t size);
+
 /*
     Starts an acceptor and returns when the initialization is complete.
     Return value is 0 if successful
@@ -73,6 +197,15 @@ int acceptor_init(int acceptor_id);
 */
 int acceptor_init_recover(int acceptor_id);
 
+/*
+    Starts an acceptor that is being added to the membership
+    (see pax_submit_membership), with a clean DB. It learns the 
+    values decided before it joined and stores them as final, 
+    so that it can retransmit them like the other acceptors.
+    Return value is 0 if successful
+*/
+int acceptor_init_join(int acceptor_id);
+
 /*
     Shuts down the acceptor in the current process.
     It may take a few seconds to complete since the DB needs to be closed.
@@ -99,11 +232,28 @@ int proposer_init(int proposer_id);
 */
 int proposer_init_cif(int proposer_id, custom_init_function cif);
 
+/*
+    Starts the leader election oracle, returns when the initialization 
+    is complete. It receives the alive pings of the proposers and 
+    suspects a proposer when its pings are late, with respect to 
+    the intervals between its previous pings (see ORACLE_PHI_THRESHOLD
+    in config). The leader is the live proposer with the lowest id,
+    it's announced to the proposers when it changes (or when some 
+    proposer starts pinging).
+    Return value is 0 if successful
+*/
+int oracle_init();
+
 /*
     This is returned to the when creating a new submit handle
 */
 typedef struct paxos_submit_handle_t {
     void * sendbuf;
+    void * replies;
+    unsigned int client_id;
+    unsigned int next_seqno;
+    int pending;
+    struct timeval pending_since;
 } paxos_submit_handle;
 
 /*
@@ -113,12 +263,285 @@ typedef struct paxos_submit_handle_t {
 */
 paxos_submit_handle * pax_submit_handle_init();
 
+/*
+    Like pax_submit_handle_init, but the values submitted are handled 
+    by the given proposer (with PAXOS_MULTI_LEADER), i.e. to spread 
+    clients among the leaders.
+*/
+paxos_submit_handle * pax_submit_handle_init_proposer(int proposer_id);
+
+/*
+    Like pax_submit_handle_init, the values are submitted to the 
+    given group (see "Groups" below).
+*/
+paxos_submit_handle * pax_submit_handle_init_group(int group);
+
+/*
+    Returns the group that handles the given key, between 0 and 
+    groups-1. Clients with one handle per group can route each value 
+    by its key, so that all the values with the same key are ordered
+    by the same group.
+*/
+int pax_group_of_key(const char * key, size_t size);
+
+/*
+    Submits a change of the acceptors membership trough the handle.
+    Bit i of members is set if acceptor i is a member, the quorums 
+    are for the new members (0 to compute them as for acceptors in 
+    the config). Like any other value, the change is decided in some 
+    instance i: all proposers and learners switch to the new members 
+    and quorums from instance i + membership_alpha.
+    The result is not notified to the handle, the change applies 
+    once even if it's submitted more times.
+    A new acceptor should start with acceptor_init_join, before 
+    the change applies. An acceptor that lost its DB must not rejoin 
+    with the same id, unless it's removed and then added again.
+    Returns -1 if the membership or the quorums are not valid.
+*/
+int pax_submit_membership(paxos_submit_handle * h, unsigned int members, 
+    int phase1_quorum, int phase2_quorum, int fast_quorum);
+
 /*
     This call sends a value to the current leader and returns immediately.
     There is no guarantee that the value even reached the leader.
+    Values previously submitted with pax_submit_async are sent too.
 */
 int pax_submit_nonblock(paxos_submit_handle * h, char * value, size_t val_size);
 
-void pax_submit_sharedmem(char* value, size_t val_size);
+/*
+    Identifies a value submitted with pax_submit_async, 
+    it is never 0.
+*/
+typedef unsigned int paxos_ticket;
+
+/*
+    Outcome of a value submitted with pax_submit_async.
+    COMMITTED means that the value was delivered in instance iid.
+    FAILED means that the leader dropped the value (i.e. it lost
+    leadership), the value may or may not be delivered later.
+    REJECTED (see below) means the leader queue was full.
+*/
+#define PAXOS_SUBMIT_COMMITTED 0
+#define PAXOS_SUBMIT_FAILED (-2)
+
+/*
+    Invoked by pax_submit_poll for each submit reply received, 
+    arg is the pointer passed to pax_submit_poll.
+    iid is meaningful only if result is PAXOS_SUBMIT_COMMITTED.
+*/
+typedef void (* submit_callback)(paxos_ticket, int result, iid_t iid, void * arg);
+
+/*
+    Like pax_submit_nonblock, but returns a ticket that identifies
+    the value in the replies of the leader (0 for error).
+    Replies are not retransmitted: if none arrives within some time,
+    the value (or the reply) was lost.
+    The value may be held in the handle for up to 
+    CLIENT_SUBMIT_COALESCE_DELAY, to be sent together with the next ones.
+*/
+paxos_ticket pax_submit_async(paxos_submit_handle * h, char * value, size_t val_size);
+
+/*
+    Submits again the value identified by the ticket (i.e. if no reply
+    was received for it). The value is proposed again, if it was
+    already decided learners deliver it only once (see 
+    learner_dedup_state_save).
+    In both cases the reply refers to the instance of the new copy.
+*/
+void pax_submit_retry(paxos_submit_handle * h, paxos_ticket t, char * value, size_t val_size);
+
+/*
+    Sends the values held by the handle, if any.
+*/
+void pax_submit_flush(paxos_submit_handle * h);
+
+/*
+    Returns a file descriptor that becomes readable when
+    some reply is available, can be used with select/poll/libevent
+*/
+int pax_submit_fd(paxos_submit_handle * h);
+
+/*
+    Reads all the replies available without blocking, and invokes
+    cb for each one of them. Also flushes the handle if the 
+    coalescing window expired.
+    Returns the number of replies processed, -1 for error
+*/
+int pax_submit_poll(paxos_submit_handle * h, submit_callback cb, void * arg);
+
+/*
+    Return values of pax_submit_sharedmem.
+    BUSY means that the value was accepted, but the leader queue is
+    almost full: the caller should slow down.
+    REJECTED means that the queue is full and the value was dropped:
+    the caller should retry later.
+*/
+#define PAXOS_SUBMIT_ACCEPTED 0
+#define PAXOS_SUBMIT_BUSY 1
+#define PAXOS_SUBMIT_REJECTED (-1)
+
+/*
+    Enqueues a value directly in the pending queue of the leader
+    running in this process. Can be called by any thread.
+    Returns one of the PAXOS_SUBMIT_* values above.
+*/
+int pax_submit_sharedmem(char* value, size_t val_size);
+
+/*
+    Local reads with the leader lease (see PAXOS_LEADER_LEASE in config).
+    If the proposer running in this process is the leader and holds 
+    the lease, sets iid to the read point and returns 0: once a learner
+    of this process has delivered instance iid (see the deliver 
+    function), a read on the delivered state is linearizable and does 
+    not need to be submitted. Otherwise returns -1, and the read must 
+    go trough the log. The read point must be taken after the read 
+    is received. Can be called by any thread.
+*/
+int pax_read_point(iid_t * iid);
+
+/*
+    Role contexts.
+    The functions above start one role of each kind per process, in
+    an internal thread. Alternatively each role instance can be created
+    as an explicit context, bound to an event base created by the
+    application (i.e. with event_base_new): all its events are
+    registered there and its callbacks are invoked by the thread
+    running event_base_dispatch on it. This way a process can host
+    several learners, acceptors and proposers, on one or more threads.
+    A context must be created and freed by the thread that runs its
+    event base (or before the loop starts). The configuration is
+    shared by all the contexts in the process, each exports its own
+    metrics (see pax_metric_value).
+    The _new functions return NULL for error.
+
+    Groups.
+    With PAXOS_GROUPS > 1 (see config) the roles can run K independent 
+    consensus groups, from 0 to K-1. Each group has its own instances,
+    leader and acceptors DB, and uses the configured networks with
+    the ports shifted by group*PAXOS_GROUP_PORT_STRIDE. A process
+    runs one context per group, each on its own event base and thread.
+    The legacy init functions above join group 0.
+    A merged learner delivers the values of all the groups in a single
+    total order, the same for every merged learner: instance i of 
+    group g is delivered (round-robin) as instance (i-1)*K + g + 1.
+    The merged order proceeds at the speed of the slowest group: 
+    when a group is behind, the merged learners ask its leader to 
+    decide no-ops up to the instance reached by the others (see 
+    LEARNER_MERGED_NOOP_INTERVAL), a group without submits does 
+    not stop it.
+*/
+struct event_base;
+typedef struct paxos_learner_t paxos_learner;
+typedef struct paxos_acceptor_t paxos_acceptor;
+typedef struct paxos_proposer_t paxos_proposer;
+typedef struct paxos_merged_learner_t paxos_merged_learner;
+typedef struct paxos_oracle_t paxos_oracle;
+
+/*
+    Like deliver_function, with the pointer given to learner_new
+*/
+typedef void (* deliver_callback)(char*, size_t, iid_t, ballot_t, int, void * arg);
+
+paxos_learner * learner_new(struct event_base * eb, int group, deliver_callback f, void * arg);
+void learner_free(paxos_learner * l);
+
+/*
+    Learns from all the groups and delivers in the merged order.
+    The iid passed to the callback is the merged one.
+*/
+paxos_merged_learner * learner_merged_new(struct event_base * eb, deliver_callback f, void * arg);
+void learner_merged_free(paxos_merged_learner * m);
+
+/*
+    Like learner_dedup_state_save/restore, for the given learner.
+    Restore must be called before the event base is dispatched.
+*/
+void learner_dedup_save(paxos_learner * l, char * buf);
+int learner_dedup_restore(paxos_learner * l, char * buf, size_t size);
+
+/*
+    If recover is set, the acceptor recovers from an existing DB
+    (like acceptor_init_recover). Free closes the DB.
+*/
+paxos_acceptor * acceptor_new(struct event_base * eb, int group, int acceptor_id, int recover);
+void acceptor_free(paxos_acceptor * a);
+
+/*
+    Like acceptor_init_join, for the given event base
+*/
+paxos_acceptor * acceptor_join(struct event_base * eb, int group, int acceptor_id);
+
+paxos_proposer * proposer_new(struct event_base * eb, int group, int proposer_id);
+void proposer_free(paxos_proposer * p);
+
+/*
+    Like pax_submit_sharedmem, for the given proposer.
+    Can be called by any thread.
+*/
+int proposer_submit_sharedmem(paxos_proposer * p, char* value, size_t val_size);
+
+/*
+    Like pax_read_point, for the given proposer.
+    Can be called by any thread.
+*/
+int proposer_read_point(paxos_proposer * p, iid_t * iid);
+
+/*
+    Like oracle_init, elects the leader of the given group
+*/
+paxos_oracle * oracle_new(struct event_base * eb, int group);
+void oracle_free(paxos_oracle * o);
+
+/*
+    Metrics of the roles running in this process: counters, gauges and 
+    latency histograms (in microseconds), i.e. "leader_p2_timeout" or
+    "acceptor_storage_latency_us".
+    The metrics of a role context are labeled with its group and id,
+    i.e. group="1",acceptor="2" (learners are numbered in the order 
+    they are created, in this process).
+    pax_metric_value returns the value of a counter or gauge, or 
+    the number of samples of a histogram, -1 if there is no such metric.
+    Counters and histograms of several contexts are added up, for 
+    gauges the first context is returned. The _label version returns
+    the value of a single context.
+    pax_metrics_dump writes all of them in the Prometheus text format,
+    returns the length of the whole dump (like snprintf).
+    The same dump is served on PAXOS_METRICS_SOCKET (see config).
+*/
+long long pax_metric_value(const char * name);
+long long pax_metric_value_label(const char * name, const char * label);
+size_t pax_metrics_dump(char * buf, size_t size);
+
+/*
+    Simulated network, for benchmarks and tests in a single process
+    (see tests/sim_benchmark.c).
+    Once started, the roles created in this process exchange messages
+    trough the simulator instead of UDP: each message is delivered 
+    to the receivers of its address and port after the configured
+    delay, or lost. All the roles must run on the given event base.
+    The random choices (loss and jitter) depend only on the seed and 
+    on the sequence of messages sent. Timers and delays still follow 
+    the real clock.
+    Messages for addresses with no receiver in this process (i.e.
+    the replies to remote clients) are dropped.
+    The counts are in the metrics "sim_sent", "sim_delivered", 
+    "sim_dropped", "sim_bytes" and "sim_sent_<type>", i.e. 
+    "sim_sent_accept_reqs".
+    Must be called before creating any role, returns 0 if successful.
+*/
+typedef struct paxos_sim_params_t {
+    //One way delay of each message, in microseconds
+    long            latency;
+    //Random delay added to latency (reorders messages), in microseconds
+    long            jitter;
+    //Probability that a message is lost, in thousandths
+    int             loss_permille;
+    //Bytes per second each receiver can get, 0 for unlimited
+    long            bandwidth;
+    //Seed of the random choices
+    unsigned int    seed;
+} paxos_sim_params;
+
+int pax_sim_start(struct event_base * eb, paxos_sim_params * params);
 
 #endif /* _LIBPAXOS_H_ */
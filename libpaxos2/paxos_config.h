@@ -1,6 +1,14 @@
 #ifndef PAXOS_CONFIG_H_24LVFLYO
 #define PAXOS_CONFIG_H_24LVFLYO
 
+/*
+    Most of the settings below are only defaults: they can be changed 
+    at runtime through pax_config() or a configuration file 
+    (see paxos_config and pax_config_load in libpaxos.h).
+    The settings without a field in paxos_config size static tables 
+    or enable optional code, changing them requires a rebuild.
+*/
+
 /*** PROTOCOL SETTINGS ***/
 
 /* 
@@ -8,48 +16,70 @@
     (executes phase1 even if no value is yet present for phase 2).
     Setting too high may produce lots of timeout, since the acceptors
     take a while to answer.
-    Should be a multiple of PROPOSER_P2_CONCURRENCY (double or more)
+    Should be a multiple of PROPOSER_P2_WINDOW_MAX (double or more)
     MUST be less than PROPOSER_ARRAY_SIZE (half or less)
 */
 #define PROPOSER_PREEXEC_WIN_SIZE 300
 
 /* 
-    Number of instances that are concurrently opened by the leader.
-    If this is 1, the leader won't try to send an accept for
+    Number of instances that are concurrently opened by the leader
+    (phase 2 window). The window is adapted at runtime, like a TCP 
+    congestion window: it grows by one every time a full window of
+    instances is closed with a latency close to the lowest observed,
+    and it's halved when an instance times out in phase 2.
+    If the window is 1, the leader won't try to send an accept for
     instance i+1 until instance i is closed.
-    If more than 1, FIFO order of values is not granted.
-    MUST be smaller than PROPOSER_PREEXEC_WIN_SIZE (half or less)
+    If more than 1, values from the same client are still delivered 
+    in FIFO order (see LEADER_CLIENT_REORDER_SIZE), unless they are 
+    pushed back because some other proposer is competing for leadership.
+    MAX MUST be smaller than PROPOSER_PREEXEC_WIN_SIZE (half or less)
 */
-#define PROPOSER_P2_CONCURRENCY 3
+#define PROPOSER_P2_WINDOW_INITIAL 3
+#define PROPOSER_P2_WINDOW_MIN 1
+#define PROPOSER_P2_WINDOW_MAX 64
+
+/* 
+    A close latency (accept sent to instance closed) higher than
+    the lowest observed times this factor is taken as a sign of 
+    congestion, and the phase 2 window is not increased.
+*/
+#define PROPOSER_P2_LATENCY_FACTOR 2
 
 /* 
     The timeout for prepare requests. If too high, the leader takes a while
     to realize the timeout. If too low, requests expire too early.
-    To calibrate, set to an high value (seconds), activate 
-    LEADER_EVENTS_UPDATE_INTERVAL and observe the number of timeouts.
-    Then lower this value until only a few occour.
+    The leader keeps a smoothed round trip time and variance for phase 1
+    (from prepare sent to quorum of promises) and sets the timeout to 
+    srtt + 4*rttvar, like TCP computes its retransmission timeout.
+    The timeout is doubled (up to MAX) every time some instance expires.
+    The INITIAL value is used until the first measurement.
     The most important factors are PROPOSER_PREEXEC_WIN_SIZE and
     the latency of the network.
     Unit is microseconds - i.e. 1500000 = 1.5 secs
 */
-#define P1_TIMEOUT_INTERVAL 30000
+#define P1_TIMEOUT_INITIAL 30000
+#define P1_TIMEOUT_MIN 2000
+#define P1_TIMEOUT_MAX 1000000
 
 /* 
     The timeout for accept requests. If too high, the leader takes a while
     to realize the timeout. If too low, requests expire too early.
-    To calibrate, set to an high value (seconds), activate 
-    LEADER_EVENTS_UPDATE_INTERVAL and observe the number of timeouts.
-    Then lower this value until only a few occour.
+    Adapted at runtime like P1_TIMEOUT_*, measuring the time from accept
+    sent to instance closed.
     The most important factors are the size of submitted values and
     the latency of the network.
     Unit is microseconds - i.e. 1500000 = 1.5 secs
 */
-#define P2_TIMEOUT_INTERVAL 35000
+#define P2_TIMEOUT_INITIAL 35000
+#define P2_TIMEOUT_MIN 2000
+#define P2_TIMEOUT_MAX 1000000
 
 /* 
     How frequently should the leader proposer try to open new instances.
     (P2 execution does not rely exclusively on this peridic check, 
     new ones are opened also when some old instance is closed/delivered).
+    The leader timer wheel has a slot for each P2_CHECK_INTERVAL up to
+    the longest of P1_TIMEOUT_MAX and P2_TIMEOUT_MAX.
     Unit is microseconds - i.e. 1000 = 1ms */
 #define P2_CHECK_INTERVAL 1000
 
@@ -64,18 +94,99 @@
 /* 
     The number of acceptors must be fixed beforehand.
     The acceptors must be started with different IDs.
+    This is also the maximum for the runtime number of acceptors,
+    since it sizes the per-instance tables: a cluster may run
+    with fewer acceptors without a rebuild.
 */
 #define N_OF_ACCEPTORS  3
 
 /* 
-    Rule for calculating whether the number of accept_ack messages (phase 2b) 
-    is sufficient to declare the instance closed and deliver 
-    the corresponding value. i.e.:
-    Paxos     -> ((int)(N_OF_ACCEPTORS/2))+1;
-    FastPaxos -> 1 + (int)((double)(N_OF_ACCEPTORS*2)/3);
+    Number of promises (phase 1b) the leader needs to start phase 2,
+    and number of accept_ack messages (phase 2b) sufficient to declare 
+    the instance closed and deliver the corresponding value. i.e.:
+    Paxos     -> (N_OF_ACCEPTORS/2)+1 for both;
+    Flexible Paxos -> any sizes such that PHASE1 + PHASE2 > N_OF_ACCEPTORS
+    (every phase 1 quorum intersects every phase 2 quorum). Phase 2 runs
+    for every instance, a smaller PHASE2_QUORUM (and a larger PHASE1) 
+    makes commits independent of the slowest acceptors, 
+    i.e. with 5 acceptors: PHASE1 4, PHASE2 2.
+    FastPaxos -> ceil(N_OF_ACCEPTORS*3/4), used in fast rounds only 
+    (any two fast quorums and a phase 1 quorum must intersect)
+    0 selects the Paxos/FastPaxos size for the number of acceptors
+    configured at runtime. The intersection is checked at init.
+*/
+
+#define PHASE1_QUORUM 0
+#define PHASE2_QUORUM 0
+#define FAST_QUORUM 0
+
+/* 
+    Enables Fast Paxos: the first round of each instance is a fast round.
+    After phase 1, the leader sends an "any" accept request instead
+    of a value, and clients send their values directly to the acceptors,
+    which accept them for the lowest instance in "any" state.
+    An instance is closed when FAST_QUORUM acceptors accept the same value.
+    If they don't (collision, or lost messages), the leader recovers
+    the instance with a classic round.
+    Clients do not receive submit replies in this mode.
+    Undefine to disable.
+*/
+// #define PAXOS_FAST_MODE
+
+/* 
+    Enables multiple leaders (like in Mencius): instance ids are
+    assigned round-robin to proposers 0...N_OF_LEADERS-1, each of them 
+    acts as leader for its own instances. A leader with no value to 
+    propose fills its instances with no-ops, so that learners can
+    deliver the instances of the other leaders.
+    Submitted values are handled by proposer (client_id % N_OF_LEADERS),
+    see pax_submit_handle_init_proposer. The oracle is ignored.
+    If an instance of another leader blocks delivery for more than 
+    MULTI_LEADER_REVOKE_TIMEOUT, it's taken over and filled with a no-op
+    (unless some value was accepted already).
+    Cannot be used together with PAXOS_FAST_MODE.
+    Undefine to disable.
+    TIMEOUT unit is microseconds - i.e. 1000 = 1ms
+*/
+// #define PAXOS_MULTI_LEADER
+#define N_OF_LEADERS 3
+#define MULTI_LEADER_REVOKE_TIMEOUT 2000000
+
+/* 
+    Thrifty phase 2: accept requests are addressed to PHASE2_QUORUM
+    acceptors only. The others still receive the multicast message,
+    but ignore it and do not write it to stable storage.
+    The acceptors addressed move forward by one every 
+    PROPOSER_THRIFTY_ROTATE instances (to spread the load), and when 
+    a phase 2 times out (to leave out slow or crashed acceptors).
+    Instances retried after a timeout are sent to all acceptors.
+    Cannot be used together with PAXOS_FAST_MODE.
+    Undefine to disable.
 */
+// #define PROPOSER_THRIFTY_P2
+#define PROPOSER_THRIFTY_ROTATE 1024
 
-#define QUORUM (((int)(N_OF_ACCEPTORS/2))+1)
+/*
+    Leader lease: an acceptor that promises or accepts for a proposer
+    ignores the requests of the other proposers for PAXOS_LEADER_LEASE.
+    The leader holds the lease until PAXOS_LEADER_LEASE after it sent 
+    the requests of the last phase answered by a quorum, minus 
+    LEADER_LEASE_MARGIN (for the clocks drift). Meanwhile no other 
+    proposer can decide a value, and reads can be served by a local 
+    learner (see proposer_read_point in libpaxos.h). The lease is 
+    renewed by phase 2, an idle leader opens a no-op when half of it 
+    is left. A new leader waits up to PAXOS_LEADER_LEASE to take over.
+    Cannot be used together with PAXOS_FAST_MODE or PAXOS_MULTI_LEADER.
+    0 disables. Unit is microseconds - i.e. 1000 = 1ms
+*/
+#define PAXOS_LEADER_LEASE 0
+#define LEADER_LEASE_MARGIN 10000
+
+/*
+    Number of instances in "any" state an acceptor keeps track of.
+    MUST be a power of 2, and bigger than PROPOSER_P2_WINDOW_MAX
+*/
+#define ACCEPTOR_ANY_QUEUE_SIZE 128
 
 /* 
     This option makes each acceptor a learner too.
@@ -107,11 +218,76 @@
 #define LEARNER_HOLECHECK_INTERVAL 500000
 
 /*
-    The maximum size of the pending list of values in the leader proposer.
+    The maximum size of the pending queue of values in the leader proposer.
     It has to be limited since client my retry to submit too early, if they send 
-    at a rate higher than the proposer can digest, the list grows to infinity
+    at a rate higher than the proposer can digest, the list grows to infinity.
+    When the queue is full new values are rejected, when it holds more than
+    the HIGH_WATERMARK, submitters are asked to slow down 
+    (see pax_submit_sharedmem).
+    MUST be a power of 2
+*/
+#define LEADER_MAX_QUEUE_LENGTH 64
+#define LEADER_QUEUE_HIGH_WATERMARK 48
+
+/*
+    A proposer that is not the leader keeps the values submitted
+    until they are delivered, to propose them if promoted (it does 
+    not shorten the phase 1 of the takeover). The buffer
+    starts with LEADER_MAX_QUEUE_LENGTH values and grows up to 
+    PROPOSER_MIRROR_MAX_LENGTH, after that new values are not kept
+    (see the "proposer_mirror_dropped" metric).
+    MUST be a power of 2
+*/
+#define PROPOSER_MIRROR_MAX_LENGTH 16384
+
+/*
+    Number of clients whose address is remembered by the leader,
+    to notify them the outcome of submitted values.
+    MUST be a power of 2
+*/
+#define LEADER_CLIENTS_TABLE_SIZE 1024
+
+/*
+    Values from the same client are enqueued in the order of their
+    sequence number. A value received out of order is held back until 
+    the previous ones are received, up to LEADER_CLIENT_REORDER_SIZE 
+    values per client and for at most LEADER_CLIENT_REORDER_TIMEOUT; 
+    after that, the missing values are considered lost and skipped.
+    Values older than the next expected are enqueued out of order
+    (resubmitted, see pax_submit_retry).
+    SIZE MUST be a power of 2
+    TIMEOUT unit is microseconds - i.e. 1000 = 1ms
+*/
+#define LEADER_CLIENT_REORDER_SIZE 16
+#define LEADER_CLIENT_REORDER_TIMEOUT 100000
+
+/*
+    The leader packs multiple pending client values in the value of 
+    a single instance, up to this size in bytes (headers included).
+    A value bigger than this is sent alone in its instance.
+    MUST be smaller than MAX_UDP_MSG_SIZE (minus ~40 bytes of headers)
 */
-#define LEADER_MAX_QUEUE_LENGTH 50
+#define LEADER_BATCH_MAX_SIZE 4000
+
+/*
+    How long the leader may hold pending client values, waiting for
+    more to fill a batch of LEADER_BATCH_MAX_SIZE bytes.
+    0 sends whatever is pending as soon as an instance is available.
+    Values are checked every P2_CHECK_INTERVAL, so higher resolution
+    is pointless.
+    Unit is microseconds - i.e. 1000 = 1ms
+*/
+#define LEADER_BATCH_DELAY 0
+
+/*
+    How long a submit handle may hold values passed to pax_submit_async,
+    waiting for more to fill a single submit message.
+    The window is checked only when the handle is used, clients should 
+    call pax_submit_flush when they have nothing else to submit.
+    0 sends every value as soon as it is submitted.
+    Unit is microseconds - i.e. 1000 = 1ms
+*/
+#define CLIENT_SUBMIT_COALESCE_DELAY 1000
 
 
 /*** FAILURE DETECTOR SETTINGS ***/
@@ -121,7 +297,22 @@
     to the failure oracle.
     Unit is microseconds.
 */
-#define FAILURE_DETECTOR_PING_INTERVAL 3000000
+#define FAILURE_DETECTOR_PING_INTERVAL 100000
+
+/*
+    The oracle (see oracle_init in libpaxos.h) suspects a proposer
+    when its suspicion level phi exceeds ORACLE_PHI_THRESHOLD. 
+    Phi is -log10 of the probability that the next ping arrives
+    later than now, given the intervals between the last 
+    ORACLE_PHI_WINDOW_SIZE pings. I.e. 8 means that a wrong suspicion
+    happens once every 10^8 checks.
+    ORACLE_MIN_STDDEV is the minimum standard deviation of the intervals,
+    so that very regular pings do not make the oracle too sensitive.
+    Unit is microseconds.
+*/
+#define ORACLE_PHI_THRESHOLD 8
+#define ORACLE_PHI_WINDOW_SIZE 100
+#define ORACLE_MIN_STDDEV 20000
 
 /*** ACCEPTORS DB SETTINGS ***/
 
@@ -157,17 +348,17 @@
     %d is replaced by 'acceptor_id'
     The concatenation of those MUST fit in 512 chars
 */
-#define ACCEPTOR_DB_PATH "/tmp/acceptor_%d", acceptor_id
-#define ACCEPTOR_DB_FNAME "acc_db_%d.bdb", acceptor_id
+#define ACCEPTOR_DB_PATH "/tmp/acceptor_%d"
+#define ACCEPTOR_DB_FNAME "acc_db_%d.bdb"
 
 /*
     Acceptor's access method on their underlying DB.
-    Only DB_BTREE and DB_RECNO are available, other methods
-    requires additional configuration and do not fit well.
+    Only DB_BTREE is available: keys are 64-bit iids (big-endian, 
+    so that records are sorted by iid), DB_RECNO record numbers 
+    are 32 bits.
     Acceptors use Berkeley DB as a stable storage layer.
 */
-// #define ACCEPTOR_ACCESS_METHOD DB_BTREE
-#define ACCEPTOR_ACCESS_METHOD DB_RECNO
+#define ACCEPTOR_ACCESS_METHOD DB_BTREE
 
 
 /*** NETWORK SETTINGS ***/
@@ -191,6 +382,32 @@
 #define PAXOS_ORACLE_NET    "239.4.0.1", 6005
 #define PAXOS_PINGS_NET     "239.5.0.1", 6006
 
+/*
+  Number of independent consensus groups (see "Groups" in libpaxos.h).
+  Each group has its own instances, leader and acceptors. Group g uses
+  the addresses above with port + (g * PAXOS_GROUP_PORT_STRIDE)
+*/
+#define PAXOS_GROUPS 1
+#define PAXOS_GROUP_PORT_STRIDE 100
+
+/*
+  A merged learner (see learner_merged_new) waiting for a group that
+  is behind the others asks, every LEARNER_MERGED_NOOP_INTERVAL, the 
+  leader of that group to fill the gap with no-ops, so that a group 
+  without submits does not stop the merged order. 0 disables.
+  Unit is microseconds - i.e. 1000 = 1ms
+*/
+#define LEARNER_MERGED_NOOP_INTERVAL 10000
+
+/*
+  A membership change decided in instance i (see pax_submit_membership
+  in libpaxos.h) applies from instance i + PAXOS_MEMBERSHIP_ALPHA.
+  MUST be at least PROPOSER_ARRAY_SIZE and LEARNER_ARRAY_SIZE, so that
+  instances are never started before their membership is known.
+  0 selects the bigger of the two.
+*/
+#define PAXOS_MEMBERSHIP_ALPHA 0
+
 /*
   If defined, UDP sockets created (to send) are non-blocking.
   The send call may return before data is actually transmitted.
@@ -214,6 +431,46 @@
 */
 #define LEARNER_ARRAY_SIZE 2048
 
+/* 
+  Number of clients tracked by learners to filter out values delivered
+  twice (i.e. resubmitted after a timeout). For each client, only the 
+  last 64 sequence numbers are remembered.
+  When the table is full, the client that was delivered least recently
+  is forgotten, and its duplicates are delivered again.
+  MUST be a power of 2
+*/
+#define LEARNER_DEDUP_TABLE_SIZE 4096
+
+
+/*** METRICS SETTINGS ***/
+
+/*
+  Maximum number of metrics (counters, gauges, histograms) 
+  registered in a process, by all the role contexts it runs
+  (each registers its own, from 10 to 20).
+*/
+#define PAXOS_METRICS_MAX 512
+
+/*
+  Latency histograms have buckets for 1, 2, 4, ... microseconds,
+  the last one counts everything above 2^(BUCKETS-2) usec.
+*/
+#define PAXOS_METRICS_BUCKETS 24
+
+/*
+  Unix socket where the metrics are dumped in text format, to 
+  whoever connects (i.e. socat - UNIX-CONNECT:/tmp/paxos_metrics.1234).
+  %d is replaced by the process id.
+  Undefine to disable.
+*/
+#define PAXOS_METRICS_SOCKET "/tmp/paxos_metrics.%d"
+
+/*
+  The dump is written without blocking the role's event loop, a client
+  that does not read it for PAXOS_METRICS_CLIENT_TIMEOUT is dropped.
+  Unit is microseconds - i.e. 1000 = 1ms
+*/
+#define PAXOS_METRICS_CLIENT_TIMEOUT 1000000
 
 /*** DEBUGGING SETTINGS ***/
 
@@ -39,8 +39,7 @@ static accept_ack * accept_buffer;
 // FIXME: should store current_iid when committing
 // but with recno is a mess
 // Cannot use 0 and does not like a large number either...
-extern DB *dbp;
-extern DB_TXN *txn;
+static acceptor_storage * storage;
 
 static void
 ab_store_value(char * value, size_t value_size) {
@@ -49,11 +48,15 @@ ab_store_value(char * value, size_t value_size) {
     accept_buffer->ballot = 101;
     accept_buffer->value_ballot = 101;
     accept_buffer->is_final = 1;
-    accept_buffer->value_size = value_size;
+    
+    //Submit messages have the same format as instance values, 
+    // all the values in the submit go in this instance
     memcpy(accept_buffer->value, value, value_size);
+    accept_buffer->value_size = value_size;
     
     //Store as acceptor_record (== accept_ack)
-    stablestorage_save_final_value(value, value_size, current_iid, 101);
+    stablestorage_save_final_value(storage, accept_buffer->value, 
+        accept_buffer->value_size, current_iid, 101);
 }
 // 
 // static void
@@ -68,10 +71,10 @@ ab_store_value(char * value, size_t value_size) {
 //     if(PAXOS_MSG_SIZE(m) + aa_size >= MAX_UDP_MSG_SIZE) {
 //         // Next accept to add does not fit, flush the current 
 //         // message before adding it
-//         stablestorage_tx_end();
+//         stablestorage_tx_end(storage);
 //         sendbuf_flush(to_learners);
 //         sendbuf_clear(to_learners, m->type, 0);
-//         stablestorage_tx_begin();   
+//         stablestorage_tx_begin(storage);   
 //     }
 //     printf("bufsize%d\n", (int)(PAXOS_MSG_SIZE(m) + aa_size));
 // 
@@ -105,7 +108,7 @@ ab_handle_newval(int sock, short event, void *arg) {
         
         case submit: {
             ab_store_value(msg->data, msg->data_size);
-            sendbuf_add_accept_ack(to_learners, accept_buffer);
+            sendbuf_add_accept_ack(to_learners, accept_buffer, storage);
             current_iid +=1;
         }
         break;
@@ -129,13 +132,13 @@ ab_handle_repeat_req_batch(repeat_req_batch * rrb) {
     //Iterate over the repeat_req in the batch
     for(i = 0; i < rrb->count; i++) {
         //Read the corresponding record
-        aa = stablestorage_get_record(rrb->requests[i]);
+        aa = stablestorage_get_record(storage, rrb->requests[i]);
         
         //If a value was accepted, send accept_ack
         if(aa != NULL && aa->value_size > 0) {
-            sendbuf_add_accept_ack(to_learners, aa);
+            sendbuf_add_accept_ack(to_learners, aa, storage);
         } else {
-            LOG(DBG, ("Cannot retransmit iid:%u no value accepted \n", aa->iid));
+            LOG(DBG, ("Cannot retransmit iid:%"IID_FMT" no value accepted \n", aa->iid));
         }
     }
     //Flush the send buffer if there's something
@@ -181,9 +184,9 @@ ab_periodic_flush(int sock, short event, void *arg) {
     UNUSED_ARG(event);
     UNUSED_ARG(arg);
     
-    stablestorage_tx_end();   
+    stablestorage_tx_end(storage);   
     sendbuf_flush(to_learners);
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(storage);
     
     if(event_add(&flush_event, &flush_interval) != 0) {
 	   printf("Error while adding first periodic flush event\n");
@@ -193,6 +196,11 @@ ab_periodic_flush(int sock, short event, void *arg) {
 static int 
 ab_init() {
     
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return -1;
+    }
+
     accept_buffer = malloc(MAX_UDP_MSG_SIZE);
     if(accept_buffer == NULL) {
         printf("Error in malloc\n");
@@ -200,11 +208,13 @@ ab_init() {
     }
     
     //Init BDB
-    if(stablestorage_init(0) != 0) {
+    storage = stablestorage_init(0, 0, 0);
+    if(storage == NULL) {
         printf("Stable storage init failed\n");
+        return -1;
     }
     //Start the first transaction
-    stablestorage_tx_begin();
+    stablestorage_tx_begin(storage);
 
 
     //Initialization of libevent handle
@@ -214,7 +224,7 @@ ab_init() {
     }
     
     // Send buffer for talking to learners
-    to_learners = udp_sendbuf_new(PAXOS_LEARNERS_NET);
+    to_learners = udp_sendbuf_new(CONF_NET(learners_net));
     if(to_learners == NULL) {
         printf("Error creating network sender\n");
         return -1;
@@ -224,14 +234,14 @@ ab_init() {
 
     // // Send buffer for talking to learners 
     // // (dedicated to answering repeat request)
-    // to_learners = udp_sendbuf_new(PAXOS_LEARNERS_NET);
+    // to_learners = udp_sendbuf_new(CONF_NET(learners_net));
     // if(to_learners == NULL) {
     //     printf("Error creating network sender 2\n");
     //     return -1;
     // }
 
     // Message from learners (repeat request) event
-    from_learners = udp_receiver_new(PAXOS_ACCEPTORS_NET);
+    from_learners = udp_receiver_new(CONF_NET(acceptors_net));
     if (from_learners == NULL) {
         printf("Error creating network receiver\n");
         return -1;
@@ -241,7 +251,7 @@ ab_init() {
 
     
     // Message from client event
-    from_clients = udp_receiver_new(PAXOS_SUBMIT_NET);
+    from_clients = udp_receiver_new(CONF_NET(submit_net));
     if (from_clients == NULL) {
         printf("Error creating network receiver\n");
         return -1;
@@ -17,6 +17,7 @@ static int force_exit = 0;
 static int delivered_count = 0;
 static int submitted_count = 0;
 static int retried_count = 0;
+static iid_t last_iid = 0;
 
 static struct event cl_periodic_event;
 static struct timeval cl_periodic_interval;
@@ -24,6 +25,8 @@ static struct timeval cl_periodic_interval;
 typedef struct client_value_record_t {
     struct timeval creation_time;
     struct timeval expire_time;
+    paxos_ticket ticket;
+    unsigned int retries;
     size_t value_size;
     char value[PAXOS_MAX_VALUE_SIZE];
 } client_value_record;
@@ -52,6 +55,37 @@ static int max_samples = 500;
 static double * samples;
 static int samples_count = 0;
 
+//HDR-style histogram: values below 2*HIST_SUB are counted exactly,
+// each higher power of 2 is split in HIST_SUB linear sub-buckets,
+// so that any value is reported with less than 1% error
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (48 * HIST_SUB)
+typedef struct histogram_t {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long total;
+    long min;
+    long max;
+    double sum;
+} histogram;
+
+//Latency of all values (microseconds), of the values delivered 
+// since the last snapshot, and retries of each value
+static histogram latency_hist;
+static histogram interval_hist;
+static histogram retries_hist;
+
+//Snapshots every snapshot_interval seconds (0 for none)
+int snapshot_interval = 0;
+static struct event cl_snapshot_event;
+static struct timeval cl_snapshot_tv;
+static int snapshot_count = 0;
+static int interval_delivered = 0;
+
+//Machine readable output (CSV), NULL for none
+static FILE * csv_out = NULL;
+static char * hist_path = NULL;
+
 void pusage() {
     printf("benchmark_client options:\n");
     printf("\t-c N : submit N values concurrently\n");
@@ -62,6 +96,9 @@ void pusage() {
     printf("\t-p N : print submit count every N values\n");
     printf("\t-s N : saves a latency sample every N values sent\n");
     printf("\t-w N : after initialization is completed, wait N seconds before submitting\n");
+    printf("\t-i N : prints the latency percentiles of the last N seconds, every N seconds\n");
+    printf("\t-o F : writes the snapshots and the totals in file F (CSV)\n");
+    printf("\t-H F : writes the whole latency distribution in file F (CSV)\n");
     printf("\t-h   : prints this message\n");    
 }
 
@@ -73,7 +110,7 @@ void handle_cltr_c (int sig) {
 void parse_args(int argc, char * const argv[]) {
 
     int c;
-    while((c = getopt(argc, argv, "c:m:M:d:t:p:s:w:h")) != -1) {
+    while((c = getopt(argc, argv, "c:m:M:d:t:p:s:w:i:o:H:h")) != -1) {
         switch(c) {
             case 'c': {
                 concurrent_values = atoi(optarg);
@@ -116,6 +153,26 @@ void parse_args(int argc, char * const argv[]) {
             }
             break;
 
+            case 'i': {
+                snapshot_interval = atoi(optarg);
+            }
+            break;
+
+            case 'o': {
+                csv_out = fopen(optarg, "w");
+                if(csv_out == NULL) {
+                    perror("fopen");
+                    exit(1);
+                }
+                fprintf(csv_out, "row,time_s,count,rate,p50_us,p90_us,p99_us,p999_us,max_us,retries_p99,retries_max\n");
+            }
+            break;
+
+            case 'H': {
+                hist_path = optarg;
+            }
+            break;
+
             
             case 'h':
             default: {
@@ -136,6 +193,149 @@ print_benchmark_parameters () {
     printf("max_val_size set to: %d\n", max_val_size);
     printf("duration set to: %d\n", duration);
     printf("Initial submission delay set to: %d\n", wait_after_init);   
+    printf("snapshot_interval set to: %d\n", snapshot_interval);
+}
+
+/*-------------------------------------------------------------------------*/
+// Histograms
+/*-------------------------------------------------------------------------*/
+
+static int
+hist_index(long value) {
+    int shift = 0;
+    
+    if(value < 0) {
+        value = 0;
+    }
+    if(value < 2 * HIST_SUB) {
+        return (int)value;
+    }
+    while((value >> shift) >= 2 * HIST_SUB) {
+        shift++;
+    }
+    if(shift + 1 >= HIST_BUCKETS / HIST_SUB) {
+        return HIST_BUCKETS - 1;
+    }
+    return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+//Highest value counted in the given bucket
+static long
+hist_bucket_value(int index) {
+    int shift;
+    
+    if(index < 2 * HIST_SUB) {
+        return index;
+    }
+    shift = index / HIST_SUB - 1;
+    return (((long)(index % HIST_SUB + HIST_SUB)) << shift) + (1L << shift) - 1;
+}
+
+static void
+hist_clear(histogram * h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+static void
+hist_record(histogram * h, long value) {
+    if(h->total == 0 || value < h->min) {
+        h->min = value;
+    }
+    if(h->total == 0 || value > h->max) {
+        h->max = value;
+    }
+    h->counts[hist_index(value)] += 1;
+    h->total += 1;
+    h->sum += value;
+}
+
+//Smallest value such that percentile % of the values are lower or equal
+static long
+hist_percentile(histogram * h, double percentile) {
+    unsigned long seen = 0, target;
+    long value;
+    int i;
+    
+    if(h->total == 0) {
+        return 0;
+    }
+    target = (unsigned long)((percentile / 100) * h->total + 0.5);
+    if(target < 1) {
+        target = 1;
+    }
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if(seen >= target) {
+            value = hist_bucket_value(i);
+            return (value > h->max ? h->max : value);
+        }
+    }
+    return h->max;
+}
+
+static void
+hist_print(const char * name, histogram * h) {
+    printf("%s - Count:%lu, P50:%ld, P90:%ld, P99:%ld, P99.9:%ld, Max:%ld\n",
+        name, h->total, hist_percentile(h, 50), hist_percentile(h, 90), 
+        hist_percentile(h, 99), hist_percentile(h, 99.9), h->max);
+}
+
+static void
+hist_csv_row(const char * row, double time_s, histogram * h, double rate) {
+    if(csv_out == NULL) {
+        return;
+    }
+    fprintf(csv_out, "%s,%.1f,%lu,%.1f,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", 
+        row, time_s, h->total, rate, hist_percentile(h, 50), 
+        hist_percentile(h, 90), hist_percentile(h, 99), 
+        hist_percentile(h, 99.9), h->max, 
+        hist_percentile(&retries_hist, 99), retries_hist.max);
+    fflush(csv_out);
+}
+
+//Full distribution, one line per non-empty bucket
+static void
+hist_write_distribution(const char * path, histogram * h) {
+    unsigned long seen = 0;
+    int i;
+    FILE * f = fopen(path, "w");
+    
+    if(f == NULL) {
+        perror("fopen");
+        return;
+    }
+    fprintf(f, "value_us,count,percentile\n");
+    for(i = 0; i < HIST_BUCKETS; i++) {
+        if(h->counts[i] == 0) {
+            continue;
+        }
+        seen += h->counts[i];
+        fprintf(f, "%ld,%lu,%.4f\n", hist_bucket_value(i), h->counts[i],
+            (100.0 * seen) / h->total);
+    }
+    fclose(f);
+}
+
+//Invoked every snapshot_interval seconds by the learner thread
+static void
+cl_snapshot(int fd, short event, void *arg) {
+    char row[32];
+    double rate = (double)interval_delivered / snapshot_interval;
+    
+    snapshot_count += 1;
+    printf("[%ds] Rate:%.1f ", snapshot_count * snapshot_interval, rate);
+    hist_print("Latency (us)", &interval_hist);
+    snprintf(row, sizeof(row), "interval%d", snapshot_count);
+    hist_csv_row(row, snapshot_count * snapshot_interval, &interval_hist, rate);
+    
+    hist_clear(&interval_hist);
+    interval_delivered = 0;
+    event_add(&cl_snapshot_event, &cl_snapshot_tv);
+    
+    //Makes the compiler happy
+    fd = fd;
+    event = event;
+    arg = arg;
 }
 
 static void 
@@ -210,6 +410,12 @@ save_latency_info (client_value_record * cvr, struct timeval * curr_time) {
     sum_in_place_timevals(&aggregated_latency, time_taken);
     aggregated_latency_count += 1;
     
+    long usecs = time_taken->tv_sec * 1000000 + time_taken->tv_usec;
+    hist_record(&latency_hist, usecs);
+    hist_record(&interval_hist, usecs);
+    hist_record(&retries_hist, cvr->retries);
+    interval_delivered += 1;
+    
     //Save a latency sample every sample_frequency 
     // values successfully submitted
     if(sample_frequency != 0 && 
@@ -224,6 +430,7 @@ save_latency_info (client_value_record * cvr, struct timeval * curr_time) {
 static void 
 submit_old_value(client_value_record * cvr) {
     retried_count += 1;
+    cvr->retries += 1;
 
     //Leave value, value size and creation time unaltered
 
@@ -232,8 +439,9 @@ submit_old_value(client_value_record * cvr) {
     gettimeofday(&time_now, NULL);
     sum_timevals(&cvr->expire_time, &time_now, &values_timeout);
     
-    //Send the value to proposers and return immediately
-    pax_submit_nonblock(psh, cvr->value, cvr->value_size);
+    //Send the value to proposers and return immediately,
+    // same ticket so that it's delivered at most once
+    pax_submit_retry(psh, cvr->ticket, cvr->value, cvr->value_size);
 }
 
 size_t random_value_gen(char * buf) {
@@ -259,6 +467,7 @@ submit_new_value(client_value_record * cvr) {
     }
     
     cvr->value_size = random_value_gen(cvr->value);
+    cvr->retries = 0;
     
     //Set creation timestamp
     gettimeofday(&cvr->creation_time, NULL);
@@ -267,7 +476,8 @@ submit_new_value(client_value_record * cvr) {
     sum_timevals(&cvr->expire_time, &cvr->creation_time, &values_timeout);
     
     //Send the value to proposers and return immediately
-    pax_submit_nonblock(psh, cvr->value, cvr->value_size);
+    cvr->ticket = pax_submit_async(psh, cvr->value, cvr->value_size);
+    pax_submit_flush(psh);
     
 }
 
@@ -345,13 +555,23 @@ int cl_init() {
     evtimer_set(&cl_periodic_event, cl_periodic_timeout_check, NULL);    
     set_timeout_check();
     
+    if(snapshot_interval > 0) {
+        evtimer_set(&cl_snapshot_event, cl_snapshot, NULL);
+        cl_snapshot_tv.tv_sec = snapshot_interval;
+        cl_snapshot_tv.tv_usec = 0;
+        event_add(&cl_snapshot_event, &cl_snapshot_tv);
+    }
+    
     return 0;
 }
 
 void cl_deliver(char* value, size_t val_size, iid_t iid, ballot_t ballot, int proposer) {
 
     delivered_count += 1;
-    assert((int)iid == delivered_count);
+    //Many values can be delivered in the same instance, and none
+    // in no-ops or where all values are resubmitted duplicates
+    assert(iid >= last_iid);
+    last_iid = iid;
     
     struct timeval time_now;
     gettimeofday(&time_now, NULL);
@@ -428,6 +648,16 @@ int main (int argc, char const *argv[]) {
     
     printf("Latency - Avg:%.2f, Min:%.2f, Max:%.2f\n", 
         avg_lat_ms, min_lat_ms, max_lat_ms);
+    hist_print("Latency (us)", &latency_hist);
+    hist_print("Retries", &retries_hist);
+    hist_csv_row("total", duration, &latency_hist, 
+        ((double)delivered_count/duration));
+    if(csv_out != NULL) {
+        fclose(csv_out);
+    }
+    if(hist_path != NULL) {
+        hist_write_distribution(hist_path, &latency_hist);
+    }
         
     if(sample_frequency != 0) {
         printf("Latency samples: \n");
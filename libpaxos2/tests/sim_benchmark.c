@@ -0,0 +1,245 @@
+//Runs the acceptors, a proposer and a learner in this process,
+//on a simulated network (see pax_sim_start in libpaxos.h),
+//and reports throughput, latency and messages sent.
+//With the same options, the network makes the same random choices
+//(loss and jitter): can be used to compare the performance of two builds.
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "libpaxos.h"
+
+//Parameters
+static unsigned int total_values = 10000;
+static unsigned int concurrent_values = 30;
+static unsigned int value_size = 64;
+static int max_duration = 60;
+static paxos_sim_params params = {1000, 0, 0, 0, 1};
+
+static struct event_base * eb;
+static paxos_proposer * proposer;
+
+static unsigned int submitted_count = 0;
+static unsigned int delivered_count = 0;
+static unsigned int duplicated_count = 0;
+static char * delivered;
+static long * latencies;
+static struct timeval start_time;
+
+static struct event submit_event;
+static struct timeval submit_interval = {0, 10000};
+
+//The content of each value
+typedef struct sim_value_t {
+    unsigned int    seqno;
+    struct timeval  sent;
+} sim_value;
+
+void pusage() {
+    printf("sim_benchmark options:\n");
+    printf("\t-n N : deliver N values\n");
+    printf("\t-c N : submit N values concurrently\n");
+    printf("\t-s N : value size is N bytes\n");
+    printf("\t-d N : give up after N seconds\n");
+    printf("\t-l N : network latency is N microseconds\n");
+    printf("\t-j N : random jitter up to N microseconds (reorders messages)\n");
+    printf("\t-p N : lose N messages every 1000\n");
+    printf("\t-b N : each receiver gets N bytes per second (0 for unlimited)\n");
+    printf("\t-r N : seed of the simulated network is N\n");
+    printf("\t-h   : prints this message\n");
+}
+
+void parse_args(int argc, char * const argv[]) {
+    int c;
+    while((c = getopt(argc, argv, "n:c:s:d:l:j:p:b:r:h")) != -1) {
+        switch(c) {
+            case 'n': total_values = atoi(optarg); break;
+            case 'c': concurrent_values = atoi(optarg); break;
+            case 's': value_size = atoi(optarg); break;
+            case 'd': max_duration = atoi(optarg); break;
+            case 'l': params.latency = atol(optarg); break;
+            case 'j': params.jitter = atol(optarg); break;
+            case 'p': params.loss_permille = atoi(optarg); break;
+            case 'b': params.bandwidth = atol(optarg); break;
+            case 'r': params.seed = atoi(optarg); break;
+            case 'h':
+            default: {
+                pusage();
+                exit(0);
+            }
+        }
+    }
+    if(value_size < sizeof(sim_value) || value_size > PAXOS_MAX_VALUE_SIZE) {
+        printf("Value size must be between %lu and %d\n",
+            (unsigned long)sizeof(sim_value), PAXOS_MAX_VALUE_SIZE);
+        exit(1);
+    }
+}
+
+static long
+usecs_since(struct timeval * from, struct timeval * now) {
+    return (now->tv_sec - from->tv_sec) * 1000000 +
+        (now->tv_usec - from->tv_usec);
+}
+
+//Keeps concurrent_values submitted and not delivered
+static void
+submit_values() {
+    char buf[PAXOS_MAX_VALUE_SIZE];
+    sim_value * sv = (sim_value *)buf;
+
+    memset(buf, 0, value_size);
+    while(submitted_count < total_values &&
+        submitted_count - delivered_count < concurrent_values) {
+        sv->seqno = submitted_count;
+        gettimeofday(&sv->sent, NULL);
+        if(proposer_submit_sharedmem(proposer, buf, value_size) == PAXOS_SUBMIT_REJECTED) {
+            //Leader queue full, retried by the next check
+            break;
+        }
+        submitted_count++;
+    }
+}
+
+static void
+periodic_submit(int fd, short event, void * arg) {
+    struct timeval now;
+    (void)fd;
+    (void)event;
+    (void)arg;
+
+    gettimeofday(&now, NULL);
+    if(now.tv_sec - start_time.tv_sec >= max_duration) {
+        printf("Giving up after %d seconds\n", max_duration);
+        event_base_loopbreak(eb);
+        return;
+    }
+    submit_values();
+    event_add(&submit_event, &submit_interval);
+}
+
+static void
+sim_deliver(char * value, size_t size, iid_t iid, ballot_t ballot, int proposer_id, void * arg) {
+    sim_value * sv = (sim_value *)value;
+    struct timeval now;
+    (void)iid;
+    (void)ballot;
+    (void)proposer_id;
+    (void)arg;
+
+    if(size != value_size || sv->seqno >= total_values) {
+        printf("Unexpected value delivered (size:%lu)\n", (unsigned long)size);
+        return;
+    }
+
+    //Anonymous values may be decided twice after a timeout
+    if(delivered[sv->seqno]) {
+        duplicated_count++;
+        return;
+    }
+    delivered[sv->seqno] = 1;
+
+    gettimeofday(&now, NULL);
+    latencies[delivered_count] = usecs_since(&sv->sent, &now);
+    delivered_count++;
+
+    if(delivered_count == total_values) {
+        event_base_loopbreak(eb);
+        return;
+    }
+    submit_values();
+}
+
+static int
+compare_longs(const void * a, const void * b) {
+    long la = *(const long *)a, lb = *(const long *)b;
+    return (la > lb) - (la < lb);
+}
+
+static void
+print_results() {
+    struct timeval now;
+    unsigned int i;
+    double elapsed, sum = 0;
+    const char * metrics[] = {"sim_sent", "sim_delivered", "sim_dropped",
+        "sim_bytes", "sim_sent_prepare_reqs", "sim_sent_prepare_acks",
+        "sim_sent_accept_reqs", "sim_sent_accept_acks",
+        "sim_sent_repeat_reqs", "sim_sent_other"};
+
+    gettimeofday(&now, NULL);
+    elapsed = (double)usecs_since(&start_time, &now) / 1000000;
+
+    printf("Delivered:%u of %u (duplicates:%u) in %.2f s\n",
+        delivered_count, total_values, duplicated_count, elapsed);
+    printf("\tRate:%.1f values/s\n", delivered_count / elapsed);
+
+    if(delivered_count > 0) {
+        qsort(latencies, delivered_count, sizeof(long), compare_longs);
+        for(i = 0; i < delivered_count; i++) {
+            sum += latencies[i];
+        }
+        printf("Latency (us) - Avg:%.0f, Min:%ld, P50:%ld, P99:%ld, Max:%ld\n",
+            sum / delivered_count, latencies[0],
+            latencies[delivered_count / 2],
+            latencies[(delivered_count * 99) / 100],
+            latencies[delivered_count - 1]);
+    }
+
+    printf("Messages:\n");
+    for(i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+        printf("\t%s:%lld\n", metrics[i], pax_metric_value(metrics[i]));
+    }
+}
+
+int main (int argc, char const *argv[]) {
+    int i;
+
+    parse_args(argc, (char **)argv);
+    printf("values:%u concurrent:%u size:%u latency:%ld jitter:%ld loss:%d bandwidth:%ld seed:%u\n",
+        total_values, concurrent_values, value_size, params.latency,
+        params.jitter, params.loss_permille, params.bandwidth, params.seed);
+
+    delivered = calloc(total_values, 1);
+    latencies = malloc(sizeof(long) * total_values);
+
+    eb = event_base_new();
+    if(pax_sim_start(eb, &params) != 0) {
+        return 1;
+    }
+
+    //The number of acceptors may be set by the configuration file,
+    // which is loaded by the first role started: load it before
+    if(getenv("PAXOS_CONFIG") != NULL && 
+        pax_config_load(getenv("PAXOS_CONFIG")) != 0) {
+        return 1;
+    }
+    for(i = 0; i < pax_config()->acceptors; i++) {
+        if(acceptor_new(eb, 0, i, 0) == NULL) {
+            printf("Could not start acceptor %d\n", i);
+            return 1;
+        }
+    }
+    if(learner_new(eb, 0, sim_deliver, NULL) == NULL) {
+        printf("Could not start the learner\n");
+        return 1;
+    }
+    //Proposer 0 is the leader, no oracle
+    proposer = proposer_new(eb, 0, 0);
+    if(proposer == NULL) {
+        printf("Could not start the proposer\n");
+        return 1;
+    }
+
+    gettimeofday(&start_time, NULL);
+    evtimer_set(&submit_event, periodic_submit, NULL);
+    event_base_set(eb, &submit_event);
+    periodic_submit(0, 0, NULL);
+
+    event_base_dispatch(eb);
+
+    print_results();
+    return (delivered_count == total_values ? 0 : 1);
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libpaxos.h"
+#include "libpaxos_priv.h"
+#include "acceptor_stable_storage.h"
+
+//Not used by any acceptor, the DB of this id is deleted
+#define STORAGE_TEST_ACCEPTOR_ID 99
+
+//Instances around 2^32, where 32-bit keys would wrap or collide
+static iid_t test_iids[] = {1, 2, 0xFFFFFFFFULL, 0x100000000ULL,
+    0x100000001ULL, 0x200000001ULL};
+#define N_OF_TEST_IIDS (sizeof(test_iids) / sizeof(iid_t))
+
+static accept_req * accept_buffer;
+
+static void
+st_save(acceptor_storage * s, iid_t iid) {
+    accept_buffer->iid = iid;
+    accept_buffer->ballot = 101;
+    accept_buffer->value_size = snprintf(accept_buffer->value, 64,
+        "value of %"IID_FMT, iid) + 1;
+    stablestorage_save_accept(s, accept_buffer);
+}
+
+static int
+st_check(acceptor_storage * s, iid_t iid) {
+    char expected[64];
+    acceptor_record * rec = stablestorage_get_record(s, iid);
+
+    snprintf(expected, sizeof(expected), "value of %"IID_FMT, iid);
+    if(rec == NULL || rec->iid != iid || strcmp(rec->value, expected) != 0) {
+        printf("Wrong record for iid:%"IID_FMT"\n", iid);
+        return -1;
+    }
+    return 0;
+}
+
+int main (int argc, char const *argv[]) {
+    acceptor_storage * s;
+    size_t i;
+    int errors = 0;
+
+    UNUSED_ARG(argc);
+    UNUSED_ARG(argv);
+
+    if(paxos_config_ready() != 0) {
+        printf("Invalid configuration\n");
+        return 1;
+    }
+
+    accept_buffer = malloc(MAX_UDP_MSG_SIZE);
+    s = stablestorage_init(0, STORAGE_TEST_ACCEPTOR_ID, 0);
+    if(accept_buffer == NULL || s == NULL) {
+        printf("Stable storage init failed\n");
+        return 1;
+    }
+
+    stablestorage_tx_begin(s);
+    for(i = 0; i < N_OF_TEST_IIDS; i++) {
+        st_save(s, test_iids[i]);
+    }
+    stablestorage_tx_end(s);
+
+    stablestorage_tx_begin(s);
+    for(i = 0; i < N_OF_TEST_IIDS; i++) {
+        errors += (st_check(s, test_iids[i]) != 0);
+    }
+    //Never saved, but equal to a saved one in the low 32 bits
+    if(stablestorage_get_record(s, 0x100000002ULL) != NULL) {
+        printf("Found a record never saved\n");
+        errors++;
+    }
+    stablestorage_tx_end(s);
+
+    stablestorage_shutdown(s);
+    free(accept_buffer);
+
+    printf("Storage test %s\n", (errors == 0 ? "passed" : "FAILED"));
+    return (errors == 0 ? 0 : 1);
+}
@@ -21,6 +21,9 @@ struct timeval monitor_start;
 struct timeval sample_start;
 
 int monitor_initialized = 0;
+//Instance of the last value delivered
+// (an instance may contain many values)
+iid_t last_iid = 0;
 
 struct event update_check_event;
 struct timeval update_check_interval;
@@ -104,6 +107,7 @@ void my_deliver_fun(char* value, size_t value_size, iid_t iid, ballot_t ballot,
     if(!monitor_initialized) {
         monitor_initialized = 1;
         // assert(iid == 1);
+        last_iid = iid;
         gettimeofday(&monitor_start, NULL);
         sample_start.tv_sec = monitor_start.tv_sec;
         sample_start.tv_usec = monitor_start.tv_usec;
@@ -112,7 +116,10 @@ void my_deliver_fun(char* value, size_t value_size, iid_t iid, ballot_t ballot,
     
     last_sample_bytes += value_size;
     last_sample_delivered += 1;
-    assert((total_delivered + last_sample_delivered) == iid);
+    //Many values can be delivered in the same instance, and none
+    // in no-ops or where all values are resubmitted duplicates
+    assert(iid >= last_iid);
+    last_iid = iid;
     
     //Makes the compiler happy
     value = value; iid = iid, ballot = ballot; proposer = proposer;